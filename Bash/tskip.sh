@@ -46,12 +46,12 @@ cat /dev/stdin > $TMP_INPUT
 cat $TMP_INPUT | grep '^#' > $TMP_HEADER_FILE
 cat $TMP_INPUT | grep -v '^#' | tail -n +$nrow > $TMP_DATA_FILE
 
-if [ $print_header ]; then
+if [ "$print_header" = true ]; then
     cat $TMP_HEADER_FILE
 fi
 cat $TMP_DATA_FILE
 
-rm -f $TMP_INPUT_FILE
+rm -f $TMP_INPUT
 rm -f $TMP_HEADER_FILE
 rm -f $TMP_DATA_FILE
 
@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_linalg.h>
+
+#include "crossval.h"
+
+/* crossval.c -- choosing the order of a linear fit for tfitpoly and tfitsurf
+ *
+ * Each candidate fit uses a subset of the columns of one design matrix X
+ * (for a polynomial, the terms up to some order). Everything a linear fit
+ * needs from a set of rows is in its normal equations: the Gram matrix
+ * G = X^T W X and b = X^T W y. So the rows are read once, into the normal
+ * equations of each fold, and the global ones are their sum. A fit
+ * leaving out fold f solves the downdated system G - G_f, scaled to unit
+ * diagonal as linsolve.c scales its columns, and is then scored by its
+ * residuals over the rows of fold f. The (candidate, fold) fits are
+ * independent and run in parallel.
+ *
+ * Normal equations are only as good as the conditioning of X, so the
+ * columns should be built from centred and scaled abscissae (see
+ * crossval_scale). For polynomials this changes the basis but not the
+ * fits. */
+
+static const char *names[] = {"cv", "aic", "bic"};
+
+
+int crossval_criterion(const char *name)
+{
+    for (int k = 0; k < 3; k++)
+        if (!strcmp(name, names[k]))
+            return(k);
+    return(-1);
+}
+
+const char *crossval_name(int criterion)
+{
+    return(names[criterion]);
+}
+
+/* Normal equations of the rows f, f + nfold, f + 2 nfold, ... */
+static void gram(const gsl_matrix *X, const gsl_vector *w, const gsl_vector *y, size_t f, size_t nfold,
+                 double *G, double *b)
+{
+    const size_t n = X->size1;
+    const size_t p = X->size2;
+
+    for (size_t i = f; i < n; i += nfold) {
+        double wi = gsl_vector_get(w, i);
+        double yi = gsl_vector_get(y, i);
+        for (size_t j = 0; j < p; j++) {
+            double xj = wi*gsl_matrix_get(X, i, j);
+            for (size_t k = 0; k <= j; k++)
+                G[j*p + k] += xj*gsl_matrix_get(X, i, k);
+            b[j] += xj*yi;
+        }
+    }
+    for (size_t j = 0; j < p; j++)
+        for (size_t k = 0; k < j; k++)
+            G[k*p + j] = G[j*p + k];
+}
+
+/* Solve the normal equations restricted to the columns in use. The other
+ * coefficients are set to zero. The system is scaled to unit diagonal
+ * before it is factorized. */
+static int solve(const double *G, const double *b, const int *use, size_t p, double *c)
+{
+    size_t idx[p], m = 0;
+    double d[p];
+    int status;
+
+    for (size_t j = 0; j < p; j++) {
+        c[j] = 0.0;
+        if (use[j])
+            idx[m++] = j;
+    }
+    if (m == 0)
+        return(0);
+
+    gsl_matrix *A = gsl_matrix_alloc(m, m);
+    gsl_vector *r = gsl_vector_alloc(m);
+    gsl_vector *s = gsl_vector_alloc(m);
+    for (size_t j = 0; j < m; j++) {
+        d[j] = G[idx[j]*p + idx[j]] > 0.0 ? sqrt(G[idx[j]*p + idx[j]]) : 1.0;
+        for (size_t k = 0; k < j; k++) {
+            gsl_matrix_set(A, j, k, G[idx[j]*p + idx[k]]/(d[j]*d[k]));
+            gsl_matrix_set(A, k, j, gsl_matrix_get(A, j, k));
+        }
+        gsl_matrix_set(A, j, j, G[idx[j]*p + idx[j]]/(d[j]*d[j]));
+        gsl_vector_set(r, j, b[idx[j]]/d[j]);
+    }
+    status = gsl_linalg_cholesky_decomp(A);
+    if (!status)
+        status = gsl_linalg_cholesky_solve(A, r, s);
+    if (!status)
+        for (size_t j = 0; j < m; j++)
+            c[idx[j]] = gsl_vector_get(s, j)/d[j];
+    gsl_matrix_free(A);
+    gsl_vector_free(r);
+    gsl_vector_free(s);
+    return(status);
+}
+
+/* Weighted sum of squared residuals of coefficients c over the rows
+ * f, f + nfold, f + 2 nfold, ... These are summed directly: expanding
+ * them through the normal equations cancels badly when the fit is good. */
+static double residual(const gsl_matrix *X, const gsl_vector *w, const gsl_vector *y, size_t f, size_t nfold,
+                       const double *c)
+{
+    const size_t n = X->size1;
+    const size_t p = X->size2;
+    double s = 0.0;
+
+    for (size_t i = f; i < n; i += nfold) {
+        double r = gsl_vector_get(y, i);
+        for (size_t j = 0; j < p; j++)
+            if (c[j] != 0.0)
+                r -= c[j]*gsl_matrix_get(X, i, j);
+        s += gsl_vector_get(w, i)*r*r;
+    }
+    return(s);
+}
+
+/* Centre and scale for abscissae x: the middle of their range and half
+ * its width (1 if they are all equal). Building the design matrix from
+ * (x - x0)/dx keeps the Gram matrices well conditioned even for offset
+ * abscissae such as Julian dates. */
+void crossval_scale(const double *x, size_t n, double *x0, double *dx)
+{
+    double lo = n > 0 ? x[0] : 0.0, hi = lo;
+
+    for (size_t i = 1; i < n; i++) {
+        if (x[i] < lo) lo = x[i];
+        if (x[i] > hi) hi = x[i];
+    }
+    *x0 = 0.5*(lo + hi);
+    *dx = hi > lo ? 0.5*(hi - lo) : 1.0;
+}
+
+/* Score ncand candidate fits, the m'th using the columns j of X for which
+ * use[m*p + j] is nonzero, and return the index of the best (the first, if
+ * several tie). The score is the mean squared residual of nfold-fold cross
+ * validation, or chisq plus the AIC or BIC penalty. If the weights are not
+ * inverse variances (known_sigma = 0) chisq is replaced by n ln(RSS/n). */
+int crossval_select(const gsl_matrix *X, const gsl_vector *w, const gsl_vector *y,
+                    size_t ncand, const int *use, int criterion, int nfold, int known_sigma,
+                    double *score)
+{
+    const size_t n = X->size1;
+    const size_t p = X->size2;
+    const int nf = criterion == CROSSVAL_CV ? nfold : 1;
+    double *G = (double *) calloc((nf + 1)*p*p, sizeof(double));
+    double *b = (double *) calloc((nf + 1)*p, sizeof(double));
+    double *partial = (double *) malloc(ncand*nf*sizeof(double));
+    gsl_error_handler_t *handler = gsl_set_error_handler_off();
+    size_t best = 0;
+    long t;
+
+    /* Slot 0 holds the global normal equations, slots 1..nf the folds */
+    #pragma omp parallel for
+    for (int f = 0; f < nf; f++)
+        gram(X, w, y, f, nf, G + (f + 1)*p*p, b + (f + 1)*p);
+    for (int f = 1; f <= nf; f++) {
+        for (size_t j = 0; j < p*p; j++)
+            G[j] += G[f*p*p + j];
+        for (size_t j = 0; j < p; j++)
+            b[j] += b[f*p + j];
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (t = 0; t < (long) (ncand*nf); t++) {
+        const size_t m = t/nf;
+        const int f = t % nf + 1;
+        double Gt[p*p], bt[p], c[p];
+
+        if (criterion == CROSSVAL_CV) {
+            for (size_t j = 0; j < p*p; j++)
+                Gt[j] = G[j] - G[f*p*p + j];
+            for (size_t j = 0; j < p; j++)
+                bt[j] = b[j] - b[f*p + j];
+            partial[t] = solve(Gt, bt, use + m*p, p, c) ? GSL_POSINF
+                       : residual(X, w, y, f - 1, nf, c);
+        }
+        else
+            partial[t] = solve(G, b, use + m*p, p, c) ? GSL_POSINF : residual(X, w, y, 0, 1, c);
+    }
+
+    /* Combine in a fixed order so the answer does not depend on the threads */
+    for (size_t m = 0; m < ncand; m++) {
+        double chisq = 0.0;
+        int k = 0;
+
+        for (int f = 0; f < nf; f++)
+            chisq += partial[m*nf + f];
+        for (size_t j = 0; j < p; j++)
+            k += use[m*p + j] != 0;
+        if (!known_sigma && criterion != CROSSVAL_CV)
+            chisq = n*log(chisq/n);
+        switch (criterion) {
+            case CROSSVAL_CV:
+                score[m] = chisq/n;
+                break;
+            case CROSSVAL_AIC:
+                score[m] = chisq + 2.0*k;
+                break;
+            case CROSSVAL_BIC:
+                score[m] = chisq + k*log((double) n);
+                break;
+        }
+        if (score[m] < score[best])
+            best = m;
+    }
+
+    gsl_set_error_handler(handler);
+    free(G);
+    free(b);
+    free(partial);
+    return((int) best);
+}
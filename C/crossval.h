@@ -0,0 +1,15 @@
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+
+/* crossval.h -- choosing which terms of a linear fit to keep */
+
+#define CROSSVAL_CV  0
+#define CROSSVAL_AIC 1
+#define CROSSVAL_BIC 2
+
+int crossval_criterion(const char *name);
+const char *crossval_name(int criterion);
+void crossval_scale(const double *x, size_t n, double *x0, double *dx);
+int crossval_select(const gsl_matrix *X, const gsl_vector *w, const gsl_vector *y,
+                    size_t ncand, const int *use, int criterion, int nfold, int known_sigma,
+                    double *score);
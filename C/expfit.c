@@ -3,69 +3,91 @@
 #include <gsl/gsl_blas.h>
 
 #include "expfit.h"
+#include "fastexp.h"
 
 /* expfit.c -- model functions for exponential + background */
 
 
-/* Residuals from the weighted exponential model */
-int expb_f (const gsl_vector *x, void *data, gsl_vector *f)
+/* The fused kernel, in the form of a tfitdist model component (see
+ * models.h): adds A*exp(-lambda*x) + b into m and writes the partials,
+ * times w[i], into J. A NULL w means unit weights. */
+void expb_eval(const double *p, const double *x, const double *w, size_t n,
+               double *m, double *J, size_t tda)
 {
-    size_t n = ((struct data *)data)->n;
-    double *y = ((struct data *)data)->y;
-    double *sigma = ((struct data *) data)->sigma;
-
-    double A = gsl_vector_get (x, 0);
-    double lambda = gsl_vector_get (x, 1);
-    double b = gsl_vector_get (x, 2);
-
+    double A = p[0];
+    double lambda = p[1];
+    double b = p[2];
     size_t i;
 
     for (i = 0; i < n; i++)
     {
-        /* Model Yi = A * exp(-lambda * i) + b */
-        double t = i;
-        double Yi = A * exp (-lambda * t) + b;
-        gsl_vector_set (f, i, (Yi - y[i])/sigma[i]);
+        double e = fast_exp(-lambda * x[i]);
+        if (m)
+            m[i] += A*e + b;
+        if (J) {
+            double wi = w ? w[i] : 1.0;
+            J[i*tda]     = e*wi;                 /* dfi/dA      */
+            J[i*tda + 1] = -x[i]*A*e*wi;         /* dfi/dlambda */
+            J[i*tda + 2] = wi;                   /* dfi/db      */
+        }
     }
-
-    return GSL_SUCCESS;
 }
 
-/* The Jacobian of the exponenial model */
-int expb_df (const gsl_vector *x, void *data, gsl_matrix *J)
+/* Turn the model values in f into weighted residuals and scale the rows
+ * of J by 1/sigma. Either may be NULL. */
+static void weight(const struct expb_data *d, gsl_vector *f, gsl_matrix *J)
 {
-    size_t n = ((struct data *)data)->n;
-    double *sigma = ((struct data *) data)->sigma;
-
-    double A = gsl_vector_get (x, 0);
-    double lambda = gsl_vector_get (x, 1);
-
     size_t i;
 
-    for (i = 0; i < n; i++)
+    for (i = 0; i < d->n; i++)
     {
-        /* Jacobian matrix J(i,j) = dfi / dxj, */
-        /* where fi = (Yi - yi)/sigma[i],      */
-        /*       Yi = A * exp(-lambda * i) + b  */
-        /* and the xj are the parameters (A,lambda,b) */
-        double t = i;
-        double s = sigma[i];
-        double e = exp(-lambda * t);
-        gsl_matrix_set (J, i, 0, e/s); 
-        gsl_matrix_set (J, i, 1, -t * A * e/s);
-        gsl_matrix_set (J, i, 2, 1/s);
+        double is = 1.0/d->sigma[i];
+        if (f)
+            f->data[i] = (f->data[i] - d->y[i])*is;
+        if (J) {
+            J->data[i*J->tda]     *= is;
+            J->data[i*J->tda + 1] *= is;
+            J->data[i*J->tda + 2] *= is;
+        }
     }
-    return GSL_SUCCESS;
 }
 
-/* Convenience function to evaluate both the exponential model and its Jacobian */
-int expb_fdf (const gsl_vector *x, void *data, gsl_vector *f, gsl_matrix *J)
+/* The GSL solver callbacks. The solver's f is contiguous, so the model is
+ * built in place. */
+
+/* Residuals from the weighted exponential model */
+int expb_f (const gsl_vector *x, void *data, gsl_vector *f)
 {
-    expb_f (x, data, f);
-    expb_df (x, data, J);
+    struct expb_data *d = (struct expb_data *)data;
 
+    gsl_vector_set_zero(f);
+    expb_eval(x->data, d->x, NULL, d->n, f->data, NULL, 0);
+    weight(d, f, NULL);
     return GSL_SUCCESS;
 }
 
+/* The Jacobian of the exponenial model */
+int expb_df (const gsl_vector *x, void *data, gsl_matrix *J)
+{
+    struct expb_data *d = (struct expb_data *)data;
+
+    /* Jacobian matrix J(i,j) = dfi / dxj, */
+    /* where fi = (Yi - yi)/sigma[i],      */
+    /*       Yi = A * exp(-lambda * t) + b  */
+    /* and the xj are the parameters (A,lambda,b) */
+    expb_eval(x->data, d->x, NULL, d->n, NULL, J->data, J->tda);
+    weight(d, NULL, J);
+    return GSL_SUCCESS;
+}
 
+/* Evaluate the exponential model and its Jacobian in one pass, computing
+ * each exponential once */
+int expb_fdf (const gsl_vector *x, void *data, gsl_vector *f, gsl_matrix *J)
+{
+    struct expb_data *d = (struct expb_data *)data;
 
+    gsl_vector_set_zero(f);
+    expb_eval(x->data, d->x, NULL, d->n, f->data, J->data, J->tda);
+    weight(d, f, J);
+    return GSL_SUCCESS;
+}
@@ -4,12 +4,15 @@
 
 /* expfit.c -- model functions for exponential + background */
 
-struct data {
+struct expb_data {
     size_t n;
+    double * x;
     double * y;
     double * sigma;
 };
 
+void expb_eval(const double *p, const double *x, const double *w, size_t n,
+               double *m, double *J, size_t tda);
 int expb_f (const gsl_vector * x, void *data, gsl_vector * f);
 int expb_df (const gsl_vector * x, void *data, gsl_matrix * J);
 int expb_fdf (const gsl_vector * x, void *data, gsl_vector * f, gsl_matrix * J);
@@ -0,0 +1,996 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+#include "expr.h"
+
+/* expr.c -- compiled row expressions for tfilter and tcalc
+ *
+ * The Perl tools rewrite each column name in an expression into
+ * $column[N] and eval the result on every row. Here the rewritten string
+ * is parsed once, with Perl's precedence rules, into a tree, and the tree
+ * is evaluated a batch of rows at a time. A predicate is evaluated on a
+ * selection vector (the indices of the rows still in play): && passes
+ * only the rows its left side selected on to its right side, and || only
+ * the rows its left side rejected, so both short-circuit row by row just
+ * as in Perl. Fields are only converted to numbers when a row reaches the
+ * node that needs them.
+ *
+ * Several expressions (tcalc's output columns) can be optimized together:
+ * constant subexpressions are folded, and identical subexpressions,
+ * within one expression or across several, are merged so that each is
+ * computed once per batch.
+ *
+ * As in Perl, a bareword that is not a column name is a string (so
+ * "IMAGE_TYPE eq light" works), strings compare bytewise with eq, ne, lt,
+ * gt, le and ge, and a row whose evaluation dies (a division by zero, the
+ * log of a negative number) is dropped. */
+
+enum {
+    N_NUM, N_STR, N_COL,
+    N_NEG, N_NOT, N_ADD, N_SUB, N_MUL, N_DIV, N_MOD, N_POW,
+    N_LT, N_LE, N_GT, N_GE, N_EQ, N_NE,
+    N_SLT, N_SLE, N_SGT, N_SGE, N_SEQ, N_SNE,
+    N_AND, N_OR, N_FN1, N_FN2
+};
+
+struct node {
+    int op;
+    double num;             /* value of a constant */
+    char *str;              /* text of a constant */
+    size_t len;
+    int col;
+    double (*fn1)(double);
+    double (*fn2)(double, double);
+    struct node *a, *b;
+    double *v;              /* values over a batch */
+    char *bad;              /* rows whose evaluation failed, here or below */
+    char *side;             /* operand (0 or 1) an && or || took its value from */
+    int *s1, *s2, *s3;      /* selections over a batch */
+    unsigned long stamp;    /* batch v was last computed for in full */
+    int refs;               /* expressions and nodes pointing here */
+};
+
+static double perl_int(double x) { return(x < 0.0 ? ceil(x) : floor(x)); }
+
+static const struct {
+    const char *name;
+    double (*fn1)(double);
+    double (*fn2)(double, double);
+} functions[] = {
+    {"abs", fabs, NULL}, {"fabs", fabs, NULL}, {"sqrt", sqrt, NULL}, {"log", log, NULL},
+    {"log10", log10, NULL}, {"exp", exp, NULL}, {"int", perl_int, NULL},
+    {"floor", floor, NULL}, {"ceil", ceil, NULL}, {"sin", sin, NULL}, {"cos", cos, NULL},
+    {"tan", tan, NULL}, {"asin", asin, NULL}, {"acos", acos, NULL}, {"atan", atan, NULL},
+    {"sinh", sinh, NULL}, {"cosh", cosh, NULL}, {"tanh", tanh, NULL},
+    {"atan2", NULL, atan2}, {"pow", NULL, pow}, {"fmod", NULL, fmod},
+    {NULL, NULL, NULL}
+};
+
+
+/* HEADER REWRITING */
+
+static int isword(int c)
+{
+    return(isalnum(c) || c == '_');
+}
+
+/* Perl's s/\bkeyword\b/\$column[col]/g */
+char *expr_substitute(const char *s, const char *keyword, int col)
+{
+    size_t n = strlen(s), k = strlen(keyword), m = 0;
+    char name[32];
+    size_t nl = snprintf(name, sizeof(name), "$column[%d]", col);
+    char *out = (char *) malloc(n*(nl > k ? nl : 1) + 1);
+
+    for (size_t i = 0; i < n; ) {
+        if (k > 0 && !strncmp(s + i, keyword, k)
+            && (i == 0 ? 0 : isword((unsigned char) s[i-1])) != isword((unsigned char) s[i])
+            && isword((unsigned char) s[i+k-1]) != (i + k < n ? isword((unsigned char) s[i+k]) : 0)) {
+            memcpy(out + m, name, nl);
+            m += nl;
+            i += k;
+        }
+        else
+            out[m++] = s[i++];
+    }
+    out[m] = '\0';
+    return(out);
+}
+
+/* The keyword of a header line is its third whitespace-separated field
+ * (e.g. "#   3 MAG_AUTO  Kron-like magnitude"). Returns 0 if there is none. */
+int expr_header_keyword(const char *line, size_t len, char *keyword, size_t size)
+{
+    size_t i = 0, start = 0, l;
+
+    for (int field = 0; field < 3; field++) {
+        while (i < len && isspace((unsigned char) line[i]))
+            i++;
+        start = i;
+        while (i < len && !isspace((unsigned char) line[i]))
+            i++;
+    }
+    l = i - start;
+    if (l == 0 || l >= size)
+        return(0);
+    memcpy(keyword, line + start, l);
+    keyword[l] = '\0';
+    return(1);
+}
+
+
+/* PARSER */
+
+struct parser {
+    const char *s;
+    size_t i;
+    int maxcol;
+    char *err;
+    size_t errlen;
+    int failed;
+};
+
+static struct node *parse_low_or(struct parser *p);
+
+static struct node *node_new(int op, struct node *a, struct node *b)
+{
+    struct node *n = (struct node *) calloc(1, sizeof(struct node));
+    n->op = op;
+    n->a = a;
+    n->b = b;
+    n->col = -1;
+    n->refs = 1;
+    n->v = (double *) malloc(EXPR_BATCH*sizeof(double));
+    n->bad = (char *) calloc(EXPR_BATCH, sizeof(char));
+    if (op == N_AND || op == N_OR)
+        n->side = (char *) malloc(EXPR_BATCH*sizeof(char));
+    n->s1 = (int *) malloc(EXPR_BATCH*sizeof(int));
+    n->s2 = (int *) malloc(EXPR_BATCH*sizeof(int));
+    n->s3 = (int *) malloc(EXPR_BATCH*sizeof(int));
+    return(n);
+}
+
+static void node_free(struct node *n)
+{
+    if (!n || --n->refs > 0)
+        return;
+    node_free(n->a);
+    node_free(n->b);
+    free(n->str);
+    free(n->v);
+    free(n->bad);
+    free(n->side);
+    free(n->s1);
+    free(n->s2);
+    free(n->s3);
+    free(n);
+}
+
+static struct node *fail(struct parser *p, const char *msg)
+{
+    if (!p->failed)
+        snprintf(p->err, p->errlen, "%s at offset %zu of \"%s\"", msg, p->i, p->s);
+    p->failed = 1;
+    return(NULL);
+}
+
+static void skip_space(struct parser *p)
+{
+    while (isspace((unsigned char) p->s[p->i]))
+        p->i++;
+}
+
+/* Match an operator (symbols) or a word operator (which must not run on
+ * into a longer word) */
+static int accept(struct parser *p, const char *op)
+{
+    size_t n = strlen(op);
+
+    skip_space(p);
+    if (strncmp(p->s + p->i, op, n))
+        return(0);
+    if (isword((unsigned char) op[0]) && isword((unsigned char) p->s[p->i + n]))
+        return(0);
+    /* Don't take "<" out of "<=", "*" out of "**" and so on */
+    if (!isword((unsigned char) op[0]) && n == 1 && p->s[p->i + 1] == '=' && strchr("<>=!", op[0]))
+        return(0);
+    if (!strcmp(op, "*") && p->s[p->i + 1] == '*')
+        return(0);
+    p->i += n;
+    return(1);
+}
+
+/* Write a number as Perl prints it: zero as 0, Inf and NaN as such, an
+ * integer (see is_integer) in full, and anything else with 15 significant
+ * digits */
+static int format_number(double x, int integer, char *buf, size_t size)
+{
+    if (isnan(x))
+        return(snprintf(buf, size, "NaN"));
+    if (isinf(x))
+        return(snprintf(buf, size, "%sInf", x < 0 ? "-" : ""));
+    if (x == 0.0)
+        return(snprintf(buf, size, "0"));
+    if (integer)
+        return(snprintf(buf, size, "%lld", (long long) x));
+    return(snprintf(buf, size, "%.15g", x));
+}
+
+/* Whether Perl would hold x as an integer operand: a whole number it can
+ * convert exactly, i.e. below 2^53 */
+static int exact_integer(double x)
+{
+    return(x == floor(x) && fabs(x) < 9007199254740992.0);
+}
+
+/* Whether Perl would hold the value of node n at row i as an integer, and
+ * so print it in full. It does for the result of %, of int(), and of +,
+ * -, * and abs() on integer operands, as long as it fits in 64 bits. */
+static int is_integer(const struct node *n, int i)
+{
+    double x = n->v[i];
+
+    if (!(x == floor(x) && fabs(x) < 9223372036854775808.0))
+        return(0);
+    switch (n->op) {
+        case N_MOD:
+            return(1);
+        case N_NEG:
+            return(exact_integer(n->a->v[i]));
+        case N_ADD: case N_SUB: case N_MUL:
+            return(exact_integer(n->a->v[i]) && exact_integer(n->b->v[i]));
+        case N_FN1:
+            return(n->fn1 == perl_int || (n->fn1 == fabs && exact_integer(n->a->v[i])));
+    }
+    return(0);
+}
+
+static struct node *constant(double x, const char *text, size_t len)
+{
+    struct node *n = node_new(N_NUM, NULL, NULL);
+    char buf[64];
+
+    n->num = x;
+    if (!text) {
+        len = format_number(x, 0, buf, sizeof(buf));
+        text = buf;
+    }
+    n->str = (char *) malloc(len + 1);
+    memcpy(n->str, text, len);
+    n->str[len] = '\0';
+    n->len = len;
+    return(n);
+}
+
+static struct node *parse_term(struct parser *p)
+{
+    const char *s;
+    struct node *n;
+
+    skip_space(p);
+    s = p->s + p->i;
+
+    if (*s == '(') {
+        p->i++;
+        n = parse_low_or(p);
+        if (!accept(p, ")"))
+            return(fail(p, "missing )"));
+        return(n);
+    }
+
+    if (isdigit((unsigned char) *s) || (*s == '.' && isdigit((unsigned char) s[1]))) {
+        char *end, *iend, text[32];
+        double x = strtod(s, &end);
+        long long k;
+        p->i += end - s;
+        /* An integer literal prints exactly, as Perl keeps it as an
+         * integer, even where the double has rounded it */
+        errno = 0;
+        k = strtoll(s, &iend, 10);
+        if (iend == end && errno == 0)
+            return(constant(x, text, snprintf(text, sizeof(text), "%lld", k)));
+        return(constant(x, NULL, 0));
+    }
+
+    if (*s == '\'' || *s == '"') {
+        const char *q = strchr(s + 1, *s);
+        if (!q)
+            return(fail(p, "unterminated string"));
+        n = node_new(N_STR, NULL, NULL);
+        n->len = q - s - 1;
+        n->str = (char *) malloc(n->len + 1);
+        memcpy(n->str, s + 1, n->len);
+        n->str[n->len] = '\0';
+        n->num = atof(n->str);
+        p->i += n->len + 2;
+        return(n);
+    }
+
+    if (!strncmp(s, "$column[", 8)) {
+        char *end;
+        long col = strtol(s + 8, &end, 10);
+        if (end == s + 8 || *end != ']' || col < 0)
+            return(fail(p, "bad column reference"));
+        n = node_new(N_COL, NULL, NULL);
+        n->col = (int) col;
+        if (col > p->maxcol)
+            p->maxcol = (int) col;
+        p->i += end + 1 - s;
+        return(n);
+    }
+
+    if (isalpha((unsigned char) *s) || *s == '_') {
+        size_t l = 0;
+        while (isword((unsigned char) s[l]))
+            l++;
+        p->i += l;
+        skip_space(p);
+        if (p->s[p->i] == '(') {
+            /* A function call */
+            int k;
+            for (k = 0; functions[k].name; k++)
+                if (strlen(functions[k].name) == l && !strncmp(functions[k].name, s, l))
+                    break;
+            if (!functions[k].name)
+                return(fail(p, "unknown function"));
+            p->i++;
+            if (functions[k].fn1) {
+                n = node_new(N_FN1, parse_low_or(p), NULL);
+                n->fn1 = functions[k].fn1;
+            }
+            else {
+                struct node *a = parse_low_or(p);
+                if (!accept(p, ","))
+                    return(fail(p, "expected two arguments"));
+                n = node_new(N_FN2, a, parse_low_or(p));
+                n->fn2 = functions[k].fn2;
+            }
+            if (!accept(p, ")"))
+                return(fail(p, "missing )"));
+            return(n);
+        }
+        /* A bareword */
+        n = node_new(N_STR, NULL, NULL);
+        n->len = l;
+        n->str = (char *) malloc(l + 1);
+        memcpy(n->str, s, l);
+        n->str[l] = '\0';
+        n->num = 0.0;
+        return(n);
+    }
+
+    return(fail(p, *s ? "unexpected character" : "unexpected end of expression"));
+}
+
+static struct node *parse_unary(struct parser *p);
+
+static struct node *parse_power(struct parser *p)
+{
+    struct node *n = parse_term(p);
+
+    if (n && accept(p, "**"))
+        return(node_new(N_POW, n, parse_unary(p)));
+    return(n);
+}
+
+static struct node *parse_or(struct parser *p);
+
+static struct node *parse_unary(struct parser *p)
+{
+    /* Perl's "not" takes everything to its right down to "and" and "or" */
+    if (accept(p, "not"))
+        return(node_new(N_NOT, parse_or(p), NULL));
+    if (accept(p, "!"))
+        return(node_new(N_NOT, parse_unary(p), NULL));
+    if (accept(p, "-"))
+        return(node_new(N_NEG, parse_unary(p), NULL));
+    if (accept(p, "+"))
+        return(parse_unary(p));
+    return(parse_power(p));
+}
+
+/* One level of left-associative binary operators */
+static struct node *parse_binary(struct parser *p, struct node *(*next)(struct parser *),
+                                 const char **ops, const int *codes)
+{
+    struct node *n = next(p);
+
+    while (n && !p->failed) {
+        int k;
+        for (k = 0; ops[k]; k++)
+            if (accept(p, ops[k]))
+                break;
+        if (!ops[k])
+            break;
+        n = node_new(codes[k], n, next(p));
+    }
+    return(n);
+}
+
+static struct node *parse_mul(struct parser *p)
+{
+    static const char *ops[] = {"*", "/", "%", NULL};
+    static const int codes[] = {N_MUL, N_DIV, N_MOD};
+    return(parse_binary(p, parse_unary, ops, codes));
+}
+
+static struct node *parse_add(struct parser *p)
+{
+    static const char *ops[] = {"+", "-", NULL};
+    static const int codes[] = {N_ADD, N_SUB};
+    return(parse_binary(p, parse_mul, ops, codes));
+}
+
+static struct node *parse_rel(struct parser *p)
+{
+    static const char *ops[] = {"<=", ">=", "<", ">", "lt", "gt", "le", "ge", NULL};
+    static const int codes[] = {N_LE, N_GE, N_LT, N_GT, N_SLT, N_SGT, N_SLE, N_SGE};
+    return(parse_binary(p, parse_add, ops, codes));
+}
+
+static struct node *parse_eq(struct parser *p)
+{
+    static const char *ops[] = {"==", "!=", "eq", "ne", NULL};
+    static const int codes[] = {N_EQ, N_NE, N_SEQ, N_SNE};
+    return(parse_binary(p, parse_rel, ops, codes));
+}
+
+static struct node *parse_and(struct parser *p)
+{
+    static const char *ops[] = {"&&", NULL};
+    static const int codes[] = {N_AND};
+    return(parse_binary(p, parse_eq, ops, codes));
+}
+
+static struct node *parse_or(struct parser *p)
+{
+    static const char *ops[] = {"||", NULL};
+    static const int codes[] = {N_OR};
+    return(parse_binary(p, parse_and, ops, codes));
+}
+
+static struct node *parse_low_and(struct parser *p)
+{
+    static const char *ops[] = {"and", NULL};
+    static const int codes[] = {N_AND};
+    return(parse_binary(p, parse_or, ops, codes));
+}
+
+static struct node *parse_low_or(struct parser *p)
+{
+    static const char *ops[] = {"or", NULL};
+    static const int codes[] = {N_OR};
+    return(parse_binary(p, parse_low_and, ops, codes));
+}
+
+/* Compile an expression in which the columns have been rewritten as
+ * $column[N]. Returns 1 (with a message in err) on a syntax error. */
+int expr_compile(struct expr *e, const char *s, char *err, size_t errlen)
+{
+    struct parser p = {s, 0, -1, err, errlen, 0};
+
+    e->root = parse_low_or(&p);
+    skip_space(&p);
+    if (!p.failed && p.s[p.i] != '\0')
+        fail(&p, "unexpected text");
+    if (p.failed) {
+        node_free(e->root);
+        e->root = NULL;
+        return(1);
+    }
+    e->maxcol = p.maxcol;
+    return(0);
+}
+
+void expr_free(struct expr *e)
+{
+    node_free(e->root);
+    e->root = NULL;
+}
+
+
+/* BATCHES */
+
+void expr_batch_free(struct expr_batch *b)
+{
+    free(b->tok);
+    free(b->toklen);
+    b->tok = NULL;
+    b->toklen = NULL;
+    b->cap = 0;
+}
+
+/* Split n lines into their first ncol fields. Missing fields are empty. */
+int expr_batch_split(struct expr_batch *b, const char **line, const size_t *len, int n, int ncol)
+{
+    if (ncol < 1)
+        ncol = 1;
+    if ((size_t) n*ncol > b->cap) {
+        b->cap = (size_t) n*ncol;
+        b->tok = (const char **) realloc(b->tok, b->cap*sizeof(const char *));
+        b->toklen = (int *) realloc(b->toklen, b->cap*sizeof(int));
+    }
+    b->n = n;
+    b->ncol = ncol;
+    for (int i = 0; i < n; i++) {
+        const char *s = line[i], *end = line[i] + len[i];
+        for (int k = 0; k < ncol; k++) {
+            while (s < end && isspace((unsigned char) *s))
+                s++;
+            b->tok[i*ncol + k] = s;
+            while (s < end && !isspace((unsigned char) *s))
+                s++;
+            b->toklen[i*ncol + k] = (int) (s - b->tok[i*ncol + k]);
+        }
+    }
+    b->stamp++;
+    return(0);
+}
+
+
+/* EVALUATION */
+
+/* Perl's numeric value of a field: its leading number, or 0 */
+static double field_value(const char *s, int len)
+{
+    char buf[64], *end;
+    double x;
+
+    if (len == 0)
+        return(0.0);
+    if (len >= (int) sizeof(buf))
+        len = sizeof(buf) - 1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    x = strtod(buf, &end);
+    return(end == buf ? 0.0 : x);
+}
+
+/* Perl's truth of a string: false if empty or "0" */
+static int string_true(const char *s, size_t len)
+{
+    return(!(len == 0 || (len == 1 && s[0] == '0')));
+}
+
+static void eval_num(struct node *n, struct expr_batch *b, const int *sel, int ns);
+static int eval_bool(struct node *n, struct expr_batch *b, const int *in, int nin, int *out);
+static int difference(const int *in, int nin, const int *a, int na, int *out);
+
+/* The string value of node n for row i, after eval_num() has run on a
+ * selection holding it if the node is not a field or a constant */
+static const char *string_value(struct node *n, struct expr_batch *b, int i, char *buf, size_t *len)
+{
+    switch (n->op) {
+        case N_COL:
+            *len = b->toklen[i*b->ncol + n->col];
+            return(b->tok[i*b->ncol + n->col]);
+        case N_NUM:
+        case N_STR:
+            *len = n->len;
+            return(n->str);
+    }
+    *len = format_number(n->v[i], is_integer(n, i), buf, 64);
+    return(buf);
+}
+
+static int compare_strings(const char *a, size_t la, const char *b, size_t lb)
+{
+    int c = memcmp(a, b, la < lb ? la : lb);
+    if (c)
+        return(c);
+    return((la > lb) - (la < lb));
+}
+
+/* Loop over the rows of a selection. When it holds the whole batch the
+ * rows are visited directly, so the compiler can vectorize the loop. */
+#define FOR_ROWS(body) do { \
+        if (full) for (i = 0; i < ns; i++) { body; } \
+        else for (k = 0; k < ns; k++) { i = sel[k]; body; } \
+    } while (0)
+
+/* Fill n->v for the rows in sel, and n->bad with the rows for which this
+ * node or one below it failed (as a Perl die would). A node shared by several expressions
+ * (see expr_optimize) is computed once per batch: after it has been
+ * evaluated on the whole batch it is marked with the batch's stamp. */
+static void eval_num(struct node *n, struct expr_batch *b, const int *sel, int ns)
+{
+    double *v = n->v;
+    char *bad = n->bad;
+    const double *x, *y;
+    const int full = (ns == b->n);
+    int i, k;
+
+    if (full && n->stamp == b->stamp)
+        return;
+
+    switch (n->op) {
+        case N_NUM:
+        case N_STR:
+            FOR_ROWS(v[i] = n->num);
+            break;
+        case N_COL:
+            FOR_ROWS(v[i] = field_value(b->tok[i*b->ncol + n->col], b->toklen[i*b->ncol + n->col]));
+            break;
+        case N_NEG:
+            eval_num(n->a, b, sel, ns);
+            x = n->a->v;
+            FOR_ROWS(v[i] = -x[i]);
+            FOR_ROWS(bad[i] = n->a->bad[i]);
+            break;
+        case N_FN1:
+            eval_num(n->a, b, sel, ns);
+            x = n->a->v;
+            FOR_ROWS(v[i] = n->fn1(x[i]));
+            /* Perl dies on a domain error (the log of 0 or less, the sqrt
+             * of a negative number) but not on an overflow to Inf */
+            FOR_ROWS(bad[i] = n->a->bad[i] || (!isnan(x[i]) && isnan(v[i])) || (n->fn1 == log && x[i] == 0.0));
+            break;
+        case N_FN2:
+            eval_num(n->a, b, sel, ns);
+            eval_num(n->b, b, sel, ns);
+            x = n->a->v;
+            y = n->b->v;
+            FOR_ROWS(v[i] = n->fn2(x[i], y[i]));
+            FOR_ROWS(bad[i] = n->a->bad[i] || n->b->bad[i] || (!isnan(x[i]) && !isnan(y[i]) && isnan(v[i])));
+            break;
+        case N_ADD: case N_SUB: case N_MUL: case N_DIV: case N_MOD: case N_POW:
+            eval_num(n->a, b, sel, ns);
+            eval_num(n->b, b, sel, ns);
+            x = n->a->v;
+            y = n->b->v;
+            FOR_ROWS(bad[i] = n->a->bad[i] || n->b->bad[i]);
+            switch (n->op) {
+                case N_ADD:
+                    FOR_ROWS(v[i] = x[i] + y[i]);
+                    break;
+                case N_SUB:
+                    FOR_ROWS(v[i] = x[i] - y[i]);
+                    break;
+                case N_MUL:
+                    FOR_ROWS(v[i] = x[i]*y[i]);
+                    break;
+                case N_DIV:
+                    FOR_ROWS(v[i] = x[i]/y[i]);
+                    FOR_ROWS(if (y[i] == 0.0) bad[i] = 1);
+                    break;
+                case N_MOD:
+                    /* Perl's % works on integers and takes the sign of the divisor */
+                    FOR_ROWS(
+                        long long p = (long long) x[i];
+                        long long q = (long long) y[i];
+                        long long r = q ? p % q : 0;
+                        if (q == 0)
+                            bad[i] = 1;
+                        else if (r != 0 && ((r < 0) != (q < 0)))
+                            r += q;
+                        v[i] = (double) r);
+                    break;
+                case N_POW:
+                    FOR_ROWS(v[i] = pow(x[i], y[i]));
+                    break;
+            }
+            break;
+        case N_AND:
+        case N_OR:
+            /* As in Perl, the value is that of the last operand evaluated:
+             * the left one if it settles the result, else the right one */
+            {
+                int na = eval_bool(n->a, b, sel, ns, n->s1);
+                int nr = difference(sel, ns, n->s1, na, n->s2);
+                const int *left = n->op == N_AND ? n->s2 : n->s1;
+                const int *right = n->op == N_AND ? n->s1 : n->s2;
+                int nleft = n->op == N_AND ? nr : na;
+                int nright = ns - nleft;
+                eval_num(n->a, b, left, nleft);
+                eval_num(n->b, b, right, nright);
+                for (k = 0; k < ns; k++)
+                    bad[sel[k]] = n->a->bad[sel[k]];
+                for (k = 0; k < nleft; k++) {
+                    i = left[k];
+                    v[i] = n->a->v[i];
+                    n->side[i] = 0;
+                }
+                for (k = 0; k < nright; k++) {
+                    i = right[k];
+                    v[i] = n->b->v[i];
+                    n->side[i] = 1;
+                    bad[i] |= n->b->bad[i];
+                }
+            }
+            break;
+        default:
+            /* A predicate used as a number: 1 or 0 */
+            FOR_ROWS(v[i] = 0.0);
+            k = eval_bool(n, b, sel, ns, n->s2);
+            while (k-- > 0)
+                v[n->s2[k]] = 1.0;
+            break;
+    }
+    if (full)
+        n->stamp = b->stamp;
+}
+
+/* Write the rows of in that are not in the sorted selection a to out */
+static int difference(const int *in, int nin, const int *a, int na, int *out)
+{
+    int k, j = 0, m = 0;
+
+    for (k = 0; k < nin; k++) {
+        while (j < na && a[j] < in[k])
+            j++;
+        if (j < na && a[j] == in[k])
+            continue;
+        out[m++] = in[k];
+    }
+    return(m);
+}
+
+/* Mark the rows of in that failed in either child of n */
+static void mark_bad(struct node *n, const int *in, int nin)
+{
+    for (int k = 0; k < nin; k++) {
+        int i = in[k];
+        n->bad[i] = n->a->bad[i] || (n->b && n->b->bad[i]);
+    }
+}
+
+/* Write the rows of in for which node n is true to out, in order, and
+ * fill n->bad for them as eval_num() does */
+static int eval_bool(struct node *n, struct expr_batch *b, const int *in, int nin, int *out)
+{
+    int k, m = 0, na, nb, nr;
+
+    switch (n->op) {
+        case N_AND:
+            na = eval_bool(n->a, b, in, nin, n->s1);
+            m = eval_bool(n->b, b, n->s1, na, out);
+            for (k = 0; k < nin; k++)
+                n->bad[in[k]] = n->a->bad[in[k]];
+            for (k = 0; k < na; k++)
+                n->bad[n->s1[k]] |= n->b->bad[n->s1[k]];
+            return(m);
+        case N_OR:
+            na = eval_bool(n->a, b, in, nin, n->s1);
+            nr = difference(in, nin, n->s1, na, n->s2);
+            nb = eval_bool(n->b, b, n->s2, nr, n->s3);
+            for (k = 0; k < nin; k++)
+                n->bad[in[k]] = n->a->bad[in[k]];
+            for (k = 0; k < nr; k++)
+                n->bad[n->s2[k]] |= n->b->bad[n->s2[k]];
+            {
+                int i = 0, j = 0;
+                while (i < na || j < nb)
+                    out[m++] = (j >= nb || (i < na && n->s1[i] < n->s3[j])) ? n->s1[i++] : n->s3[j++];
+            }
+            return(m);
+        case N_NOT:
+            na = eval_bool(n->a, b, in, nin, n->s1);
+            mark_bad(n, in, nin);
+            return(difference(in, nin, n->s1, na, out));
+        case N_LT: case N_LE: case N_GT: case N_GE: case N_EQ: case N_NE:
+            eval_num(n->a, b, in, nin);
+            eval_num(n->b, b, in, nin);
+            mark_bad(n, in, nin);
+            {
+                const double *x = n->a->v, *y = n->b->v;
+                for (k = 0; k < nin; k++) {
+                    int i = in[k], t = 0;
+                    switch (n->op) {
+                        case N_LT: t = x[i] < y[i]; break;
+                        case N_LE: t = x[i] <= y[i]; break;
+                        case N_GT: t = x[i] > y[i]; break;
+                        case N_GE: t = x[i] >= y[i]; break;
+                        case N_EQ: t = x[i] == y[i]; break;
+                        case N_NE: t = x[i] != y[i]; break;
+                    }
+                    if (t)
+                        out[m++] = i;
+                }
+            }
+            return(m);
+        case N_SLT: case N_SLE: case N_SGT: case N_SGE: case N_SEQ: case N_SNE:
+            if (n->a->op != N_COL && n->a->op != N_NUM && n->a->op != N_STR)
+                eval_num(n->a, b, in, nin);
+            if (n->b->op != N_COL && n->b->op != N_NUM && n->b->op != N_STR)
+                eval_num(n->b, b, in, nin);
+            mark_bad(n, in, nin);
+            for (k = 0; k < nin; k++) {
+                char bufa[64], bufb[64];
+                size_t la, lb;
+                int i = in[k], c, t = 0;
+                const char *sa = string_value(n->a, b, i, bufa, &la);
+                const char *sb = string_value(n->b, b, i, bufb, &lb);
+                c = compare_strings(sa, la, sb, lb);
+                switch (n->op) {
+                    case N_SLT: t = c < 0; break;
+                    case N_SLE: t = c <= 0; break;
+                    case N_SGT: t = c > 0; break;
+                    case N_SGE: t = c >= 0; break;
+                    case N_SEQ: t = c == 0; break;
+                    case N_SNE: t = c != 0; break;
+                }
+                if (t)
+                    out[m++] = i;
+            }
+            return(m);
+        case N_COL:
+        case N_STR:
+            for (k = 0; k < nin; k++) {
+                char buf[64];
+                size_t len;
+                const char *s = string_value(n, b, in[k], buf, &len);
+                if (string_true(s, len))
+                    out[m++] = in[k];
+            }
+            return(m);
+    }
+
+    eval_num(n, b, in, nin);
+    for (k = 0; k < nin; k++)
+        if (n->v[in[k]] != 0.0)
+            out[m++] = in[k];
+    return(m);
+}
+
+/* Write the indices of the rows of the batch the predicate selects to
+ * sel, in order, and return their number */
+int expr_select(struct expr *e, struct expr_batch *b, int *sel)
+{
+    int all[EXPR_BATCH];
+    int m, k, j = 0;
+
+    for (k = 0; k < b->n; k++)
+        all[k] = k;
+    m = eval_bool(e->root, b, all, b->n, sel);
+    for (k = 0; k < m; k++)
+        if (!e->root->bad[sel[k]])
+            sel[j++] = sel[k];
+    return(j);
+}
+
+
+/* OPTIMIZATION */
+
+static int is_constant(const struct node *n)
+{
+    return(n && (n->op == N_NUM || n->op == N_STR));
+}
+
+/* Replace arithmetic on constants by its value, unless evaluating it
+ * would fail (e.g. 1/0, which must still drop the row) */
+static struct node *fold(struct node *n)
+{
+    struct expr_batch b = {0};
+    int all = 0;
+    struct node *c;
+    char text[64];
+    size_t len;
+
+    if (!n)
+        return(NULL);
+    n->a = fold(n->a);
+    n->b = fold(n->b);
+    if (n->op < N_NEG || n->op == N_NOT || (n->op > N_POW && n->op < N_FN1))
+        return(n);
+    if (!is_constant(n->a) || (n->b && !is_constant(n->b)))
+        return(n);
+    b.n = 1;
+    b.stamp = (unsigned long) -1;
+    eval_num(n, &b, &all, 1);
+    if (n->bad[0])
+        return(n);
+    len = format_number(n->v[0], is_integer(n, 0), text, sizeof(text));
+    c = constant(n->v[0], text, len);
+    node_free(n);
+    return(c);
+}
+
+static int same(const struct node *x, const struct node *y)
+{
+    if (x->op != y->op || x->a != y->a || x->b != y->b)
+        return(0);
+    switch (x->op) {
+        case N_NUM:
+            return(x->num == y->num && !strcmp(x->str, y->str));
+        case N_STR:
+            return(!strcmp(x->str, y->str));
+        case N_COL:
+            return(x->col == y->col);
+        case N_FN1:
+            return(x->fn1 == y->fn1);
+        case N_FN2:
+            return(x->fn2 == y->fn2);
+    }
+    return(1);
+}
+
+/* Return the node in seen[] identical to n, or n (added to seen[]). The
+ * children are merged first, so comparing their pointers suffices. */
+static struct node *merge(struct node *n, struct node ***seen, int *nseen, int *size)
+{
+    if (!n)
+        return(NULL);
+    n->a = merge(n->a, seen, nseen, size);
+    n->b = merge(n->b, seen, nseen, size);
+    for (int k = 0; k < *nseen; k++)
+        if (same((*seen)[k], n)) {
+            (*seen)[k]->refs++;
+            node_free(n);
+            return((*seen)[k]);
+        }
+    if (*nseen == *size) {
+        *size = *size ? 2*(*size) : 64;
+        *seen = (struct node **) realloc(*seen, *size*sizeof(struct node *));
+    }
+    (*seen)[(*nseen)++] = n;
+    return(n);
+}
+
+/* Fold constants and merge common subexpressions in n expressions */
+void expr_optimize(struct expr *e, int n)
+{
+    struct node **seen = NULL;
+    int nseen = 0, size = 0;
+
+    for (int k = 0; k < n; k++)
+        e[k].root = fold(e[k].root);
+    for (int k = 0; k < n; k++)
+        e[k].root = merge(e[k].root, &seen, &nseen, &size);
+    free(seen);
+}
+
+
+/* VALUES */
+
+static int is_predicate(const struct node *n)
+{
+    return(n->op == N_NOT || (n->op >= N_LT && n->op <= N_SNE));
+}
+
+/* Evaluate an expression on every row of a batch, for expr_format() */
+void expr_evaluate(struct expr *e, struct expr_batch *b)
+{
+    struct node *n = e->root;
+    int all[EXPR_BATCH];
+
+    for (int k = 0; k < b->n; k++)
+        all[k] = k;
+    if (n->op != N_COL && n->op != N_STR)
+        eval_num(n, b, all, b->n);
+}
+
+/* Write the value of an expression for row i of a batch as Perl would
+ * print it: a field or string as it is, a comparison as 1 or nothing, an
+ * && or || as the operand it took its value from, a number as
+ * format_number() writes it, and nothing if the row failed. Returns the
+ * length written. */
+int expr_format(struct expr *e, struct expr_batch *b, int i, char *buf, size_t size)
+{
+    struct node *n = e->root;
+    size_t len;
+    double x;
+
+    if (n->bad[i]) {
+        buf[0] = '\0';
+        return(0);
+    }
+    while (n->op == N_AND || n->op == N_OR)
+        n = n->side[i] ? n->b : n->a;
+    if (n->op == N_COL || n->op == N_STR || n->op == N_NUM) {
+        char tmp[64];
+        const char *s = string_value(n, b, i, tmp, &len);
+        if (len >= size)
+            len = size - 1;
+        memcpy(buf, s, len);
+        buf[len] = '\0';
+        return((int) len);
+    }
+    x = n->v[i];
+    if (is_predicate(n))
+        return(snprintf(buf, size, "%s", x != 0.0 ? "1" : ""));
+    return(format_number(x, is_integer(n, i), buf, size));
+}
@@ -0,0 +1,35 @@
+#include <stdio.h>
+
+/* expr.h -- compiled row expressions for tfilter and tcalc */
+
+#define EXPR_BATCH 1024
+
+/* A batch of data lines, split into the fields an expression needs. Field
+ * k of line i starts at tok[i*ncol + k] and is toklen[i*ncol + k] bytes
+ * long. */
+struct expr_batch {
+    int n;
+    int ncol;
+    const char **tok;
+    int *toklen;
+    size_t cap;
+    unsigned long stamp;    /* changes with every batch */
+};
+
+struct node;
+
+struct expr {
+    struct node *root;
+    int maxcol;         /* highest column referred to, or -1 */
+};
+
+char *expr_substitute(const char *s, const char *keyword, int col);
+int expr_header_keyword(const char *line, size_t len, char *keyword, size_t size);
+int expr_compile(struct expr *e, const char *s, char *err, size_t errlen);
+void expr_optimize(struct expr *e, int n);
+void expr_free(struct expr *e);
+void expr_batch_free(struct expr_batch *b);
+int expr_batch_split(struct expr_batch *b, const char **line, const size_t *len, int n, int ncol);
+int expr_select(struct expr *e, struct expr_batch *b, int *sel);
+void expr_evaluate(struct expr *e, struct expr_batch *b);
+int expr_format(struct expr *e, struct expr_batch *b, int i, char *buf, size_t size);
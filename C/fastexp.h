@@ -0,0 +1,47 @@
+#include <stdint.h>
+
+/* fastexp.h -- branch-free exponential for the model kernels
+ *
+ * exp(x) = 2^k exp(r) with k = round(x/ln2) and |r| <= ln2/2. The rounding
+ * is done by adding and subtracting 1.5*2^52, which also leaves k in the
+ * low bits of the sum, so 2^k can be built directly in the exponent field.
+ * exp(r) is the degree 13 Taylor polynomial, good to a few parts in 1e16.
+ * There are no branches or library calls, so loops over fast_exp() are
+ * vectorized by the compiler. Arguments below -708 return 0 and arguments
+ * above 709 are clamped, so the result is never infinite or subnormal.
+ */
+
+static inline double fast_exp(double x)
+{
+    const double log2e = 1.4426950408889634;
+    const double ln2hi = 6.93147180369123816490e-01;
+    const double ln2lo = 1.90821492927058770002e-10;
+    const double shift = 0x1.8p52;
+    union { double d; int64_t i; } k, scale;
+    double kd, r, p;
+
+    double xc = x > 709.0 ? 709.0 : x;
+    xc = xc < -708.0 ? -708.0 : xc;
+
+    k.d = xc * log2e + shift;
+    kd = k.d - shift;
+    r = (xc - kd * ln2hi) - kd * ln2lo;
+
+    p = 1.0/6227020800.0;
+    p = p * r + 1.0/479001600.0;
+    p = p * r + 1.0/39916800.0;
+    p = p * r + 1.0/3628800.0;
+    p = p * r + 1.0/362880.0;
+    p = p * r + 1.0/40320.0;
+    p = p * r + 1.0/5040.0;
+    p = p * r + 1.0/720.0;
+    p = p * r + 1.0/120.0;
+    p = p * r + 1.0/24.0;
+    p = p * r + 1.0/6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+
+    scale.i = (k.i - 0x4338000000000000LL + 1023) << 52;
+    return x < -708.0 ? 0.0 : p * scale.d;
+}
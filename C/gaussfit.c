@@ -4,31 +4,68 @@
 #include <gsl/gsl_blas.h>
 
 #include "gaussfit.h"
+#include "fastexp.h"
 
 /* gaussfit.c -- functions for gaussian fits */
 
 
-/* Residuals from the weighted gaussian model */
-int gauss_f(const gsl_vector *p, void *data, gsl_vector *f)
+/* The fused kernel, in the form of a tfitdist model component (see
+ * models.h): adds A*exp(-0.5*((x-mu)/sig)^2) into m and writes the
+ * partials, times w[i], into J. A NULL w means unit weights. */
+void gauss_eval(const double *p, const double *x, const double *w, size_t n,
+                double *m, double *J, size_t tda)
 {
-    size_t n = ((struct data *)data)->n;
-    double *x = ((struct data *)data)->x;
-    double *y = ((struct data *)data)->y;
-    double *sigma = ((struct data *) data)->sigma;
+    double A = p[0];
+    double mu = p[1];
+    double isig = 1.0/p[2];
+    size_t i;
 
-    double A = gsl_vector_get(p, 0);
-    double mu = gsl_vector_get(p, 1);
-    double sig = gsl_vector_get(p, 2);
+    for (i = 0; i < n; i++)
+    {
+        double u = (x[i]-mu)*isig;
+        double e = fast_exp(-0.5*u*u);
+        if (m)
+            m[i] += A*e;
+        if (J) {
+            double wi = w ? w[i] : 1.0;
+            double ae = A*e*wi;
+            J[i*tda]     = e*wi;             /* dfi/dA   */
+            J[i*tda + 1] = ae*u*isig;        /* dfi/dmu  */
+            J[i*tda + 2] = ae*u*u*isig;      /* dfi/dsig */
+        }
+    }
+}
 
+/* Turn the model values in f into weighted residuals and scale the rows
+ * of J by 1/sigma. Either may be NULL. */
+static void weight(const struct data *d, gsl_vector *f, gsl_matrix *J)
+{
     size_t i;
 
-    for (i = 0; i < n; i++)
+    for (i = 0; i < d->n; i++)
     {
-        /* Model Yi = A * exp(-lambda * i) + b */
-        double Yi = A * exp (-0.5*gsl_pow_2((x[i]-mu)/sig));
-        gsl_vector_set(f, i, (Yi - y[i])/sigma[i]);
+        double is = 1.0/d->sigma[i];
+        if (f)
+            f->data[i] = (f->data[i] - d->y[i])*is;
+        if (J) {
+            J->data[i*J->tda]     *= is;
+            J->data[i*J->tda + 1] *= is;
+            J->data[i*J->tda + 2] *= is;
+        }
     }
+}
+
+/* The GSL solver callbacks. The solver's f is contiguous, so the model is
+ * built in place. */
+
+/* Residuals from the weighted gaussian model */
+int gauss_f(const gsl_vector *p, void *data, gsl_vector *f)
+{
+    struct data *d = (struct data *)data;
 
+    gsl_vector_set_zero(f);
+    gauss_eval(p->data, d->x, NULL, d->n, f->data, NULL, 0);
+    weight(d, f, NULL);
     return GSL_SUCCESS;
 }
 
@@ -51,36 +88,21 @@ int gauss_f(const gsl_vector *p, void *data, gsl_vector *f)
 /* D[fi,sig]                                                           */
 int gauss_df(const gsl_vector *p, void *data, gsl_matrix *J)
 {
-    size_t n = ((struct data *)data)->n;
-    double *x = ((struct data *)data)->x;
-    double *sigma = ((struct data *) data)->sigma;
-
-    double A = gsl_vector_get(p, 0);
-    double mu = gsl_vector_get(p, 1);
-    double sig = gsl_vector_get(p, 2);
-
-    size_t i;
+    struct data *d = (struct data *)data;
 
-    for (i = 0; i < n; i++)
-    {
-        double t = x[i];
-        double s = sigma[i];
-        double e = exp(-0.5*gsl_pow_2((t-mu)/sig));
-        gsl_matrix_set(J, i, 0, e/s);                                  /* dfi/dA   */
-        gsl_matrix_set(J, i, 1, A*e*(t-mu)/gsl_pow_2(sig)/s);          /* dfi/dmu  */
-        gsl_matrix_set(J, i, 2, A*e*gsl_pow_2(t-mu)/gsl_pow_3(sig)/s); /* dfi/dsig */
-    }
+    gauss_eval(p->data, d->x, NULL, d->n, NULL, J->data, J->tda);
+    weight(d, NULL, J);
     return GSL_SUCCESS;
 }
 
-/* Convenience function to evaluate both the model and its Jacobian */
+/* Evaluate the model and its Jacobian together. Both share the same
+ * exponential, so it is computed once per point. */
 int gauss_fdf(const gsl_vector *p, void *data, gsl_vector *f, gsl_matrix *J)
 {
-    gauss_f(p, data, f);
-    gauss_df(p, data, J);
+    struct data *d = (struct data *)data;
 
+    gsl_vector_set_zero(f);
+    gauss_eval(p->data, d->x, NULL, d->n, f->data, J->data, J->tda);
+    weight(d, f, J);
     return GSL_SUCCESS;
 }
-
-
-
@@ -9,6 +9,8 @@ struct data {
     double * sigma;
 };
 
+void gauss_eval(const double *p, const double *x, const double *w, size_t n,
+                double *m, double *J, size_t tda);
 int gauss_f (const gsl_vector * x, void *data, gsl_vector * f);
 int gauss_df (const gsl_vector * x, void *data, gsl_matrix * J);
 int gauss_fdf (const gsl_vector * x, void *data, gsl_vector * f, gsl_matrix * J);
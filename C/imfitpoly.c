@@ -6,6 +6,7 @@
 #include <gsl/gsl_multifit.h>
 #include <fitsio.h>
 #include "mfits.h"
+#include "linsolve.h"
 
 char   *help[] = {
 "",
@@ -18,6 +19,7 @@ char   *help[] = {
 "OPTIONS",
 "    -n            Order of the polynomial (0=constant, 1=linear, 2=quadratic, 3=cubic) [default 1]", 
 "    -o file.fits  Output filename [default a.fits]",
+"    -l name       Least-squares solver: auto, cholesky, qr or svd [default auto]",
 "    -s sigma.fits Input error map. This is the sigma_i in $\\Sum(((y-y_i)/sigma_i)^2)$",
 "    -h            Print help",
 "    -v            Verbose mode", 
@@ -33,6 +35,9 @@ char   *help[] = {
 "    then the error map should just be the square root of the original image. If you want to",
 "    totally de-emphasize a particular pixel give it a huge value on the error map.",
 "",
+"    The fit is solved by Cholesky, QR or SVD according to its estimated condition number (see",
+"    tfitpoly -h), unless a solver is forced with -l. In verbose mode the solver used is printed.",
+"",
 "AUTHOR",
 "    Roberto Abraham (abraham@astro.utoronto.ca)",
 "",
@@ -71,10 +76,17 @@ int main (int argc, char **argv)
     char *signame;
     char *outname = "a.fits";
     int use_sigma_map = 0;
+    struct linsolve solver = {LINSOLVE_AUTO};
 
-    while ((c = getopt (argc, argv, "vn:o:s:h")) != -1)
+    while ((c = getopt (argc, argv, "vn:o:s:l:h")) != -1)
         switch (c)
         {
+            case 'l':
+                if ((solver.method = linsolve_method(optarg)) < 0) {
+                    fprintf(stderr,"Unknown solver %s.\n", optarg);
+                    return(1);
+                }
+                break;
             case 'v':
                 verbose = 1;
                 break;
@@ -274,11 +286,8 @@ int main (int argc, char **argv)
 
 
     // Compute the answer
-    {
-        gsl_multifit_linear_workspace *work = gsl_multifit_linear_alloc(ndata, npar);
-        gsl_multifit_wlinear(X, sigvec, yvec, cvec, cov, &chisq, work);
-        gsl_multifit_linear_free(work);
-    }
+    if (linsolve_fit(&solver, X, sigvec, yvec, cvec, cov, &chisq))
+        fprintf(stderr,"Warning: the %s solver failed.\n", linsolve_name(solver.used));
 
 
     #define C(i) (gsl_vector_get(cvec,(i)))
@@ -311,6 +320,7 @@ int main (int argc, char **argv)
 
         printf("# chisq = %g\n", chisq);
         printf("# chisq_nu = %g\n", chisq/(ndata - npar -1));
+        printf("# solver: %s (condition number %g)\n", linsolve_name(solver.used), solver.cond);
     }
     else {
 
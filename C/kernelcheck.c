@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+
+#include "gaussfit.h"
+#include "expfit.h"
+#include "fastexp.h"
+
+/* kernelcheck.c -- accuracy check for the fused model kernels
+ *
+ * Compares fast_exp() with exp(), and the residuals and Jacobians from
+ * gauss_fdf/expb_fdf and from the gauss_eval/expb_eval components with
+ * reference values computed point by point with the library exp(), the
+ * way the separate _f and _df routines used to. Prints the largest error
+ * of each and exits non-zero if any exceeds its tolerance. Run it with
+ * "make check". */
+
+#define N 1000
+#define TOL_EXP 1e-15
+#define TOL_KERNEL 1e-13
+
+static int failures = 0;
+
+static void report(const char *what, double err, double tol)
+{
+    int bad = !(err <= tol);
+    printf("%-34s %10.3g  %s\n", what, err, bad ? "FAIL" : "ok");
+    failures += bad;
+}
+
+/* Largest difference between a and b over n values with stride s, relative
+ * to the largest |b| so that zero crossings do not dominate */
+static double maxerr(const double *a, const double *b, size_t n, size_t s)
+{
+    double err = 0.0, scale = 0.0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (fabs(b[i*s]) > scale)
+            scale = fabs(b[i*s]);
+    for (i = 0; i < n; i++)
+        if (!(fabs(a[i*s] - b[i*s]) <= err))
+            err = fabs(a[i*s] - b[i*s]);
+    return(scale > 0.0 ? err/scale : err);
+}
+
+static void check_exp(void)
+{
+    double err = 0.0, x;
+
+    for (x = -708.0; x <= 709.0; x += 1e-3) {
+        double e = fabs(fast_exp(x) - exp(x))/exp(x);
+        if (!(e <= err))
+            err = e;
+    }
+    report("fast_exp vs exp, [-708,709]", err, TOL_EXP);
+    report("fast_exp(-1000)", fast_exp(-1000.0), 0.0);
+}
+
+/* Compare the fused f and J with the reference values, column by column */
+static void compare(const char *name, const gsl_vector *f, const gsl_matrix *J,
+                    const double *rf, const double *rJ)
+{
+    char what[64];
+    size_t j;
+
+    snprintf(what, sizeof(what), "%s residuals", name);
+    report(what, maxerr(f->data, rf, N, 1), TOL_KERNEL);
+    for (j = 0; j < 3; j++) {
+        snprintf(what, sizeof(what), "%s Jacobian column %zu", name, j);
+        report(what, maxerr(J->data + j, rJ + j, N, J->tda), TOL_KERNEL);
+    }
+}
+
+/* The model values from eval() with unit weights, and its Jacobian with
+ * weights 1/sigma, are the fdf residuals and Jacobian */
+static void check_eval(const char *name,
+                       void (*eval)(const double *, const double *, const double *, size_t,
+                                    double *, double *, size_t),
+                       const double *p, const double *x, const double *y, const double *sigma,
+                       const double *rf, const double *rJ)
+{
+    gsl_vector *f = gsl_vector_calloc(N);
+    gsl_matrix *J = gsl_matrix_alloc(N, 3);
+    double *w = malloc(N*sizeof(double));
+    size_t i;
+
+    for (i = 0; i < N; i++)
+        w[i] = 1.0/sigma[i];
+    eval(p, x, w, N, f->data, J->data, J->tda);
+    for (i = 0; i < N; i++)
+        f->data[i] = (f->data[i] - y[i])/sigma[i];
+    compare(name, f, J, rf, rJ);
+    free(w);
+    gsl_vector_free(f);
+    gsl_matrix_free(J);
+}
+
+static void check_gauss(const double *x, const double *y, const double *sigma)
+{
+    double p[3] = {1200.0, 3.7, 12.5};
+    double *rf = malloc(N*sizeof(double));
+    double *rJ = malloc(3*N*sizeof(double));
+    gsl_vector_view pv = gsl_vector_view_array(p, 3);
+    gsl_vector *f = gsl_vector_alloc(N);
+    gsl_matrix *J = gsl_matrix_alloc(N, 3);
+    struct data d = {N, (double *)x, (double *)y, (double *)sigma};
+    size_t i;
+
+    for (i = 0; i < N; i++) {
+        double t = x[i];
+        double e = exp(-0.5*pow((t - p[1])/p[2], 2.0));
+        rf[i] = (p[0]*e - y[i])/sigma[i];
+        rJ[3*i]     = e/sigma[i];
+        rJ[3*i + 1] = p[0]*e*(t - p[1])/(p[2]*p[2])/sigma[i];
+        rJ[3*i + 2] = p[0]*e*pow(t - p[1], 2.0)/pow(p[2], 3.0)/sigma[i];
+    }
+    gauss_fdf(&pv.vector, &d, f, J);
+    compare("gauss_fdf", f, J, rf, rJ);
+    check_eval("gauss_eval", gauss_eval, p, x, y, sigma, rf, rJ);
+
+    free(rf);
+    free(rJ);
+    gsl_vector_free(f);
+    gsl_matrix_free(J);
+}
+
+static void check_expb(const double *x, const double *y, const double *sigma)
+{
+    double p[3] = {800.0, 0.031, 40.0};
+    double *rf = malloc(N*sizeof(double));
+    double *rJ = malloc(3*N*sizeof(double));
+    gsl_vector_view pv = gsl_vector_view_array(p, 3);
+    gsl_vector *f = gsl_vector_alloc(N);
+    gsl_matrix *J = gsl_matrix_alloc(N, 3);
+    struct expb_data d = {N, (double *)x, (double *)y, (double *)sigma};
+    size_t i;
+
+    for (i = 0; i < N; i++) {
+        double t = x[i];
+        double e = exp(-p[1]*t);
+        rf[i] = (p[0]*e + p[2] - y[i])/sigma[i];
+        rJ[3*i]     = e/sigma[i];
+        rJ[3*i + 1] = -t*p[0]*e/sigma[i];
+        rJ[3*i + 2] = 1.0/sigma[i];
+    }
+    expb_fdf(&pv.vector, &d, f, J);
+    compare("expb_fdf", f, J, rf, rJ);
+    check_eval("expb_eval", expb_eval, p, x, y, sigma, rf, rJ);
+
+    free(rf);
+    free(rJ);
+    gsl_vector_free(f);
+    gsl_matrix_free(J);
+}
+
+int main(void)
+{
+    double *x = malloc(N*sizeof(double));
+    double *y = malloc(N*sizeof(double));
+    double *sigma = malloc(N*sizeof(double));
+    size_t i;
+
+    /* A noisy histogram-like data set over a range wider than the models */
+    for (i = 0; i < N; i++) {
+        x[i] = -50.0 + 0.1*i;
+        y[i] = 1000.0*exp(-0.5*pow((x[i] - 4.0)/12.0, 2.0)) + 30.0*sin(0.7*i);
+        sigma[i] = 1.0 + sqrt(fabs(y[i]));
+    }
+    check_exp();
+    check_gauss(x, y, sigma);
+    for (i = 0; i < N; i++)
+        x[i] = 0.1*i;
+    check_expb(x, y, sigma);
+
+    free(x);
+    free(y);
+    free(sigma);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return(failures ? 1 : 0);
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_blas.h>
+#include <gsl/gsl_linalg.h>
+#include <gsl/gsl_multifit.h>
+
+#include "linsolve.h"
+
+/* linsolve.c -- weighted linear least squares for tfitpoly, tfitsurf and
+ * imfitpoly
+ *
+ * gsl_multifit_wlinear solves by a full SVD, which is safe but several
+ * times slower than needed for the well-conditioned low-order fits that
+ * are most of ours. Here the columns of the weighted design matrix are
+ * first scaled to unit norm, and then (in auto mode) the fit is solved
+ * by the cheapest method its condition number allows:
+ *
+ *   cholesky  the normal equations, whose error grows as cond^2
+ *   qr        Householder QR of the design matrix, error ~ cond
+ *   svd       gsl_multifit_wlinear, which also copes with rank deficiency
+ *
+ * The condition number is that of the triangular factor, in the 1-norm,
+ * which comes almost for free since its inverse is needed anyway for the
+ * covariance matrix. A forced cholesky or qr that finds the system
+ * singular falls back to svd, so c, cov and chisq are always set, and
+ * ls->used says which solver gave them. */
+
+#define COND_CHOLESKY 1e4
+#define COND_QR 1e10
+
+static const char *names[] = {"auto", "cholesky", "qr", "svd"};
+
+
+int linsolve_method(const char *name)
+{
+    for (int k = 0; k < 4; k++)
+        if (!strcmp(name, names[k]))
+            return(k);
+    return(-1);
+}
+
+const char *linsolve_name(int method)
+{
+    return(names[method]);
+}
+
+/* Invert the upper triangle R of F into Rinv, and return the 1-norm
+ * condition number of R (infinite if it is singular) */
+static double invert(const gsl_matrix *F, gsl_matrix *Rinv)
+{
+    const size_t p = F->size1;
+    double norm = 0.0, inorm = 0.0;
+
+    for (size_t j = 0; j < p; j++)
+        if (gsl_matrix_get(F, j, j) == 0.0)
+            return(GSL_POSINF);
+    gsl_matrix_set_identity(Rinv);
+    for (size_t j = 0; j < p; j++) {
+        gsl_vector_view col = gsl_matrix_column(Rinv, j);
+        double s = 0.0, si = 0.0;
+        gsl_blas_dtrsv(CblasUpper, CblasNoTrans, CblasNonUnit, F, &col.vector);
+        for (size_t i = 0; i <= j; i++) {
+            s += fabs(gsl_matrix_get(F, i, j));
+            si += fabs(gsl_matrix_get(Rinv, i, j));
+        }
+        if (s > norm)
+            norm = s;
+        if (si > inorm)
+            inorm = si;
+    }
+    return(norm*inorm);
+}
+
+/* Fit y = X c with weights w. The covariance and chisq are as returned by
+ * gsl_multifit_wlinear. */
+int linsolve_fit(struct linsolve *ls, const gsl_matrix *X, const gsl_vector *w, const gsl_vector *y,
+                 gsl_vector *c, gsl_matrix *cov, double *chisq)
+{
+    const size_t n = X->size1;
+    const size_t p = X->size2;
+    gsl_matrix *A = gsl_matrix_alloc(n, p);
+    gsl_vector *b = gsl_vector_alloc(n);
+    gsl_vector *d = gsl_vector_alloc(p);
+    gsl_matrix *F = NULL;
+    gsl_matrix *Rinv = gsl_matrix_alloc(p, p);
+    gsl_vector *tau = NULL;
+    gsl_error_handler_t *handler = gsl_set_error_handler_off();
+    int status = 0;
+    size_t i, j;
+
+    /* Weighted design matrix with columns of unit norm */
+    for (i = 0; i < n; i++) {
+        double sw = sqrt(gsl_vector_get(w, i));
+        for (j = 0; j < p; j++)
+            gsl_matrix_set(A, i, j, sw*gsl_matrix_get(X, i, j));
+        gsl_vector_set(b, i, sw*gsl_vector_get(y, i));
+    }
+    for (j = 0; j < p; j++) {
+        gsl_vector_view col = gsl_matrix_column(A, j);
+        double norm = gsl_blas_dnrm2(&col.vector);
+        if (norm == 0.0)
+            norm = 1.0;
+        gsl_vector_set(d, j, norm);
+        gsl_vector_scale(&col.vector, 1.0/norm);
+    }
+    ls->used = ls->method;
+    ls->cond = GSL_POSINF;
+
+    /* Normal equations. The factorization leaves R = L^T in the upper
+     * triangle, as QR does. */
+    if (ls->method == LINSOLVE_AUTO || ls->method == LINSOLVE_CHOLESKY) {
+        F = gsl_matrix_alloc(p, p);
+        gsl_blas_dsyrk(CblasLower, CblasTrans, 1.0, A, 0.0, F);
+        for (j = 0; j < p; j++)
+            for (i = 0; i < j; i++)
+                gsl_matrix_set(F, i, j, gsl_matrix_get(F, j, i));
+        if (!gsl_linalg_cholesky_decomp(F))
+            ls->cond = invert(F, Rinv);
+        if (!gsl_finite(ls->cond) && ls->method == LINSOLVE_CHOLESKY)
+            ls->used = LINSOLVE_SVD;
+        else if (ls->method == LINSOLVE_CHOLESKY || ls->cond < COND_CHOLESKY) {
+            gsl_vector *rhs = gsl_vector_alloc(p);
+            ls->used = LINSOLVE_CHOLESKY;
+            gsl_blas_dgemv(CblasTrans, 1.0, A, b, 0.0, rhs);
+            if (gsl_linalg_cholesky_solve(F, rhs, c))
+                ls->used = LINSOLVE_SVD;
+            gsl_vector_free(rhs);
+        }
+        else
+            ls->used = LINSOLVE_AUTO;
+        gsl_matrix_free(F);
+        F = NULL;
+    }
+
+    /* Householder QR */
+    if (ls->used == LINSOLVE_AUTO || ls->used == LINSOLVE_QR) {
+        gsl_vector *resid = gsl_vector_alloc(n);
+        F = gsl_matrix_alloc(n, p);
+        tau = gsl_vector_alloc(p < n ? p : n);
+        gsl_matrix_memcpy(F, A);
+        gsl_linalg_QR_decomp(F, tau);
+        {
+            gsl_matrix_view R = gsl_matrix_submatrix(F, 0, 0, p, p);
+            ls->cond = invert(&R.matrix, Rinv);
+        }
+        if (!gsl_finite(ls->cond))
+            ls->used = LINSOLVE_SVD;
+        else if (ls->used == LINSOLVE_QR || ls->cond < COND_QR) {
+            ls->used = LINSOLVE_QR;
+            if (gsl_linalg_QR_lssolve(F, tau, b, c, resid))
+                ls->used = LINSOLVE_SVD;
+        }
+        gsl_vector_free(resid);
+    }
+
+    if (ls->used == LINSOLVE_AUTO || ls->used == LINSOLVE_SVD) {
+        /* Singular value decomposition, on the original problem */
+        gsl_multifit_linear_workspace *work = gsl_multifit_linear_alloc(n, p);
+        ls->used = LINSOLVE_SVD;
+        status = gsl_multifit_wlinear(X, w, y, c, cov, chisq, work);
+        gsl_multifit_linear_free(work);
+    }
+    else {
+        /* Undo the column scaling: c = D^-1 c', cov = D^-1 Rinv Rinv^T D^-1 */
+        gsl_vector *r = gsl_vector_alloc(n);
+        gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, Rinv, Rinv, 0.0, cov);
+        gsl_vector_memcpy(r, b);
+        gsl_blas_dgemv(CblasNoTrans, -1.0, A, c, 1.0, r);
+        *chisq = pow(gsl_blas_dnrm2(r), 2.0);
+        for (i = 0; i < p; i++) {
+            gsl_vector_set(c, i, gsl_vector_get(c, i)/gsl_vector_get(d, i));
+            for (j = 0; j < p; j++)
+                gsl_matrix_set(cov, i, j, gsl_matrix_get(cov, i, j)/(gsl_vector_get(d, i)*gsl_vector_get(d, j)));
+        }
+        gsl_vector_free(r);
+    }
+
+    gsl_set_error_handler(handler);
+    gsl_matrix_free(A);
+    gsl_vector_free(b);
+    gsl_vector_free(d);
+    gsl_matrix_free(Rinv);
+    if (F)
+        gsl_matrix_free(F);
+    if (tau)
+        gsl_vector_free(tau);
+    return(status);
+}
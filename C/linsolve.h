@@ -0,0 +1,20 @@
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+
+/* linsolve.h -- weighted linear least squares with a choice of solver */
+
+#define LINSOLVE_AUTO     0
+#define LINSOLVE_CHOLESKY 1
+#define LINSOLVE_QR       2
+#define LINSOLVE_SVD      3
+
+struct linsolve {
+    int method;         /* solver asked for */
+    int used;           /* solver used */
+    double cond;        /* estimated condition number of the scaled design matrix */
+};
+
+int linsolve_method(const char *name);
+const char *linsolve_name(int method);
+int linsolve_fit(struct linsolve *ls, const gsl_matrix *X, const gsl_vector *w, const gsl_vector *y,
+                 gsl_vector *c, gsl_matrix *cov, double *chisq);
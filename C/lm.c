@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <math.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_blas.h>
+
+#include "lm.h"
+
+/* lm.c -- small dense Levenberg-Marquardt solver with geodesic acceleration
+ *
+ * The fits in tfitdist have a handful of parameters, so each step is found
+ * by Cholesky factoring the p x p damped normal equations
+ *
+ *     (J^T J + lambda D) v = -J^T f,      D = diag(J^T J)
+ *
+ * rather than by a QR factorization of the n x p Jacobian. With geodesic
+ * acceleration (Transtrum & Sethna 2012, arXiv:1201.5885) the step is
+ * v + a/2, where a solves the same equations with J^T f replaced by the
+ * J^T of the second directional derivative of f along v, found by a finite
+ * difference. This follows the curvature of the model and usually needs
+ * fewer iterations. The acceleration is dropped whenever it is not small
+ * next to v. Each iteration costs one residual evaluation for the trial
+ * step, one more for the acceleration, and one Jacobian evaluation. */
+
+#define HFVV 0.02           /* finite difference step for the acceleration */
+#define AVMAX 0.75          /* largest allowed |a|/|v| (times 2) */
+#define LAMBDA_MIN 1e-12
+#define LAMBDA_MAX 1e16
+
+
+struct lm *lm_alloc(size_t n, size_t p, int accel)
+{
+    struct lm *lm = (struct lm *) calloc(1, sizeof(struct lm));
+
+    if (lm == NULL)
+        return(NULL);
+    lm->n = n;
+    lm->p = p;
+    lm->accel = accel;
+    lm->x = gsl_vector_alloc(p);
+    lm->f = gsl_vector_alloc(n);
+    lm->J = gsl_matrix_alloc(n, p);
+    lm->g = gsl_vector_alloc(p);
+    lm->dx = gsl_vector_calloc(p);
+    lm->A = gsl_matrix_alloc(p, p);
+    lm->L = (double *) malloc(p*p*sizeof(double));
+    lm->xtrial = gsl_vector_alloc(p);
+    lm->ftrial = gsl_vector_alloc(n);
+    lm->v = gsl_vector_alloc(p);
+    lm->a = gsl_vector_alloc(p);
+    lm->r = gsl_vector_alloc(n);
+    if (lm->x == NULL || lm->f == NULL || lm->J == NULL || lm->g == NULL || lm->dx == NULL
+        || lm->A == NULL || lm->L == NULL || lm->xtrial == NULL || lm->ftrial == NULL
+        || lm->v == NULL || lm->a == NULL || lm->r == NULL) {
+        lm_free(lm);
+        return(NULL);
+    }
+    return(lm);
+}
+
+void lm_free(struct lm *lm)
+{
+    if (lm == NULL)
+        return;
+    if (lm->x) gsl_vector_free(lm->x);
+    if (lm->f) gsl_vector_free(lm->f);
+    if (lm->J) gsl_matrix_free(lm->J);
+    if (lm->g) gsl_vector_free(lm->g);
+    if (lm->dx) gsl_vector_free(lm->dx);
+    if (lm->A) gsl_matrix_free(lm->A);
+    free(lm->L);
+    if (lm->xtrial) gsl_vector_free(lm->xtrial);
+    if (lm->ftrial) gsl_vector_free(lm->ftrial);
+    if (lm->v) gsl_vector_free(lm->v);
+    if (lm->a) gsl_vector_free(lm->a);
+    if (lm->r) gsl_vector_free(lm->r);
+    free(lm);
+}
+
+
+/* Cholesky factor A + lambda diag(A) into the lower triangle of L.
+ * Returns 1 if the matrix is not numerically positive definite. */
+static int factor(const gsl_matrix *A, double lambda, double *L, size_t p)
+{
+    size_t i, j, k;
+
+    for (j = 0; j < p; j++) {
+        double d = gsl_matrix_get(A, j, j);
+        double s = d + lambda*(d > 0 ? d : 1.0);
+        for (k = 0; k < j; k++)
+            s -= L[j*p + k]*L[j*p + k];
+        if (!(s > 0))
+            return(1);
+        L[j*p + j] = sqrt(s);
+        for (i = j + 1; i < p; i++) {
+            double t = gsl_matrix_get(A, i, j);
+            for (k = 0; k < j; k++)
+                t -= L[i*p + k]*L[j*p + k];
+            L[i*p + j] = t/L[j*p + j];
+        }
+    }
+    return(0);
+}
+
+/* Solve L L^T x = -b */
+static void solve(const double *L, size_t p, const gsl_vector *b, gsl_vector *x)
+{
+    size_t i, k;
+
+    for (i = 0; i < p; i++) {
+        double t = -gsl_vector_get(b, i);
+        for (k = 0; k < i; k++)
+            t -= L[i*p + k]*gsl_vector_get(x, k);
+        gsl_vector_set(x, i, t/L[i*p + i]);
+    }
+    for (i = p; i-- > 0;) {
+        double t = gsl_vector_get(x, i);
+        for (k = i + 1; k < p; k++)
+            t -= L[k*p + i]*gsl_vector_get(x, k);
+        gsl_vector_set(x, i, t/L[i*p + i]);
+    }
+}
+
+/* J^T J and J^T f at the current position */
+static void normal_equations(struct lm *lm)
+{
+    gsl_blas_dsyrk(CblasLower, CblasTrans, 1.0, lm->J, 0.0, lm->A);
+    gsl_blas_dgemv(CblasTrans, 1.0, lm->J, lm->f, 0.0, lm->g);
+}
+
+int lm_set(struct lm *lm, int (*func)(const gsl_vector *, void *, gsl_vector *),
+           int (*dfunc)(const gsl_vector *, void *, gsl_matrix *), void *params, const gsl_vector *x)
+{
+    lm->func = func;
+    lm->dfunc = dfunc;
+    lm->params = params;
+    lm->lambda = 1e-3;
+    gsl_vector_memcpy(lm->x, x);
+    gsl_vector_set_zero(lm->dx);
+    if (func(lm->x, params, lm->f) || dfunc(lm->x, params, lm->J))
+        return(GSL_EBADFUNC);
+    lm->chisq = pow(gsl_blas_dnrm2(lm->f), 2.0);
+    normal_equations(lm);
+    return(GSL_SUCCESS);
+}
+
+/* Take one step downhill. Returns GSL_ENOPROG if no step lowers chisq
+ * however much it is damped. */
+int lm_iterate(struct lm *lm)
+{
+    const size_t p = lm->p;
+    double chisq;
+
+    for (;;) {
+        if (!factor(lm->A, lm->lambda, lm->L, p)) {
+
+            /* Velocity */
+            solve(lm->L, p, lm->g, lm->v);
+            gsl_vector_memcpy(lm->dx, lm->v);
+
+            /* Acceleration: r = (2/h) ((f(x + h v) - f(x))/h - J v) */
+            if (lm->accel) {
+                gsl_vector_memcpy(lm->xtrial, lm->x);
+                gsl_blas_daxpy(HFVV, lm->v, lm->xtrial);
+                if (!lm->func(lm->xtrial, lm->params, lm->r)) {
+                    double vnorm = gsl_blas_dnrm2(lm->v), anorm;
+                    gsl_blas_daxpy(-1.0, lm->f, lm->r);
+                    gsl_blas_dgemv(CblasNoTrans, -HFVV, lm->J, lm->v, 1.0, lm->r);
+                    gsl_blas_dscal(2.0/(HFVV*HFVV), lm->r);
+                    gsl_blas_dgemv(CblasTrans, 1.0, lm->J, lm->r, 0.0, lm->xtrial);
+                    solve(lm->L, p, lm->xtrial, lm->a);
+                    anorm = gsl_blas_dnrm2(lm->a);
+                    if (vnorm > 0 && 2.0*anorm/vnorm <= AVMAX)
+                        gsl_blas_daxpy(0.5, lm->a, lm->dx);
+                }
+            }
+
+            /* Try the step */
+            gsl_vector_memcpy(lm->xtrial, lm->x);
+            gsl_vector_add(lm->xtrial, lm->dx);
+            if (!lm->func(lm->xtrial, lm->params, lm->ftrial)) {
+                chisq = pow(gsl_blas_dnrm2(lm->ftrial), 2.0);
+                if (isfinite(chisq) && chisq < lm->chisq)
+                    break;
+            }
+        }
+        lm->lambda *= 10;
+        if (lm->lambda > LAMBDA_MAX) {
+            gsl_vector_set_zero(lm->dx);
+            return(GSL_ENOPROG);
+        }
+    }
+
+    /* Accept it, keeping the residuals already computed */
+    gsl_vector_memcpy(lm->x, lm->xtrial);
+    gsl_vector_memcpy(lm->f, lm->ftrial);
+    lm->chisq = chisq;
+    lm->lambda = lm->lambda/10 > LAMBDA_MIN ? lm->lambda/10 : LAMBDA_MIN;
+    if (lm->dfunc(lm->x, lm->params, lm->J))
+        return(GSL_EBADFUNC);
+    normal_equations(lm);
+    return(GSL_SUCCESS);
+}
+
+/* Covariance matrix (J^T J)^-1 at the current position. Returns 1, and
+ * fills covar with NaN, if J^T J is singular. */
+int lm_covar(struct lm *lm, gsl_matrix *covar)
+{
+    const size_t p = lm->p;
+
+    if (factor(lm->A, 0.0, lm->L, p)) {
+        gsl_matrix_set_all(covar, GSL_NAN);
+        return(1);
+    }
+    for (size_t j = 0; j < p; j++) {
+        gsl_vector_view col = gsl_matrix_column(covar, j);
+        gsl_vector_set_basis(lm->v, j);
+        gsl_vector_scale(lm->v, -1.0);
+        solve(lm->L, p, lm->v, &col.vector);
+    }
+    return(0);
+}
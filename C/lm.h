@@ -0,0 +1,35 @@
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+
+/* lm.h -- small dense Levenberg-Marquardt solver with geodesic acceleration */
+
+struct lm {
+    size_t n;
+    size_t p;
+    gsl_vector *x;          /* current parameters */
+    gsl_vector *f;          /* residuals at x */
+    gsl_matrix *J;          /* Jacobian at x */
+    gsl_vector *g;          /* gradient J^T f */
+    gsl_vector *dx;         /* last step taken */
+    double chisq;           /* |f|^2 */
+    double lambda;          /* damping */
+    int accel;              /* use geodesic acceleration */
+    int (*func)(const gsl_vector *x, void *params, gsl_vector *f);
+    int (*dfunc)(const gsl_vector *x, void *params, gsl_matrix *J);
+    void *params;
+    /* scratch */
+    gsl_matrix *A;
+    double *L;
+    gsl_vector *xtrial;
+    gsl_vector *ftrial;
+    gsl_vector *v;
+    gsl_vector *a;
+    gsl_vector *r;
+};
+
+struct lm *lm_alloc(size_t n, size_t p, int accel);
+void lm_free(struct lm *lm);
+int lm_set(struct lm *lm, int (*func)(const gsl_vector *, void *, gsl_vector *),
+           int (*dfunc)(const gsl_vector *, void *, gsl_matrix *), void *params, const gsl_vector *x);
+int lm_iterate(struct lm *lm);
+int lm_covar(struct lm *lm, gsl_matrix *covar);
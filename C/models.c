@@ -0,0 +1,595 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_blas.h>
+
+#include "models.h"
+#include "gaussfit.h"
+#include "expfit.h"
+#include "fastexp.h"
+
+/* models.c -- model components for tfitdist and the glue that sums them
+ *
+ * To add a model write its eval() and guess() functions below and add an
+ * entry to the registry at the bottom of the component section. Each
+ * eval() computes its model and Jacobian together, sharing the expensive
+ * terms, and writes the already-weighted partials straight into the
+ * solver's Jacobian. The gaussian and exponential kernels are the ones
+ * in gaussfit.c and expfit.c. */
+
+
+/* Peak of the data and its half width at half maximum, found by walking
+ * out from the peak until the data fall below half of it. The data are
+ * assumed to be sorted in x. */
+static void peak(const double *x, const double *y, size_t n, double *A, double *mu, double *hwhm)
+{
+    size_t i, imax = 0, lo, hi;
+
+    for (i = 1; i < n; i++)
+        if (y[i] > y[imax]) imax = i;
+    lo = hi = imax;
+    while (lo > 0 && y[lo] > 0.5*y[imax]) lo--;
+    while (hi < n - 1 && y[hi] > 0.5*y[imax]) hi++;
+
+    *A = y[imax];
+    *mu = x[imax];
+    *hwhm = 0.5*fabs(x[hi] - x[lo]);
+    if (*hwhm <= 0.0)
+        *hwhm = (n > 1) ? fabs(x[n-1] - x[0])/n : 1.0;
+}
+
+
+/* Gaussian: A * exp(-0.5*((x-mu)/sig)^2) */
+
+/* Closed-form gaussian after Caruana et al. (1986): ln y is a parabola
+ * a + b*x + c*x^2, fitted by linear least squares. Each point is weighted
+ * by y, the inverse variance of ln y for Poisson counts (Guo 2011, IEEE
+ * Signal Proc. Mag. 28, 134), which keeps the noisy tails from dominating.
+ * x is taken relative to the peak for conditioning. If cov is not NULL it
+ * receives the 3x3 covariance of (A, mu, sig), propagated from that of the
+ * parabola and scaled by the reduced chi-square of the log fit when that
+ * exceeds one. Returns 0 on success and 1 if the data are not peaked. */
+int gaussian_caruana(const double *x, const double *y, size_t n, double *p, double *cov)
+{
+    double S[5] = {0, 0, 0, 0, 0}, T[3] = {0, 0, 0};
+    double M[3][3], inv[3][3], coef[3], det, x0, A0, hwhm;
+    double a, b, c, A, mu, sig, chi2 = 0.0, scale;
+    size_t i, npos = 0;
+    int j, k;
+
+    peak(x, y, n, &A0, &x0, &hwhm);
+    for (i = 0; i < n; i++) {
+        double u, w, l;
+        if (y[i] <= 0.0) continue;
+        u = x[i] - x0;
+        w = y[i];
+        l = log(y[i]);
+        S[0] += w; S[1] += w*u; S[2] += w*u*u; S[3] += w*u*u*u; S[4] += w*u*u*u*u;
+        T[0] += w*l; T[1] += w*u*l; T[2] += w*u*u*l;
+        npos++;
+    }
+    if (npos < 3) return(1);
+
+    /* Normal equations M coef = T, solved by the adjugate */
+    for (j = 0; j < 3; j++)
+        for (k = 0; k < 3; k++)
+            M[j][k] = S[j + k];
+    inv[0][0] = M[1][1]*M[2][2] - M[1][2]*M[2][1];
+    inv[0][1] = M[0][2]*M[2][1] - M[0][1]*M[2][2];
+    inv[0][2] = M[0][1]*M[1][2] - M[0][2]*M[1][1];
+    inv[1][1] = M[0][0]*M[2][2] - M[0][2]*M[2][0];
+    inv[1][2] = M[0][2]*M[1][0] - M[0][0]*M[1][2];
+    inv[2][2] = M[0][0]*M[1][1] - M[0][1]*M[1][0];
+    det = M[0][0]*inv[0][0] + M[0][1]*inv[0][1] + M[0][2]*inv[0][2];
+    if (det == 0.0) return(1);
+    inv[1][0] = inv[0][1];
+    inv[2][0] = inv[0][2];
+    inv[2][1] = inv[1][2];
+    for (j = 0; j < 3; j++) {
+        coef[j] = 0.0;
+        for (k = 0; k < 3; k++) {
+            inv[j][k] /= det;
+            coef[j] += inv[j][k]*T[k];
+        }
+    }
+    a = coef[0];
+    b = coef[1];
+    c = coef[2];
+    if (c >= 0.0) return(1);
+
+    mu = -b/(2.0*c);
+    sig = sqrt(-1.0/(2.0*c));
+    A = exp(a - b*b/(4.0*c));
+    p[0] = A;
+    p[1] = x0 + mu;
+    p[2] = sig;
+
+    if (cov != NULL) {
+        /* d(A,mu,sig)/d(a,b,c) */
+        double D[3][3] = {{A, A*mu, A*mu*mu},
+                          {0.0, -1.0/(2.0*c), b/(2.0*c*c)},
+                          {0.0, 0.0, sig*sig*sig}};
+        for (i = 0; i < n; i++) {
+            double u, r;
+            if (y[i] <= 0.0) continue;
+            u = x[i] - x0;
+            r = log(y[i]) - (a + b*u + c*u*u);
+            chi2 += y[i]*r*r;
+        }
+        scale = (npos > 3) ? chi2/(npos - 3) : 1.0;
+        if (scale < 1.0) scale = 1.0;
+        for (j = 0; j < 3; j++)
+            for (k = 0; k < 3; k++) {
+                double sum = 0.0;
+                for (int l = 0; l < 3; l++)
+                    for (int m = 0; m < 3; m++)
+                        sum += D[j][l]*inv[l][m]*D[k][m];
+                cov[3*j + k] = scale*sum;
+            }
+    }
+    return(0);
+}
+
+/* Gaussian from the weighted moments of the data, with the peak as the
+ * amplitude. Cruder than the log-parabola, but it never fails on data with
+ * some positive values. */
+static void gaussian_moments(const double *x, const double *y, size_t n, double *p)
+{
+    double sw = 0.0, swx = 0.0, swxx = 0.0, hwhm;
+    size_t i;
+
+    peak(x, y, n, &p[0], &p[1], &hwhm);
+    for (i = 0; i < n; i++) {
+        if (y[i] <= 0.0) continue;
+        sw += y[i];
+        swx += y[i]*x[i];
+    }
+    if (sw <= 0.0) {
+        p[2] = hwhm/sqrt(2.0*M_LN2);
+        return;
+    }
+    p[1] = swx/sw;
+    for (i = 0; i < n; i++)
+        if (y[i] > 0.0)
+            swxx += y[i]*(x[i] - p[1])*(x[i] - p[1]);
+    p[2] = sqrt(swxx/sw);
+    if (p[2] <= 0.0)
+        p[2] = hwhm/sqrt(2.0*M_LN2);
+}
+
+static void gaussian_guess(const double *x, const double *y, size_t n, double *p)
+{
+    if (gaussian_caruana(x, y, n, p, NULL))
+        gaussian_moments(x, y, n, p);
+}
+
+
+/* Exponential plus background: A * exp(-lambda*x) + b */
+static void exponential_guess(const double *x, const double *y, size_t n, double *p)
+{
+    double ymin = y[0], ymax = y[0], eps;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, l, slope;
+    size_t i;
+
+    for (i = 1; i < n; i++) {
+        if (y[i] < ymin) ymin = y[i];
+        if (y[i] > ymax) ymax = y[i];
+    }
+    /* straight line fit to log(y - b) */
+    eps = 0.01*(ymax - ymin) + 1e-300;
+    for (i = 0; i < n; i++) {
+        l = log(y[i] - ymin + eps);
+        sx += x[i];
+        sy += l;
+        sxx += x[i]*x[i];
+        sxy += x[i]*l;
+    }
+    slope = (n*sxx - sx*sx != 0.0) ? (n*sxy - sx*sy)/(n*sxx - sx*sx) : 0.0;
+    p[0] = exp((sy - slope*sx)/n);
+    p[1] = -slope;
+    p[2] = ymin;
+}
+
+
+/* Lorentzian: A / (1 + ((x-mu)/gamma)^2), with gamma the half width */
+static void lorentzian_guess(const double *x, const double *y, size_t n, double *p)
+{
+    peak(x, y, n, &p[0], &p[1], &p[2]);
+}
+
+static void lorentzian_eval(const double *p, const double *x, const double *w, size_t n,
+                            double *m, double *J, size_t tda)
+{
+    double A = p[0];
+    double mu = p[1];
+    double igam = 1.0/p[2];
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        double u = (x[i] - mu)*igam;
+        double iq = 1.0/(1.0 + u*u);
+        if (m)
+            m[i] += A*iq;
+        if (J) {
+            double a = 2.0*A*iq*iq*igam*w[i];
+            J[i*tda]     = iq*w[i];              /* dfi/dA     */
+            J[i*tda + 1] = a*u;                  /* dfi/dmu    */
+            J[i*tda + 2] = a*u*u;                /* dfi/dgamma */
+        }
+    }
+}
+
+
+/* Moffat: A * (1 + ((x-mu)/alpha)^2)^(-beta) */
+static void moffat_guess(const double *x, const double *y, size_t n, double *p)
+{
+    double hwhm;
+
+    peak(x, y, n, &p[0], &p[1], &hwhm);
+    p[3] = 2.5;
+    p[2] = hwhm/sqrt(pow(2.0, 1.0/p[3]) - 1.0);
+}
+
+static void moffat_eval(const double *p, const double *x, const double *w, size_t n,
+                        double *m, double *J, size_t tda)
+{
+    double A = p[0];
+    double mu = p[1];
+    double ialpha = 1.0/p[2];
+    double beta = p[3];
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        double u = (x[i] - mu)*ialpha;
+        double q = 1.0 + u*u;
+        double lq = log(q);
+        double qb = fast_exp(-beta*lq);
+        if (m)
+            m[i] += A*qb;
+        if (J) {
+            double a = 2.0*A*beta*qb/q*ialpha*w[i];
+            J[i*tda]     = qb*w[i];              /* dfi/dA     */
+            J[i*tda + 1] = a*u;                  /* dfi/dmu    */
+            J[i*tda + 2] = a*u*u;                /* dfi/dalpha */
+            J[i*tda + 3] = -A*qb*lq*w[i];        /* dfi/dbeta  */
+        }
+    }
+}
+
+
+/* Constant: c */
+static void constant_guess(const double *x, const double *y, size_t n, double *p)
+{
+    double sum = 0.0;
+
+    for (size_t i = 0; i < n; i++)
+        sum += y[i];
+    p[0] = (n > 0) ? sum/n : 0.0;
+}
+
+static void constant_eval(const double *p, const double *x, const double *w, size_t n,
+                          double *m, double *J, size_t tda)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (m)
+            m[i] += p[0];
+        if (J)
+            J[i*tda] = w[i];                     /* dfi/dc */
+    }
+}
+
+
+static const struct component registry[] = {
+    {"gaussian", "A*exp(-0.5*((x-mu)/sig)^2)", 3, {"A", "mu", "sig"},
+        gaussian_guess, gauss_eval},
+    {"exponential", "A*exp(-lambda*x) + b", 3, {"A", "lambda", "b"},
+        exponential_guess, expb_eval},
+    {"lorentzian", "A/(1 + ((x-mu)/gamma)^2)", 3, {"A", "mu", "gamma"},
+        lorentzian_guess, lorentzian_eval},
+    {"moffat", "A*(1 + ((x-mu)/alpha)^2)^(-beta)", 4, {"A", "mu", "alpha", "beta"},
+        moffat_guess, moffat_eval},
+    {"constant", "c", 1, {"c"},
+        constant_guess, constant_eval},
+    {NULL, NULL, 0, {NULL}, NULL, NULL}
+};
+
+
+/* Parse a model specification such as "gaussian" or "gaussian+constant".
+ * Returns 0 on success. */
+int model_parse(const char *spec, struct model *model)
+{
+    char buf[256];
+    char *name;
+    int k;
+
+    strncpy(buf, spec, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    model->ncomp = 0;
+    model->npar = 0;
+    for (name = strtok(buf, "+"); name != NULL; name = strtok(NULL, "+")) {
+        for (k = 0; registry[k].name != NULL; k++)
+            if (!strcmp(name, registry[k].name))
+                break;
+        if (registry[k].name == NULL) {
+            fprintf(stderr,"Unknown model %s.\n",name);
+            return(1);
+        }
+        if (model->ncomp == MAXCOMP || model->npar + registry[k].npar > MAXMODELPAR) {
+            fprintf(stderr,"Too many model components.\n");
+            return(1);
+        }
+        model->comp[model->ncomp++] = &registry[k];
+        model->npar += registry[k].npar;
+    }
+    if (model->ncomp == 0) {
+        fprintf(stderr,"Empty model.\n");
+        return(1);
+    }
+    return(0);
+}
+
+void model_list(FILE *fp)
+{
+    for (int k = 0; registry[k].name != NULL; k++)
+        fprintf(fp,"    %-12s %s\n",registry[k].name,registry[k].description);
+}
+
+/* Guess each component in turn from what the earlier ones leave unexplained */
+void model_guess(const struct model *model, const double *x, const double *y, size_t n, double *p)
+{
+    double *r = (double *) malloc(n*sizeof(double));
+    double *m = (double *) malloc(n*sizeof(double));
+    size_t c, i, off = 0;
+
+    memcpy(r, y, n*sizeof(double));
+    for (c = 0; c < model->ncomp; c++) {
+        model->comp[c]->guess(x, r, n, p + off);
+        for (i = 0; i < n; i++)
+            m[i] = 0.0;
+        model->comp[c]->eval(p + off, x, NULL, n, m, NULL, 0);
+        for (i = 0; i < n; i++)
+            r[i] -= m[i];
+        off += model->comp[c]->npar;
+    }
+    free(r);
+    free(m);
+}
+
+/* Name of parameter i. Components of a sum are numbered from 1. */
+const char *model_parname(const struct model *model, size_t i, char *buf, size_t len)
+{
+    size_t c;
+
+    for (c = 0; c < model->ncomp; c++) {
+        if (i < model->comp[c]->npar) {
+            if (model->ncomp == 1)
+                return(model->comp[c]->parnames[i]);
+            snprintf(buf, len, "%s_%d", model->comp[c]->parnames[i], (int) c + 1);
+            return(buf);
+        }
+        i -= model->comp[c]->npar;
+    }
+    return(NULL);
+}
+
+int model_data_init(struct model_data *d, const struct model *model, size_t n, double *x, double *y, double *sigma)
+{
+    d->n = n;
+    d->x = x;
+    d->y = y;
+    d->sigma = sigma;
+    d->model = model;
+    d->isigma = (double *) malloc(n*sizeof(double));
+    d->work = (double *) malloc(n*sizeof(double));
+    if (d->isigma == NULL || d->work == NULL)
+        return(1);
+    for (size_t i = 0; i < n; i++)
+        d->isigma[i] = 1.0/sigma[i];
+    return(0);
+}
+
+void model_data_free(struct model_data *d)
+{
+    free(d->isigma);
+    free(d->work);
+}
+
+
+/* Solver callbacks. The residuals are fi = (Yi - yi)/sigma[i], where Yi is
+ * the sum of the model components. */
+
+static void get_params(const gsl_vector *p, const struct model *model, double *pp)
+{
+    for (size_t j = 0; j < model->npar; j++)
+        pp[j] = gsl_vector_get(p, j);
+}
+
+int model_f(const gsl_vector *p, void *data, gsl_vector *f)
+{
+    struct model_data *d = (struct model_data *) data;
+    double pp[MAXMODELPAR];
+    size_t c, i, off = 0;
+
+    get_params(p, d->model, pp);
+    for (i = 0; i < d->n; i++)
+        d->work[i] = 0.0;
+    for (c = 0; c < d->model->ncomp; c++) {
+        d->model->comp[c]->eval(pp + off, d->x, d->isigma, d->n, d->work, NULL, 0);
+        off += d->model->comp[c]->npar;
+    }
+    for (i = 0; i < d->n; i++)
+        f->data[i*f->stride] = (d->work[i] - d->y[i])*d->isigma[i];
+
+    return GSL_SUCCESS;
+}
+
+int model_df(const gsl_vector *p, void *data, gsl_matrix *J)
+{
+    struct model_data *d = (struct model_data *) data;
+    double pp[MAXMODELPAR];
+    size_t c, off = 0;
+
+    get_params(p, d->model, pp);
+    for (c = 0; c < d->model->ncomp; c++) {
+        d->model->comp[c]->eval(pp + off, d->x, d->isigma, d->n, NULL, J->data + off, J->tda);
+        off += d->model->comp[c]->npar;
+    }
+
+    return GSL_SUCCESS;
+}
+
+int model_fdf(const gsl_vector *p, void *data, gsl_vector *f, gsl_matrix *J)
+{
+    struct model_data *d = (struct model_data *) data;
+    double pp[MAXMODELPAR];
+    size_t c, i, off = 0;
+
+    get_params(p, d->model, pp);
+    for (i = 0; i < d->n; i++)
+        d->work[i] = 0.0;
+    for (c = 0; c < d->model->ncomp; c++) {
+        d->model->comp[c]->eval(pp + off, d->x, d->isigma, d->n, d->work, J->data + off, J->tda);
+        off += d->model->comp[c]->npar;
+    }
+    for (i = 0; i < d->n; i++)
+        f->data[i*f->stride] = (d->work[i] - d->y[i])*d->isigma[i];
+
+    return GSL_SUCCESS;
+}
+
+
+/* Unbinned extended maximum likelihood. The model is read as the expected
+ * number of samples per unit x, so for samples xi in [xlo,xhi]
+ *
+ *     -ln L = integral(m, xlo, xhi) - sum ln m(xi)
+ *
+ * The integral is done by Simpson's rule on a fine grid. Both it and the sum
+ * are evaluated CHUNK points at a time, so the component kernels run over
+ * short contiguous arrays that stay in cache, and the chunks of the sum are
+ * shared out between threads. */
+
+#define NGRID 4097
+#define CHUNK 256
+
+int model_sample_init(struct model_sample *s, const struct model *model, size_t n, const double *x,
+                      double xlo, double xhi)
+{
+    double h = (xhi - xlo)/(NGRID - 1);
+
+    s->n = n;
+    s->x = x;
+    s->model = model;
+    s->ngrid = NGRID;
+    s->grid = (double *) malloc(NGRID*sizeof(double));
+    s->qw = (double *) malloc(NGRID*sizeof(double));
+    if (s->grid == NULL || s->qw == NULL)
+        return(1);
+    for (size_t i = 0; i < NGRID; i++) {
+        s->grid[i] = xlo + i*h;
+        s->qw[i] = (i == 0 || i == NGRID - 1 ? 1.0 : (i % 2 ? 4.0 : 2.0))*h/3.0;
+    }
+    return(0);
+}
+
+void model_sample_free(struct model_sample *s)
+{
+    free(s->grid);
+    free(s->qw);
+}
+
+/* Model and (if J is not NULL) its partials at n <= CHUNK points */
+static void eval_chunk(const struct model *model, const double *p, const double *x, const double *one,
+                       size_t n, double *m, double *J)
+{
+    size_t c, off = 0;
+
+    for (size_t i = 0; i < n; i++)
+        m[i] = 0.0;
+    for (c = 0; c < model->ncomp; c++) {
+        model->comp[c]->eval(p + off, x, one, n, m, J ? J + off : NULL, model->npar);
+        off += model->comp[c]->npar;
+    }
+}
+
+/* -ln L at parameters p. If grad is not NULL the gradient is returned in it,
+ * and if info is not NULL the Fisher information matrix, integral(dm/dpj
+ * dm/dpk / m), is returned in it (npar x npar, row major). Returns
+ * GSL_POSINF if the model is not positive at every sample. */
+double model_nll(const struct model_sample *s, const double *p, double *grad, double *info)
+{
+    const size_t np = s->model->npar;
+    double one[CHUNK];
+    double nll = 0.0;
+    int bad = 0;
+    size_t i, j, k;
+
+    for (i = 0; i < CHUNK; i++)
+        one[i] = 1.0;
+    if (grad)
+        for (j = 0; j < np; j++)
+            grad[j] = 0.0;
+    if (info)
+        for (j = 0; j < np*np; j++)
+            info[j] = 0.0;
+
+    /* Expected number of samples */
+    {
+        double m[CHUNK], J[CHUNK*MAXMODELPAR];
+        for (size_t i0 = 0; i0 < s->ngrid; i0 += CHUNK) {
+            size_t len = GSL_MIN(CHUNK, s->ngrid - i0);
+            eval_chunk(s->model, p, s->grid + i0, one, len, m, (grad || info) ? J : NULL);
+            for (i = 0; i < len; i++) {
+                double q = s->qw[i0 + i];
+                nll += q*m[i];
+                if (grad)
+                    for (j = 0; j < np; j++)
+                        grad[j] += q*J[i*np + j];
+                if (info && m[i] > 0)
+                    for (j = 0; j < np; j++)
+                        for (k = 0; k <= j; k++)
+                            info[j*np + k] += q*J[i*np + j]*J[i*np + k]/m[i];
+            }
+        }
+        if (info)
+            for (j = 0; j < np; j++)
+                for (k = 0; k < j; k++)
+                    info[k*np + j] = info[j*np + k];
+    }
+
+    /* Sum over the samples */
+    #pragma omp parallel reduction(+:nll) reduction(||:bad)
+    {
+        double m[CHUNK], J[CHUNK*MAXMODELPAR], g[MAXMODELPAR];
+        size_t ii, jj;
+
+        for (jj = 0; jj < np; jj++)
+            g[jj] = 0.0;
+        #pragma omp for schedule(static)
+        for (long i0 = 0; i0 < (long) s->n; i0 += CHUNK) {
+            size_t len = GSL_MIN(CHUNK, s->n - i0);
+            eval_chunk(s->model, p, s->x + i0, one, len, m, grad ? J : NULL);
+            for (ii = 0; ii < len; ii++) {
+                if (m[ii] <= 0) {
+                    bad = 1;
+                    continue;
+                }
+                nll -= log(m[ii]);
+                if (grad)
+                    for (jj = 0; jj < np; jj++)
+                        g[jj] -= J[ii*np + jj]/m[ii];
+            }
+        }
+        if (grad) {
+            #pragma omp critical
+            for (jj = 0; jj < np; jj++)
+                grad[jj] += g[jj];
+        }
+    }
+
+    return(bad ? GSL_POSINF : nll);
+}
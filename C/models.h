@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+
+/* models.h -- registry of nonlinear models for tfitdist */
+
+#define MAXCOMP 8
+#define MAXMODELPAR 32
+
+/* A model component. eval() adds the component's model values at x into m
+ * (unless m is NULL) and writes its partial derivatives, each multiplied
+ * by the weight w[i], into the first npar columns of J (unless J is NULL).
+ * guess() makes a starting guess for the parameters from data y(x). */
+struct component {
+    const char *name;
+    const char *description;
+    size_t npar;
+    const char *parnames[4];
+    void (*guess)(const double *x, const double *y, size_t n, double *p);
+    void (*eval)(const double *p, const double *x, const double *w, size_t n,
+                 double *m, double *J, size_t tda);
+};
+
+/* A model is a sum of one or more components */
+struct model {
+    size_t ncomp;
+    const struct component *comp[MAXCOMP];
+    size_t npar;
+};
+
+/* Everything the solver callbacks need: the data, the inverse of the
+ * uncertainties, the model, and n doubles of scratch space */
+struct model_data {
+    size_t n;
+    double *x;
+    double *y;
+    double *sigma;
+    double *isigma;
+    const struct model *model;
+    double *work;
+};
+
+/* The samples for an unbinned fit, and a quadrature rule over the range
+ * [xlo,xhi] the model is integrated over */
+struct model_sample {
+    size_t n;
+    const double *x;
+    const struct model *model;
+    size_t ngrid;
+    double *grid;
+    double *qw;
+};
+
+int model_parse(const char *spec, struct model *model);
+void model_list(FILE *fp);
+void model_guess(const struct model *model, const double *x, const double *y, size_t n, double *p);
+const char *model_parname(const struct model *model, size_t i, char *buf, size_t len);
+int model_data_init(struct model_data *d, const struct model *model, size_t n, double *x, double *y, double *sigma);
+void model_data_free(struct model_data *d);
+
+int model_sample_init(struct model_sample *s, const struct model *model, size_t n, const double *x,
+                      double xlo, double xhi);
+void model_sample_free(struct model_sample *s);
+double model_nll(const struct model_sample *s, const double *p, double *grad, double *info);
+
+int gaussian_caruana(const double *x, const double *y, size_t n, double *p, double *cov);
+
+int model_f (const gsl_vector * p, void *data, gsl_vector * f);
+int model_df (const gsl_vector * p, void *data, gsl_matrix * J);
+int model_fdf (const gsl_vector * p, void *data, gsl_vector * f, gsl_matrix * J);
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <math.h>
+#include <stdlib.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_sort.h>
+#include <gsl/gsl_statistics_double.h>
+
+#include "resample.h"
+#include "linsolve.h"
+
+/* resample.c -- bootstrap and Monte Carlo resampling for the fitting programs
+ *
+ * The fitters refit many resampled copies of their data in parallel. To
+ * make the answers depend only on the seed, and not on the number of
+ * threads or the order the replicates are done in, each replicate reseeds
+ * its thread's generator from the seed and the replicate number. */
+
+
+/* Seed r for replicate k. The seed and k are mixed with the splitmix64
+ * finalizer so that neighbouring replicates get unrelated streams. */
+void resample_seed(gsl_rng *r, unsigned long seed, long k)
+{
+    uint64_t z = (uint64_t) seed + (uint64_t) (k + 1)*0x9e3779b97f4a7c15ULL;
+
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+    z = z ^ (z >> 31);
+    gsl_rng_set(r, (unsigned long) (z ^ (z >> 32)));
+}
+
+/* The rows of a bootstrap replicate: n draws with replacement */
+void resample_rows(gsl_rng *r, size_t n, size_t *idx)
+{
+    for (size_t i = 0; i < n; i++)
+        idx[i] = gsl_rng_uniform_int(r, n);
+}
+
+/* The central interval holding a fraction level of the n values in v,
+ * leaving out any that are not finite (replicates whose fit failed). v is
+ * sorted in place. Returns the number of values used. */
+size_t resample_interval(double *v, size_t n, double level, double *lo, double *hi)
+{
+    size_t m = 0;
+
+    for (size_t i = 0; i < n; i++)
+        if (isfinite(v[i]))
+            v[m++] = v[i];
+    if (m == 0) {
+        *lo = *hi = NAN;
+        return(0);
+    }
+    gsl_sort(v, 1, m);
+    *lo = gsl_stats_quantile_from_sorted_data(v, 1, m, 0.5 - 0.5*level);
+    *hi = gsl_stats_quantile_from_sorted_data(v, 1, m, 0.5 + 0.5*level);
+    return(m);
+}
+
+/* Refit nboot resampled copies of the weighted linear least squares
+ * problem y = X c (with weights w) and return the central interval
+ * holding a fraction level of each coefficient in lo and hi. A bootstrap
+ * copy draws rows of X, y and w with replacement; a Monte Carlo copy adds
+ * gaussian noise of standard deviation sigma[i] to each y[i]. Each copy
+ * is solved as the fit itself was, by linsolve_fit() with the method of
+ * solver, and each thread keeps one set of matrices for all of its fits.
+ * Returns the number of copies fitted. */
+long resample_linear(const gsl_matrix *X, const gsl_vector *w, const gsl_vector *y, const double *sigma,
+                     const struct linsolve *solver, long nboot, unsigned long seed, int montecarlo,
+                     double level, double *lo, double *hi)
+{
+    const size_t n = X->size1;
+    const size_t p = X->size2;
+    double *rep = (double *) malloc(p*nboot*sizeof(double));
+    long nok = 0;
+
+    gsl_set_error_handler_off();
+    #pragma omp parallel reduction(+:nok)
+    {
+        struct linsolve ls = *solver;
+        gsl_matrix *Xb = gsl_matrix_alloc(n, p);
+        gsl_matrix *cov = gsl_matrix_alloc(p, p);
+        gsl_vector *wb = gsl_vector_alloc(n);
+        gsl_vector *yb = gsl_vector_alloc(n);
+        gsl_vector *c = gsl_vector_alloc(p);
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_mt19937);
+        size_t *idx = (size_t *) malloc(n*sizeof(size_t));
+        double chisq;
+
+        if (montecarlo) {
+            gsl_matrix_memcpy(Xb, X);
+            gsl_vector_memcpy(wb, w);
+        }
+        #pragma omp for schedule(dynamic)
+        for (long k = 0; k < nboot; k++) {
+            resample_seed(r, seed, k);
+            if (montecarlo) {
+                for (size_t i = 0; i < n; i++)
+                    gsl_vector_set(yb, i, gsl_vector_get(y, i) + gsl_ran_gaussian_ziggurat(r, sigma[i]));
+            }
+            else {
+                resample_rows(r, n, idx);
+                for (size_t i = 0; i < n; i++) {
+                    gsl_vector_const_view row = gsl_matrix_const_row(X, idx[i]);
+                    gsl_matrix_set_row(Xb, i, &row.vector);
+                    gsl_vector_set(yb, i, gsl_vector_get(y, idx[i]));
+                    gsl_vector_set(wb, i, gsl_vector_get(w, idx[i]));
+                }
+            }
+            if (linsolve_fit(&ls, Xb, wb, yb, c, cov, &chisq)) {
+                for (size_t j = 0; j < p; j++)
+                    rep[j*nboot + k] = NAN;
+                continue;
+            }
+            for (size_t j = 0; j < p; j++)
+                rep[j*nboot + k] = gsl_vector_get(c, j);
+            nok++;
+        }
+        gsl_matrix_free(Xb);
+        gsl_matrix_free(cov);
+        gsl_vector_free(wb);
+        gsl_vector_free(yb);
+        gsl_vector_free(c);
+        gsl_rng_free(r);
+        free(idx);
+    }
+
+    for (size_t j = 0; j < p; j++)
+        resample_interval(rep + j*nboot, nboot, level, &lo[j], &hi[j]);
+    free(rep);
+    return(nok);
+}
@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_vector.h>
+
+/* resample.h -- bootstrap and Monte Carlo resampling for the fitting programs */
+
+struct linsolve;
+
+void resample_seed(gsl_rng *r, unsigned long seed, long k);
+void resample_rows(gsl_rng *r, size_t n, size_t *idx);
+size_t resample_interval(double *v, size_t n, double level, double *lo, double *hi);
+long resample_linear(const gsl_matrix *X, const gsl_vector *w, const gsl_vector *y, const double *sigma,
+                     const struct linsolve *solver, long nboot, unsigned long seed, int montecarlo,
+                     double level, double *lo, double *hi);
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_blas.h>
+#include <gsl/gsl_sort.h>
+#include <gsl/gsl_statistics_double.h>
+
+#include "robust.h"
+#include "linsolve.h"
+
+/* robust.c -- robust linear least squares for tfitpoly and tfitsurf
+ *
+ * The fit minimizes a sum of rho(r/s) rather than of (r/s)^2, where r are
+ * the residuals (times the square root of the weights) and s is their
+ * scale. It is solved by iteratively reweighted least squares: each pass
+ * takes the residuals of the previous solution, turns them into
+ * robustness weights, and solves the weighted fit again. The passes go
+ * through linsolve.c like the ordinary fits, so they get its column
+ * scaling and its choice of solver, with SVD for ill-conditioned
+ * problems such as polynomials in offset abscissae. Each pass starts from
+ * the previous solution, and the iteration stops once no weight changes
+ * or the coefficients settle. */
+
+static const char *names[] = {"none", "huber", "tukey", "clip"};
+static const double tunes[] = {0.0, 1.345, 4.685, 3.0};
+
+
+/* Set the method (and its default tuning constant) from its name.
+ * Returns 1 if the name is unknown. */
+int robust_method(const char *name, struct robust *r)
+{
+    for (int k = 0; k < 4; k++) {
+        if (!strcmp(name, names[k])) {
+            r->method = k;
+            r->tune = tunes[k];
+            return(0);
+        }
+    }
+    return(1);
+}
+
+const char *robust_name(const struct robust *r)
+{
+    return(names[r->method]);
+}
+
+/* Robustness weight for a residual u in units of the scale */
+static double weight(int method, double u, double k)
+{
+    u = fabs(u);
+    switch (method) {
+        case ROBUST_HUBER:
+            return(u <= k ? 1.0 : k/u);
+        case ROBUST_TUKEY:
+            return(u < k ? (1.0 - (u/k)*(u/k))*(1.0 - (u/k)*(u/k)) : 0.0);
+        case ROBUST_CLIP:
+            return(u <= k ? 1.0 : 0.0);
+    }
+    return(1.0);
+}
+
+/* Fit y = X c with weights w robustly. Each pass is solved by
+ * linsolve_fit() with the solver in ls, so c, cov and chisq are those of
+ * the final weighted fit, with chisq its weighted sum of squares. A
+ * non-zero status means the solver failed: either on the starting fit, in
+ * which case c, cov and chisq are NaN, or on a later pass, in which case
+ * the fit is the last one that succeeded. */
+int robust_fit(const gsl_matrix *X, const gsl_vector *y, const gsl_vector *w, struct robust *r,
+               struct linsolve *ls, gsl_vector *c, gsl_matrix *cov, double *chisq)
+{
+    const size_t n = X->size1;
+    const size_t p = X->size2;
+    gsl_vector *ww, *cold;
+    gsl_matrix *covold;
+    double *rw, *res, *tmp, chisqold;
+    int status;
+    size_t i, j;
+
+    /* Start from the ordinary weighted fit. If even that fails there is
+     * nothing to improve on. */
+    r->iter = 0;
+    r->scale = 0.0;
+    r->nlow = 0;
+    status = linsolve_fit(ls, X, w, y, c, cov, chisq);
+    if (status) {
+        gsl_vector_set_all(c, GSL_NAN);
+        gsl_matrix_set_all(cov, GSL_NAN);
+        *chisq = GSL_NAN;
+        return(status);
+    }
+
+    ww = gsl_vector_alloc(n);
+    cold = gsl_vector_alloc(p);
+    covold = gsl_matrix_alloc(p, p);
+    rw = (double *) malloc(n*sizeof(double));
+    res = (double *) malloc(n*sizeof(double));
+    tmp = (double *) malloc(n*sizeof(double));
+    for (i = 0; i < n; i++)
+        rw[i] = 1.0;
+
+    while (r->iter < r->maxiter) {
+        long changed = 0;
+        int converged = 1;
+
+        r->iter++;
+
+        /* Residuals of the previous solution and their scale */
+        for (i = 0; i < n; i++) {
+            gsl_vector_const_view row = gsl_matrix_const_row(X, i);
+            double m;
+            gsl_blas_ddot(&row.vector, c, &m);
+            res[i] = sqrt(gsl_vector_get(w, i))*(gsl_vector_get(y, i) - m);
+        }
+        if (r->method == ROBUST_CLIP) {
+            double sum = 0.0, sw = 0.0;
+            for (i = 0; i < n; i++) {
+                sum += rw[i]*res[i]*res[i];
+                sw += rw[i];
+            }
+            r->scale = sw > p ? sqrt(sum/(sw - p)) : 0.0;
+        }
+        else {
+            for (i = 0; i < n; i++)
+                tmp[i] = fabs(res[i]);
+            gsl_sort(tmp, 1, n);
+            r->scale = 1.4826*gsl_stats_median_from_sorted_data(tmp, 1, n);
+        }
+        if (r->scale <= 0.0)
+            break;
+
+        /* New weights */
+        for (i = 0; i < n; i++) {
+            tmp[i] = weight(r->method, res[i]/r->scale, r->tune);
+            if (tmp[i] != rw[i])
+                changed++;
+            gsl_vector_set(ww, i, tmp[i]*gsl_vector_get(w, i));
+        }
+        if (changed == 0)
+            break;
+
+        /* Solve again. If that fails, keep the previous fit and weights,
+         * and stop there. */
+        gsl_vector_memcpy(cold, c);
+        gsl_matrix_memcpy(covold, cov);
+        chisqold = *chisq;
+        status = linsolve_fit(ls, X, ww, y, c, cov, chisq);
+        if (status) {
+            gsl_vector_memcpy(c, cold);
+            gsl_matrix_memcpy(cov, covold);
+            *chisq = chisqold;
+            break;
+        }
+        memcpy(rw, tmp, n*sizeof(double));
+        for (j = 0; j < p; j++)
+            if (fabs(gsl_vector_get(c, j) - gsl_vector_get(cold, j)) > 1e-8*(1.0 + fabs(gsl_vector_get(c, j))))
+                converged = 0;
+        if (converged)
+            break;
+    }
+
+    for (i = 0; i < n; i++)
+        if (rw[i] < 0.5)
+            r->nlow++;
+
+    gsl_vector_free(ww);
+    gsl_vector_free(cold);
+    gsl_matrix_free(covold);
+    free(rw);
+    free(res);
+    free(tmp);
+    return(status);
+}
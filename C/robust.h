@@ -0,0 +1,25 @@
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+
+/* robust.h -- robust linear least squares by iteratively reweighted least squares */
+
+struct linsolve;
+
+#define ROBUST_NONE  0
+#define ROBUST_HUBER 1
+#define ROBUST_TUKEY 2
+#define ROBUST_CLIP  3
+
+struct robust {
+    int method;
+    double tune;        /* tuning constant, in units of the residual scale */
+    int maxiter;
+    int iter;           /* iterations taken */
+    double scale;       /* final residual scale */
+    long nlow;          /* points given less than half weight */
+};
+
+int robust_method(const char *name, struct robust *r);
+const char *robust_name(const struct robust *r);
+int robust_fit(const gsl_matrix *X, const gsl_vector *y, const gsl_vector *w, struct robust *r,
+               struct linsolve *ls, gsl_vector *c, gsl_matrix *cov, double *chisq);
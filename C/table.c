@@ -15,6 +15,150 @@ int is_numeric (const char * s)
 }
 
 
+/* Read the next data row from stdin, for programs that stream a table
+ * rather than loading it. The caller sets every col[k] to -1 and *ncol to
+ * 0 before the first call; header lines met along the way are used to
+ * fill them in. The values of the named columns are returned in values.
+ * Returns 1 if a row was read, 0 at the end of the table and -1 on error. */
+int read_row(int ncols, char **colnames, int *col, int *ncol, double *values)
+{
+    static char *line = NULL;
+    static size_t len = 0;
+    ssize_t nread;
+    char *dummy1,*dummy2,*keyword,*description;
+    const char delims[]=" \n";
+    char *tok;
+    int i, k, maxcol = -1;
+
+    while ((nread = getline(&line, &len, stdin)) != -1) {
+
+        if (!strncmp(&line[0],"#",1))
+        { 
+            // HEADER
+       
+            // Skip comments
+            if (!strncmp(&line[1],"!",1)) continue;
+            
+            // Determine columns numbers corresponding to desired column names.
+            dummy1      = strtok(line,delims);
+            dummy2      = strtok(NULL,delims);
+            keyword     = strtok(NULL,delims);
+            description = strtok(NULL,delims);
+            for (k=0;k<ncols;k++)
+                if (!strncmp(colnames[k],keyword,64))
+                    col[k] = *ncol;
+            (*ncol)++;
+            continue;
+        }
+
+        // DATA
+
+        // Skip blank lines
+        if (line[strspn(line," \t\r\n")] == '\0') continue;
+
+        for (k=0;k<ncols;k++) {
+            if (col[k] < 0){
+                fprintf(stderr,"Keyword %s not found.\n",colnames[k]);
+                return(-1);
+            }
+            if (col[k] > maxcol)
+                maxcol = col[k];
+        }
+
+        // Only tokenize as far as the last column we need
+        tok = strtok(line,delims);
+        for (i=0; tok != NULL; i++) {
+            for (k=0;k<ncols;k++)
+                if (col[k] == i)
+                    values[k] = atof(tok);
+            if (i == maxcol)
+                break;
+            tok = strtok(NULL,delims);
+        }
+        // The loop only runs out of tokens if the field at maxcol is missing
+        if (tok == NULL) {
+            fprintf(stderr,"Short data row.\n");
+            return(-1);
+        }
+        return(1);
+    }
+
+    free(line);
+    line = NULL;
+    len = 0;
+    return(0);
+}
+
+
+int read_cols(int ncols, char **colnames, double **data, int *nrow)
+{
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+    int ncol = 0;
+    int *col;
+    char *dummy1,*dummy2,*keyword,*description;
+    const char delims[]=" \n";
+    char **tok = NULL;
+
+    col = malloc(ncols*sizeof(int));
+    for (int k=0;k<ncols;k++)
+        col[k] = -1;
+
+    *nrow = 0;
+    while ((nread = getline(&line, &len, stdin)) != -1) {
+
+        if (!strncmp(&line[0],"#",1))
+        { 
+            // HEADER
+       
+            // Skip comments
+            if (!strncmp(&line[1],"!",1)) continue;
+            
+            // Determine columns numbers corresponding to desired column names.
+            dummy1      = strtok(line,delims);
+            dummy2      = strtok(NULL,delims);
+            keyword     = strtok(NULL,delims);
+            description = strtok(NULL,delims);
+            for (int k=0;k<ncols;k++)
+                if (!strncmp(colnames[k],keyword,64))
+                    col[k] = ncol;
+            ncol++;
+        }
+        else
+        {
+            // DATA
+            
+            if (*nrow==0) {
+                for (int k=0;k<ncols;k++) {
+                    if (col[k] < 0){
+                        fprintf(stderr,"Keyword %s not found.\n",colnames[k]);
+                        free(col);
+                        return(1);
+                    }
+                }
+                tok = malloc(ncol*sizeof(char *));
+            }
+
+            *tok = strtok(line,delims);
+            for (int i=1;i<ncol;i++)
+                *(tok + i) = strtok(NULL,delims);
+
+            for (int k=0;k<ncols;k++)
+                data[k][*nrow] = atof(*(tok + col[k]));
+
+            (*nrow)++; 
+        }
+    }
+
+    free(line);
+    free(tok);
+    free(col);
+
+    return (0);
+}
+
+
 int read_xyzs(char *xcolname, char *ycolname, char *zcolname, char *scolname, double *x, double *y, double *z, double *s, int *nrow)
 {
     char *line = NULL;
@@ -253,3 +397,92 @@ int read_xy(char *xcolname, char *ycolname, double *x, double *y, int *nrow)
 
     return (0);
 }
+
+
+/* Split a header line "#   3 MAG_AUTO  Kron-like magnitude  [mag]" into
+ * the column number, the keyword and the offset of the text after the
+ * number. Returns 0 if it is not a column description. */
+int header_column(const char *line, size_t len, int *number, char *keyword, size_t size,
+                  size_t *rest)
+{
+    size_t i = 1, start, l;
+
+    while (i < len && isspace((unsigned char) line[i]))
+        i++;
+    if (i == len || !isdigit((unsigned char) line[i]))
+        return(0);
+    *number = atoi(line + i);
+    while (i < len && isdigit((unsigned char) line[i]))
+        i++;
+    *rest = i;
+    while (i < len && isspace((unsigned char) line[i]))
+        i++;
+    start = i;
+    while (i < len && !isspace((unsigned char) line[i]))
+        i++;
+    l = i - start;
+    if (l == 0 || l >= size)
+        return(0);
+    memcpy(keyword, line + start, l);
+    keyword[l] = '\0';
+    return(1);
+}
+
+
+/* Block line reader, for streaming tools that pass lines through */
+
+#define BLOCK (1 << 20)
+
+void reader_init(struct reader *r, FILE *fp)
+{
+    r->fp = fp;
+    r->size = BLOCK;
+    r->buf = (char *) malloc(r->size + 1);
+    r->start = r->end = 0;
+    r->eof = 0;
+}
+
+void reader_free(struct reader *r)
+{
+    free(r->buf);
+}
+
+/* Return up to max complete lines (with their newlines, except perhaps
+ * the last line of the file). Returns 0 at the end of the file. */
+int reader_lines(struct reader *r, const char **line, size_t *len, int max)
+{
+    int n = 0;
+
+    /* Refill only when no complete line is left */
+    while (!r->eof && !memchr(r->buf + r->start, '\n', r->end - r->start)) {
+        size_t got;
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+        if (r->end == r->size) {
+            r->size *= 2;
+            r->buf = (char *) realloc(r->buf, r->size + 1);
+        }
+        got = fread(r->buf + r->end, 1, r->size - r->end, r->fp);
+        r->end += got;
+        if (got == 0)
+            r->eof = 1;
+    }
+    r->buf[r->end] = '\0';
+
+    while (n < max && r->start < r->end) {
+        char *p = r->buf + r->start;
+        char *nl = (char *) memchr(p, '\n', r->end - r->start);
+        size_t l;
+        if (nl)
+            l = nl - p + 1;
+        else if (r->eof)
+            l = r->end - r->start;
+        else
+            break;
+        line[n] = p;
+        len[n++] = l;
+        r->start += l;
+    }
+    return(n);
+}
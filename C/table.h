@@ -1,4 +1,21 @@
+#include <stdio.h>
+
+/* Reads lines from a file in large blocks. The lines returned by
+ * reader_lines() stay valid until the next call. */
+struct reader {
+    FILE *fp;
+    char *buf;
+    size_t size, start, end;
+    int eof;
+};
+
+int read_row(int ncols, char **colnames, int *col, int *ncol, double *values);
+int read_cols(int ncols, char **colnames, double **data, int *nrow);
 int read_xy(char *xcolname, char *ycolname, double *x, double *y, int *nrow);
 int read_xyz(char *xcolname, char *ycolname, char *zcolname, double *x, double *y, double *z, int *nrow);
 int read_xyzs(char *xcolname, char *ycolname, char *zcolname, char *scolname, double *x, double *y, double *z, double *s, int *nrow);
 int isNumeric (const char * s);
+int header_column(const char *line, size_t len, int *number, char *keyword, size_t size, size_t *rest);
+void reader_init(struct reader *r, FILE *fp);
+void reader_free(struct reader *r);
+int reader_lines(struct reader *r, const char **line, size_t *len, int max);
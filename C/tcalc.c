@@ -0,0 +1,242 @@
+// Append computed columns to a table. A native replacement for
+// Perl/tcalc.pl: the expressions are compiled once, optimized together
+// (constants folded, shared subexpressions computed once) and evaluated
+// on batches of rows (see expr.c).
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include "table.h"
+#include "expr.h"
+
+#define MAXEXPR 64
+
+char   *help[] = {
+"",
+"NAME",
+"    tcalc - add columns computed from other columns to a table",
+"",
+"SYNOPSIS",
+"    % tcalc [OPTIONS] \"expression\" [\"expression\" ...] < table.txt ",
+"",
+"OPTIONS",
+"    -c names Comma-separated names of the new columns [default CALC, or",
+"             CALC1, CALC2, ... for several expressions]",
+"    -h       Print help",
+"",
+"DESCRIPTION",
+"",
+"    This program appends to each row of a SExtractor ASCII table",
+"    provided via standard input the value of an expression, e.g.",
+"",
+"        tcalc \"sqrt((X_IMAGE-1650)**2 + (Y_IMAGE-1250)**2)\" < catalog",
+"",
+"    The expression syntax is that of tfilter (see tfilter -h), so",
+"    column names stand for the values in those columns. Several",
+"    expressions can be given, and each becomes a column. They are",
+"    compiled together: arithmetic on constants is done once, and a",
+"    subexpression that appears more than once (in one expression or in",
+"    several) is computed once per row.",
+"",
+"    The header gains a line for each new column, and a pair of comment",
+"    lines recording each expression as given and with its columns",
+"    numbered. Values are printed as Perl prints them: numbers with 15",
+"    significant digits, comparisons as 1 or nothing, and nothing where",
+"    the expression cannot be evaluated (e.g. a division by zero). As in",
+"    the Perl version, a table without data rows produces no output.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+/* Header lines are held until the first data row, when the new columns
+ * are known to follow the old ones */
+struct header {
+    char *text;
+    size_t len;
+    size_t size;
+};
+
+static void header_add(struct header *h, const char *line, size_t len)
+{
+    if (h->len + len + 1 > h->size) {
+        h->size = 2*(h->len + len + 1);
+        h->text = (char *) realloc(h->text, h->size);
+    }
+    memcpy(h->text + h->len, line, len);
+    h->len += len;
+    if (line[len - 1] != '\n')
+        h->text[h->len++] = '\n';
+}
+
+/* Write the rows of a batch with the values of the expressions appended */
+static void flush(struct expr *e, int nexpr, int maxcol, struct expr_batch *b,
+                  const char **line, size_t *len, int n)
+{
+    char buf[1024];
+
+    if (n == 0)
+        return;
+    expr_batch_split(b, line, len, n, maxcol + 1);
+    for (int k = 0; k < nexpr; k++)
+        expr_evaluate(&e[k], b);
+    for (int i = 0; i < n; i++) {
+        size_t l = len[i];
+        if (l > 0 && line[i][l - 1] == '\n')
+            l--;
+        fwrite(line[i], 1, l, stdout);
+        for (int k = 0; k < nexpr; k++) {
+            int m = expr_format(&e[k], b, i, buf, sizeof(buf));
+            fputs("  ", stdout);
+            fwrite(buf, 1, m, stdout);
+        }
+        putchar('\n');
+    }
+}
+
+
+int main (int argc, char **argv)
+{
+    struct reader r;
+    struct expr e[MAXEXPR];
+    struct expr_batch b = {0};
+    struct header data_header = {NULL, 0, 0}, comment_header = {NULL, 0, 0};
+    const char *line[EXPR_BATCH], *data[EXPR_BATCH];
+    size_t len[EXPR_BATCH], dlen[EXPR_BATCH];
+    char keyword[1024], err[1024];
+    char *original[MAXEXPR], *modified[MAXEXPR];
+    char *colname[MAXEXPR];
+    char *names = NULL;
+    int nexpr, maxcol = -1;
+    int colnum = 0;
+    int compiled = 0;
+    int n, nd, c;
+
+    while ((c = getopt (argc, argv, "hc:")) != -1)
+        switch (c)
+        {
+            case 'c':
+                names = optarg;
+                break;
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'c')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    nexpr = argc - optind;
+    if (nexpr < 1 || nexpr > MAXEXPR)
+    {
+        print_help();
+        return(1);
+    }
+    for (int k = 0; k < nexpr; k++) {
+        original[k] = argv[optind + k];
+        modified[k] = strdup(original[k]);
+        colname[k] = NULL;
+    }
+
+    /* Names of the new columns */
+    if (names) {
+        char *tok = strtok(names, ",");
+        for (int k = 0; k < nexpr && tok; k++, tok = strtok(NULL, ","))
+            colname[k] = tok;
+    }
+    for (int k = 0; k < nexpr; k++)
+        if (!colname[k]) {
+            colname[k] = (char *) malloc(32);
+            if (nexpr == 1)
+                strcpy(colname[k], "CALC");
+            else
+                sprintf(colname[k], "CALC%d", k + 1);
+        }
+
+    reader_init(&r, stdin);
+    while ((n = reader_lines(&r, line, len, EXPR_BATCH)) > 0) {
+        nd = 0;
+        for (int i = 0; i < n; i++) {
+            if (line[i][0] == '#') {
+                flush(e, nexpr, maxcol, &b, data, dlen, nd);
+                nd = 0;
+                if (len[i] > 1 && line[i][1] == '!') {
+                    if (compiled)
+                        fwrite(line[i], 1, len[i], stdout);
+                    else
+                        header_add(&comment_header, line[i], len[i]);
+                    continue;
+                }
+                if (compiled) {
+                    fwrite(line[i], 1, len[i], stdout);
+                    continue;
+                }
+                header_add(&data_header, line[i], len[i]);
+                if (expr_header_keyword(line[i], len[i], keyword, sizeof(keyword)))
+                    for (int k = 0; k < nexpr; k++) {
+                        char *s = expr_substitute(modified[k], keyword, colnum);
+                        free(modified[k]);
+                        modified[k] = s;
+                    }
+                colnum++;
+                continue;
+            }
+
+            // First data row: write the header and compile
+            if (!compiled) {
+                fwrite(data_header.text, 1, data_header.len, stdout);
+                for (int k = 0; k < nexpr; k++)
+                    printf("#  %d %s            Result of tcalc      [unspecified]\n",
+                           colnum + k + 1, colname[k]);
+                fwrite(comment_header.text, 1, comment_header.len, stdout);
+                for (int k = 0; k < nexpr; k++) {
+                    printf("#! tcalc_string = %s\n", original[k]);
+                    printf("#! tcalc_string_modified = %s\n", modified[k]);
+                }
+                for (int k = 0; k < nexpr; k++) {
+                    if (expr_compile(&e[k], modified[k], err, sizeof(err))) {
+                        fflush(stdout);
+                        fprintf(stderr, "Syntax error: %s\n", err);
+                        exit(1);
+                    }
+                    if (e[k].maxcol > maxcol)
+                        maxcol = e[k].maxcol;
+                }
+                expr_optimize(e, nexpr);
+                compiled = 1;
+            }
+            data[nd] = line[i];
+            dlen[nd++] = len[i];
+        }
+        flush(e, nexpr, maxcol, &b, data, dlen, nd);
+    }
+
+    for (int k = 0; k < nexpr && compiled; k++)
+        expr_free(&e[k]);
+    expr_batch_free(&b);
+    reader_free(&r);
+    return 0;
+}
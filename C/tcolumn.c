@@ -0,0 +1,186 @@
+// Cut named columns out of a table in one streaming pass. A native
+// replacement for Bash/tcolumn.sh, which copied the input to temporary
+// files and matched column names as substrings.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include "table.h"
+
+#define BATCH 1024
+#define MAXCOLS 1024
+
+char   *help[] = {
+"",
+"NAME",
+"    tcolumn - cut named columns out of a table",
+"",
+"SYNOPSIS",
+"    % tcolumn [OPTIONS] colname [colname ...] < table.txt ",
+"",
+"OPTIONS",
+"    -H       Print a header for the output columns",
+"    -h       Print help",
+"",
+"DESCRIPTION",
+"",
+"    This program writes the named columns of a SExtractor ASCII table",
+"    provided via standard input, in the order they are named and",
+"    separated by single spaces, e.g.",
+"",
+"        extract foo.fits | tcolumn X_IMAGE Y_IMAGE FWHM_IMAGE",
+"",
+"    Column names must match exactly (so NUMBER does not pick out",
+"    FILTER_NUMBER), and are found in the columns the header gives for",
+"    them (so a vector column such as FLUX_APER, whose header line",
+"    covers several columns, does not shift the rest). With -H the",
+"    header lines of the chosen columns are written first, renumbered",
+"    from 1 in their new order. Comment lines (#!) and empty rows are",
+"    dropped. The table is read once, and each row only as far as the",
+"    last column wanted.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+int main (int argc, char **argv)
+{
+    struct reader r;
+    const char *line[BATCH];
+    size_t len[BATCH];
+    char **keyword = NULL, **header = NULL;
+    size_t *rest = NULL;
+    int *number = NULL;
+    int nheader = 0, hsize = 0;
+    char **colnames;
+    int *col, *desc;
+    int ncols, maxcol = -1;
+    int print_header = 0;
+    int resolved = 0;
+    const char **tok;
+    int *toklen;
+    int n, c;
+
+    while ((c = getopt (argc, argv, "Hh")) != -1)
+        switch (c)
+        {
+            case 'H':
+                print_header = 1;
+                break;
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'c')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    ncols = argc - optind;
+    if (ncols < 1 || ncols > MAXCOLS)
+    {
+        print_help();
+        return(1);
+    }
+    colnames = argv + optind;
+    col = (int *) malloc(ncols*sizeof(int));
+    desc = (int *) malloc(ncols*sizeof(int));
+
+    reader_init(&r, stdin);
+    while ((n = reader_lines(&r, line, len, BATCH)) > 0) {
+        for (int i = 0; i < n; i++) {
+            const char *s = line[i], *end = line[i] + len[i];
+
+            if (s[0] == '#') {
+                char name[1024];
+                size_t at;
+                if (resolved || (len[i] > 1 && s[1] == '!'))
+                    continue;
+                if (nheader == hsize) {
+                    hsize = hsize ? 2*hsize : 64;
+                    keyword = (char **) realloc(keyword, hsize*sizeof(char *));
+                    header = (char **) realloc(header, hsize*sizeof(char *));
+                    rest = (size_t *) realloc(rest, hsize*sizeof(size_t));
+                    number = (int *) realloc(number, hsize*sizeof(int));
+                }
+                if (!header_column(s, len[i], &number[nheader], name, sizeof(name), &at)
+                    || number[nheader] < 1)
+                    continue;
+                keyword[nheader] = strdup(name);
+                header[nheader] = strndup(s, len[i]);
+                rest[nheader++] = at;
+                continue;
+            }
+
+            // The header is complete at the first data row
+            if (!resolved) {
+                for (int k = 0; k < ncols; k++) {
+                    desc[k] = -1;
+                    for (int j = 0; j < nheader && desc[k] < 0; j++)
+                        if (!strcmp(keyword[j], colnames[k]))
+                            desc[k] = j;
+                    if (desc[k] < 0) {
+                        fprintf(stderr,"Keyword %s not found.\n",colnames[k]);
+                        exit(1);
+                    }
+                    col[k] = number[desc[k]] - 1;
+                    if (col[k] > maxcol)
+                        maxcol = col[k];
+                }
+                if (print_header)
+                    for (int k = 0; k < ncols; k++) {
+                        const char *h = header[desc[k]];
+                        printf("#%4d%s", k + 1, h + rest[desc[k]]);
+                        if (h[strlen(h) - 1] != '\n')
+                            putchar('\n');
+                    }
+                tok = (const char **) malloc((maxcol + 1)*sizeof(char *));
+                toklen = (int *) malloc((maxcol + 1)*sizeof(int));
+                resolved = 1;
+            }
+
+            // Split the row as far as the last column wanted
+            for (int k = 0; k <= maxcol; k++) {
+                while (s < end && isspace((unsigned char) *s))
+                    s++;
+                tok[k] = s;
+                while (s < end && !isspace((unsigned char) *s))
+                    s++;
+                toklen[k] = (int) (s - tok[k]);
+            }
+            if (toklen[0] == 0)
+                continue;
+            for (int k = 0; k < ncols; k++) {
+                if (k > 0)
+                    putchar(' ');
+                fwrite(tok[col[k]], 1, toklen[col[k]], stdout);
+            }
+            putchar('\n');
+        }
+    }
+
+    reader_free(&r);
+    return 0;
+}
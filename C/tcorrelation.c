@@ -0,0 +1,427 @@
+// Means, covariances and correlations of any number of table columns, in
+// one streaming pass. A native replacement for Perl/tcorrelation.pl, which
+// held two columns in memory and read them twice.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_eigen.h>
+#include "table.h"
+
+#define BATCH 8192
+#define CHUNK 256
+
+char   *help[] = {
+"",
+"NAME",
+"    tcorrelation - covariance and correlation statistics of table columns",
+"",
+"SYNOPSIS",
+"    % tcorrelation [OPTIONS] colname1 colname2 [colname ...] < table.txt ",
+"",
+"OPTIONS",
+"    -h       Print help",
+"",
+"DESCRIPTION",
+"",
+"    This program reads a SExtractor ASCII table provided via standard",
+"    input and computes, for the named columns,",
+"",
+"        * the mean and variance of each column",
+"        * the covariance and correlation matrices",
+"        * the eigenvalues and eigenvectors of the covariance matrix",
+"        * the axes of the 1 sigma error ellipse (or ellipsoid)",
+"",
+"    e.g.",
+"",
+"        extract foo.fits | tcorrelation X_IMAGE Y_IMAGE",
+"",
+"    Variances and covariances are normalized by the number of rows, as",
+"    before. Rows where any of the columns is not a finite number are",
+"    skipped, so every entry of the matrices comes from the same rows.",
+"    With two columns the position angle of the major axis of the",
+"    ellipse is also given, in degrees counterclockwise from the first",
+"    column's axis. Eigenvectors are listed with their largest component",
+"    positive.",
+"",
+"    The table is read once, in blocks. Each block is cut into chunks",
+"    whose means and sums of squared deviations are found directly and",
+"    then merged pairwise (Chan, Golub & LeVeque 1979), which is as",
+"    accurate as two passes over the data. The chunks are processed in",
+"    parallel when built with OpenMP, and the answer does not depend on",
+"    the number of threads.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+/* Running moments of p columns: the number of rows, their means and the
+ * sums of products of deviations from the means (upper triangle of m2) */
+struct moments {
+    double n;
+    double *mean;
+    double *m2;
+};
+
+
+static void moments_alloc(struct moments *m, int p)
+{
+    m->n = 0.0;
+    m->mean = (double *) calloc(p, sizeof(double));
+    m->m2 = (double *) calloc(p*p, sizeof(double));
+}
+
+
+static void moments_free(struct moments *m)
+{
+    free(m->mean);
+    free(m->m2);
+}
+
+
+/* Moments of the n rows of x (n x p, row major), two passes over rows
+ * that are already in memory */
+static void moments_rows(struct moments *m, const double *x, int n, int p)
+{
+    m->n = n;
+    for (int j = 0; j < p; j++)
+        m->mean[j] = 0.0;
+    for (int j = 0; j < p*p; j++)
+        m->m2[j] = 0.0;
+    if (n == 0)
+        return;
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < p; j++)
+            m->mean[j] += x[i*p + j];
+    for (int j = 0; j < p; j++)
+        m->mean[j] /= n;
+    for (int i = 0; i < n; i++) {
+        double d[p];
+        for (int j = 0; j < p; j++)
+            d[j] = x[i*p + j] - m->mean[j];
+        for (int j = 0; j < p; j++)
+            for (int k = j; k < p; k++)
+                m->m2[j*p + k] += d[j]*d[k];
+    }
+}
+
+
+/* Fold b into a */
+static void moments_merge(struct moments *a, const struct moments *b, int p)
+{
+    double n = a->n + b->n, f;
+
+    if (b->n == 0)
+        return;
+    if (a->n == 0) {
+        a->n = b->n;
+        memcpy(a->mean, b->mean, p*sizeof(double));
+        memcpy(a->m2, b->m2, p*p*sizeof(double));
+        return;
+    }
+    f = a->n*b->n/n;
+    {
+        double d[p];
+        for (int j = 0; j < p; j++)
+            d[j] = b->mean[j] - a->mean[j];
+        for (int j = 0; j < p; j++)
+            for (int k = j; k < p; k++)
+                a->m2[j*p + k] += b->m2[j*p + k] + f*d[j]*d[k];
+        for (int j = 0; j < p; j++)
+            a->mean[j] += d[j]*b->n/n;
+    }
+    a->n = n;
+}
+
+
+/* Read the wanted fields of a line into v; returns 0 if one is missing or
+ * is not a finite number */
+static int parse_row(const char *s, size_t len, const int *col, const int *order, int p, int maxcol,
+                     double *v)
+{
+    const char *end = s + len;
+    int k = 0;
+
+    for (int c = 0; c <= maxcol && k < p; c++) {
+        const char *t;
+        while (s < end && isspace((unsigned char) *s))
+            s++;
+        if (s == end)
+            return(0);
+        t = s;
+        while (s < end && !isspace((unsigned char) *s))
+            s++;
+        while (k < p && col[order[k]] == c) {
+            char *stop;
+            double x = strtod(t, &stop);
+            if (stop != s || !isfinite(x))
+                return(0);
+            v[order[k++]] = x;
+        }
+    }
+    return(k == p);
+}
+
+
+static const int *sort_col;
+
+static int compare_col(const void *a, const void *b)
+{
+    return(sort_col[*(const int *) a] - sort_col[*(const int *) b]);
+}
+
+
+static void print_label(const char *what, int k)
+{
+    char label[64];
+    snprintf(label, sizeof(label), "%s (column %d):", what, k + 1);
+    printf("%-21s", label);
+}
+
+
+int main (int argc, char **argv)
+{
+    struct reader r;
+    const char *line[BATCH];
+    size_t len[BATCH];
+    char **keyword = NULL;
+    int *number = NULL;
+    int nheader = 0, hsize = 0;
+    char **colnames;
+    int *col, *order;
+    int p, maxcol = -1;
+    int resolved = 0;
+    long nskip = 0;
+    struct moments total, chunk[BATCH/CHUNK];
+    double *x;
+    int n, c;
+
+    while ((c = getopt (argc, argv, "h")) != -1)
+        switch (c)
+        {
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'c')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    p = argc - optind;
+    if (p < 2)
+    {
+        print_help();
+        return(1);
+    }
+    colnames = argv + optind;
+    col = (int *) malloc(p*sizeof(int));
+    order = (int *) malloc(p*sizeof(int));
+    x = (double *) malloc(BATCH*p*sizeof(double));
+    moments_alloc(&total, p);
+    for (int k = 0; k < BATCH/CHUNK; k++)
+        moments_alloc(&chunk[k], p);
+
+    reader_init(&r, stdin);
+    while ((n = reader_lines(&r, line, len, BATCH)) > 0) {
+        int first = 0, nchunk;
+
+        /* Header lines can only come before the first data row */
+        if (!resolved) {
+            for (; first < n; first++) {
+                char name[1024];
+                size_t at;
+                if (line[first][0] != '#')
+                    break;
+                if (len[first] > 1 && line[first][1] == '!')
+                    continue;
+                if (nheader == hsize) {
+                    hsize = hsize ? 2*hsize : 64;
+                    keyword = (char **) realloc(keyword, hsize*sizeof(char *));
+                    number = (int *) realloc(number, hsize*sizeof(int));
+                }
+                if (!header_column(line[first], len[first], &number[nheader], name, sizeof(name), &at)
+                    || number[nheader] < 1)
+                    continue;
+                keyword[nheader++] = strdup(name);
+            }
+            if (first == n)
+                continue;
+            for (int k = 0; k < p; k++) {
+                int j;
+                for (j = 0; j < nheader && strcmp(keyword[j], colnames[k]); j++)
+                    ;
+                if (j == nheader) {
+                    fprintf(stderr,"Keyword %s not found.\n",colnames[k]);
+                    exit(1);
+                }
+                col[k] = number[j] - 1;
+                if (col[k] > maxcol)
+                    maxcol = col[k];
+                order[k] = k;
+            }
+            sort_col = col;
+            qsort(order, p, sizeof(int), compare_col);
+            resolved = 1;
+        }
+
+        /* Moments of each chunk of the block, then merged pairwise */
+        nchunk = (n - first + CHUNK - 1)/CHUNK;
+        #pragma omp parallel for schedule(static) reduction(+:nskip)
+        for (int k = 0; k < nchunk; k++) {
+            int i0 = first + k*CHUNK, i1 = i0 + CHUNK < n ? i0 + CHUNK : n, m = 0;
+            double *xk = x + (long) k*CHUNK*p;
+            for (int i = i0; i < i1; i++) {
+                if (line[i][0] == '#')
+                    continue;
+                if (parse_row(line[i], len[i], col, order, p, maxcol, xk + m*p))
+                    m++;
+                else
+                    nskip++;
+            }
+            moments_rows(&chunk[k], xk, m, p);
+        }
+        for (int step = 1; step < nchunk; step *= 2) {
+            #pragma omp parallel for schedule(static)
+            for (int k = 0; k < nchunk - step; k += 2*step)
+                moments_merge(&chunk[k], &chunk[k + step], p);
+        }
+        if (nchunk > 0)
+            moments_merge(&total, &chunk[0], p);
+    }
+    reader_free(&r);
+
+    if (total.n < 2) {
+        fprintf(stderr,"Too few rows with numbers in all the columns.\n");
+        return(1);
+    }
+
+    {
+        gsl_matrix *cov = gsl_matrix_alloc(p, p);
+        gsl_matrix *A = gsl_matrix_alloc(p, p);
+        gsl_matrix *evec = gsl_matrix_alloc(p, p);
+        gsl_vector *eval = gsl_vector_alloc(p);
+        gsl_eigen_symmv_workspace *work = gsl_eigen_symmv_alloc(p);
+        double trace = 0.0, det = 1.0;
+
+        for (int j = 0; j < p; j++)
+            for (int k = j; k < p; k++) {
+                gsl_matrix_set(cov, j, k, total.m2[j*p + k]/total.n);
+                gsl_matrix_set(cov, k, j, total.m2[j*p + k]/total.n);
+            }
+        gsl_matrix_memcpy(A, cov);
+        gsl_eigen_symmv(A, eval, evec, work);
+        gsl_eigen_symmv_sort(eval, evec, GSL_EIGEN_SORT_VAL_DESC);
+        for (int j = 0; j < p; j++) {
+            int big = 0;
+            trace += gsl_matrix_get(cov, j, j);
+            det *= gsl_vector_get(eval, j);
+            for (int k = 1; k < p; k++)
+                if (fabs(gsl_matrix_get(evec, k, j)) > fabs(gsl_matrix_get(evec, big, j)))
+                    big = k;
+            if (gsl_matrix_get(evec, big, j) < 0)
+                for (int k = 0; k < p; k++)
+                    gsl_matrix_set(evec, k, j, -gsl_matrix_get(evec, k, j));
+        }
+
+        printf("- Moments -\n");
+        printf("%-21s%.0f\n","Rows:",total.n);
+        if (nskip)
+            printf("%-21s%ld\n","Rows skipped:",nskip);
+        printf("\n");
+        for (int j = 0; j < p; j++) {
+            printf("%-21s%s\n","Column:",colnames[j]);
+            print_label("Mean", j);
+            printf("%f\n",total.mean[j]);
+            print_label("Variance", j);
+            printf("%f\n",gsl_matrix_get(cov, j, j));
+            printf("\n");
+        }
+        if (p == 2) {
+            double c01 = gsl_matrix_get(cov, 0, 1);
+            printf("%-21s%f\n","Correlation:",
+                   c01/sqrt(gsl_matrix_get(cov, 0, 0)*gsl_matrix_get(cov, 1, 1)));
+            printf("%-21s%f\n","Covariance:",c01);
+            printf("\n");
+        }
+        printf("- Covariance matrix -\n");
+        for (int j = 0; j < p; j++) {
+            printf("[");
+            for (int k = 0; k < p; k++)
+                printf(k ? "     %f" : " %f", gsl_matrix_get(cov, j, k));
+            printf(" ]\n");
+        }
+        printf("\n");
+        printf("- Correlation matrix -\n");
+        for (int j = 0; j < p; j++) {
+            printf("[");
+            for (int k = 0; k < p; k++)
+                printf(k ? "     %f" : " %f", gsl_matrix_get(cov, j, k)
+                       /sqrt(gsl_matrix_get(cov, j, j)*gsl_matrix_get(cov, k, k)));
+            printf(" ]\n");
+        }
+        printf("\n");
+        printf("%-17s%f\n","Trace:",trace);
+        printf("%-17s%f\n","Determinant:",det);
+        for (int j = 0; j < p; j++) {
+            char label[64];
+            snprintf(label, sizeof(label), "Eigenvalue%d:", j + 1);
+            printf("%-17s%f\n",label,gsl_vector_get(eval, j));
+        }
+        for (int j = 0; j < p; j++) {
+            char label[64];
+            snprintf(label, sizeof(label), "Eigenvector%d:", j + 1);
+            printf("%-17s[",label);
+            for (int k = 0; k < p; k++)
+                printf(" %f", gsl_matrix_get(evec, k, j));
+            printf(" ]\n");
+        }
+        printf("\n");
+        printf("- Ellipse parameters -\n");
+        for (int j = 0; j < p; j++) {
+            char label[64];
+            double l = gsl_vector_get(eval, j);
+            snprintf(label, sizeof(label), "Axis%d:", j + 1);
+            printf("%-17s%f\n",label,sqrt(l > 0 ? l : 0));
+        }
+        if (p == 2)
+            printf("%-17s%f\n","Angle:",
+                   atan2(gsl_matrix_get(evec, 1, 0), gsl_matrix_get(evec, 0, 0))*180.0/M_PI);
+
+        gsl_eigen_symmv_free(work);
+        gsl_matrix_free(cov);
+        gsl_matrix_free(A);
+        gsl_matrix_free(evec);
+        gsl_vector_free(eval);
+    }
+
+    moments_free(&total);
+    for (int k = 0; k < BATCH/CHUNK; k++)
+        moments_free(&chunk[k]);
+    return 0;
+}
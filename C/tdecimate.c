@@ -0,0 +1,720 @@
+// Thin a table down to the points that can be seen on a plot, in one
+// streaming pass. Perl/tplot.pl pipes large tables through this so that it
+// only hands PGPLOT about as many points as the plot has pixels.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <ctype.h>
+#include "table.h"
+
+#define BATCH 1024
+#define TEXT 96         /* room for the fields of a row that is kept */
+#define START 4096      /* rows read before the axis ranges are chosen */
+
+char   *help[] = {
+"",
+"NAME",
+"    tdecimate - thin a table down to the points visible on a plot",
+"",
+"SYNOPSIS",
+"    % tdecimate [OPTIONS] xcolname ycolname [sigmacolname] < table.txt ",
+"",
+"OPTIONS",
+"    -m method     minmax, lttb or grid [default minmax]",
+"    -W pixels     Width of the plot in pixels [default 1024]",
+"    -H pixels     Height of the plot in pixels (grid) [default 1024]",
+"    -x xmin,xmax  X range of the plot",
+"    -y ymin,ymax  Y range of the plot (grid)",
+"    -l            The X axis is logarithmic",
+"    -L            The Y axis is logarithmic",
+"    -h            Print help",
+"",
+"DESCRIPTION",
+"",
+"    This program reads a SExtractor ASCII table provided via standard",
+"    input and writes a table holding the named columns of only those",
+"    rows needed to draw the plot of ycolname against xcolname so that it",
+"    looks the same as a plot of every row. The output is typically a few",
+"    thousand rows however long the input is. Perl/tplot.pl uses it",
+"    automatically when it is on the path.",
+"",
+"        extract foo.fits | tdecimate -m grid X_IMAGE Y_IMAGE | tplot X_IMAGE Y_IMAGE",
+"",
+"    The X axis is cut into one bin per pixel column, and the methods are",
+"",
+"        minmax  For each pixel column, the points with the least and",
+"                greatest X and Y. A line through these draws the same",
+"                pixels as one through all the points (the M4 method of",
+"                Jugel et al. 2014), so this suits joined, pulse and",
+"                histogram plots.",
+"",
+"        lttb    One point per pixel column, chosen by the Largest",
+"                Triangle Three Buckets rule (Steinarsson 2013) from the",
+"                four extreme points of the column. Fewer points than",
+"                minmax, for smooth curves.",
+"",
+"        grid    The first point falling in each pixel of the plot. This",
+"                suits scatter plots, where only the pixels that are",
+"                marked matter.",
+"",
+"    Rows are written in order of X for minmax and lttb, and in their",
+"    original order for grid. The named columns are written with their",
+"    header lines and a #! line naming the method.",
+"    Rows where a column is missing or is not a number are dropped. An X",
+"    column holding ISO dates (2013-05-21T03:14:15) is binned by time.",
+"",
+"    If the range of an axis is not given it is found as the table is",
+"    read: it is set from the first rows, with a margin, and doubled to",
+"    take in any row that falls outside it, merging pairs of bins and",
+"    leaving room on that side. The range ends up between one and about",
+"    three times the span of the data, so such an axis is binned twice",
+"    as finely as the plot, with bins from half a pixel to one and a half",
+"    pixels wide; grid may then miss a few percent of the pixels a",
+"    scatter plot marks. With a range given each pixel gets one bin, and",
+"    rows outside the range are dropped, except that minmax and lttb keep",
+"    the nearest row on each side of the X range, so that a joined line",
+"    still runs to the edges of the plot. The axes are binned in log10",
+"    with -l and -L, where rows that are not positive are dropped.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+enum {MINMAX, LTTB, GRID};
+
+static const char *method_name[] = {"minmax", "lttb", "grid"};
+
+/* A row that may be written, with its position on the (log) axes */
+struct point {
+    double x, y;
+    long row;
+    char text[TEXT];
+};
+
+/* The bins of one axis: n bins covering [lo, lo + width), and the range
+ * of the values binned so far */
+struct axis {
+    double lo, width;
+    int n;
+    int fixed;
+    int log;
+    double dmin, dmax;
+};
+
+/* What is kept of a pixel column for minmax and lttb: the points of
+ * least and greatest X and Y, and the sums that give its centroid */
+struct bucket {
+    long count;
+    double sx, sy;
+    struct point xlo, xhi, ylo, yhi;
+};
+
+/* An occupied pixel of the grid */
+struct cell {
+    long key;
+    struct point p;
+};
+
+struct grid {
+    struct cell *cell;
+    long size, used;
+};
+
+
+/* Bin of v, or -1 if v is outside the axis */
+static long axis_bin(const struct axis *a, double v)
+{
+    double f = (v - a->lo)/a->width;
+    long k;
+
+    if (!(f >= 0.0 && f < 1.0))
+        return(-1);
+    k = (long) (f*a->n);
+    return(k < a->n ? k : a->n - 1);
+}
+
+
+/* Double the range of a to take in v and the values binned so far,
+ * leaving as much room as it can on the side of v, where later values are
+ * likely to fall (a time series grows to the right). Old bin k becomes bin
+ * (k + shift)/2, and shift is returned. */
+static long axis_grow(struct axis *a, double v)
+{
+    double bin = a->width/a->n;
+    double lo = v < a->dmin ? v : a->dmin, hi = v > a->dmax ? v : a->dmax;
+    double smin = ceil((a->lo - lo)/bin), smax = floor((a->lo + 2*a->width - hi)/bin);
+    long shift;
+
+    if (smin < 0)
+        smin = 0;
+    if (smax > a->n)
+        smax = a->n;
+    if (smin <= smax)
+        shift = (long) (v < a->lo ? smax : smin);
+    else
+        shift = v < a->lo ? a->n : 0;
+    a->lo -= shift*bin;
+    a->width *= 2;
+    return(shift);
+}
+
+
+/* Set the range of an axis that was not given from the first values,
+ * with a margin for the later ones of a quarter of their span each side */
+static void axis_start(struct axis *a, const double *v, long n, size_t stride)
+{
+    double lo = INFINITY, hi = -INFINITY;
+
+    if (a->fixed)
+        return;
+    for (long i = 0; i < n; i++) {
+        double t = *(const double *) ((const char *) v + i*stride);
+        if (t < lo) lo = t;
+        if (t > hi) hi = t;
+    }
+    a->dmin = lo;
+    a->dmax = hi;
+    a->width = hi - lo;
+    if (!(a->width > 0))
+        a->width = lo != 0 ? fabs(lo)*1e-6 : 1e-6;
+    a->lo = lo - 0.25*a->width;
+    a->width *= 1.5;
+    while (!(a->lo + a->width > hi))
+        a->width *= 2;
+}
+
+
+static void bucket_add(struct bucket *b, const struct point *p)
+{
+    if (b->count == 0) {
+        b->xlo = b->xhi = b->ylo = b->yhi = *p;
+        b->sx = p->x;
+        b->sy = p->y;
+        b->count = 1;
+        return;
+    }
+    if (p->x < b->xlo.x) b->xlo = *p;
+    if (p->x > b->xhi.x) b->xhi = *p;
+    if (p->y < b->ylo.y) b->ylo = *p;
+    if (p->y > b->yhi.y) b->yhi = *p;
+    b->sx += p->x;
+    b->sy += p->y;
+    b->count++;
+}
+
+
+static void bucket_merge(struct bucket *a, const struct bucket *b)
+{
+    if (b->count == 0)
+        return;
+    if (a->count == 0) {
+        *a = *b;
+        return;
+    }
+    if (b->xlo.x < a->xlo.x || (b->xlo.x == a->xlo.x && b->xlo.row < a->xlo.row)) a->xlo = b->xlo;
+    if (b->xhi.x > a->xhi.x || (b->xhi.x == a->xhi.x && b->xhi.row < a->xhi.row)) a->xhi = b->xhi;
+    if (b->ylo.y < a->ylo.y || (b->ylo.y == a->ylo.y && b->ylo.row < a->ylo.row)) a->ylo = b->ylo;
+    if (b->yhi.y > a->yhi.y || (b->yhi.y == a->yhi.y && b->yhi.row < a->yhi.row)) a->yhi = b->yhi;
+    a->sx += b->sx;
+    a->sy += b->sy;
+    a->count += b->count;
+}
+
+
+/* Keep p in the cell with the given key, unless an earlier row is there */
+static void grid_put(struct grid *g, long key, const struct point *p)
+{
+    unsigned long h;
+
+    if (2*(g->used + 1) > g->size) {
+        struct grid bigger;
+        bigger.size = g->size ? 2*g->size : 4096;
+        bigger.used = 0;
+        bigger.cell = (struct cell *) malloc(bigger.size*sizeof(struct cell));
+        for (long i = 0; i < bigger.size; i++)
+            bigger.cell[i].key = -1;
+        for (long i = 0; i < g->size; i++)
+            if (g->cell[i].key >= 0)
+                grid_put(&bigger, g->cell[i].key, &g->cell[i].p);
+        free(g->cell);
+        *g = bigger;
+    }
+    h = ((unsigned long) key*0x9e3779b97f4a7c15UL) & (g->size - 1);
+    while (g->cell[h].key >= 0 && g->cell[h].key != key)
+        h = (h + 1) & (g->size - 1);
+    if (g->cell[h].key < 0) {
+        g->cell[h].key = key;
+        g->cell[h].p = *p;
+        g->used++;
+    }
+    else if (p->row < g->cell[h].p.row)
+        g->cell[h].p = *p;
+}
+
+
+/* Regroup the cells after axis a (0 for X, 1 for Y) has doubled, so that
+ * its old cell k becomes cell (k + shift)/2; the other axis is unchanged */
+static void grid_regroup(struct grid *g, long nx, int a, long shift)
+{
+    long xshift = a == 0 ? shift : 0, yshift = a == 1 ? shift : 0;
+    long xdiv = a == 0 ? 2 : 1, ydiv = a == 1 ? 2 : 1;
+
+    struct grid old = *g;
+
+    g->size = g->used = 0;
+    g->cell = NULL;
+    for (long i = 0; i < old.size; i++)
+        if (old.cell[i].key >= 0) {
+            long ix = old.cell[i].key % nx, iy = old.cell[i].key / nx;
+            grid_put(g, ((iy + yshift)/ydiv)*nx + (ix + xshift)/xdiv, &old.cell[i].p);
+        }
+    free(old.cell);
+}
+
+
+/* Regroup the buckets after the X axis has doubled */
+static void bucket_regroup(struct bucket *bucket, long n, long shift)
+{
+    struct bucket *old = (struct bucket *) malloc(n*sizeof(struct bucket));
+
+    memcpy(old, bucket, n*sizeof(struct bucket));
+    memset(bucket, 0, n*sizeof(struct bucket));
+    for (long k = 0; k < n; k++)
+        bucket_merge(&bucket[(k + shift)/2], &old[k]);
+    free(old);
+}
+
+
+struct decimate {
+    int method;
+    struct axis ax, ay;
+    struct bucket *bucket;
+    struct grid g;
+    struct point left, right;   /* nearest rows outside a given X range */
+    int nleft, nright;
+};
+
+
+/* Bin a point, growing the axes to take it if their ranges were not given */
+static void decimate_add(struct decimate *d, const struct point *p)
+{
+    long kx, ky;
+
+    while ((kx = axis_bin(&d->ax, p->x)) < 0) {
+        long shift;
+        if (d->ax.fixed) {
+            /* A joined line leaves the plot towards the nearest rows
+             * outside it, so minmax and lttb keep those */
+            if (d->method == GRID)
+                return;
+            if (p->x < d->ax.lo) {
+                if (!d->nleft || p->x > d->left.x)
+                    d->left = *p;
+                d->nleft = 1;
+            }
+            else if (!d->nright || p->x < d->right.x) {
+                d->right = *p;
+                d->nright = 1;
+            }
+            return;
+        }
+        shift = axis_grow(&d->ax, p->x);
+        if (d->method == GRID)
+            grid_regroup(&d->g, d->ax.n, 0, shift);
+        else
+            bucket_regroup(d->bucket, d->ax.n, shift);
+    }
+    if (d->method != GRID)
+        bucket_add(&d->bucket[kx], p);
+    else {
+        while ((ky = axis_bin(&d->ay, p->y)) < 0) {
+            if (d->ay.fixed)
+                return;
+            grid_regroup(&d->g, d->ax.n, 1, axis_grow(&d->ay, p->y));
+        }
+        grid_put(&d->g, ky*d->ax.n + kx, p);
+        d->ay.dmin = fmin(d->ay.dmin, p->y);
+        d->ay.dmax = fmax(d->ay.dmax, p->y);
+    }
+    d->ax.dmin = fmin(d->ax.dmin, p->x);
+    d->ax.dmax = fmax(d->ax.dmax, p->x);
+}
+
+
+static int compare_x(const void *a, const void *b)
+{
+    const struct point *pa = *(const struct point **) a, *pb = *(const struct point **) b;
+    if (pa->x != pb->x)
+        return(pa->x < pb->x ? -1 : 1);
+    return((pa->row > pb->row) - (pa->row < pb->row));
+}
+
+
+static int compare_row(const void *a, const void *b)
+{
+    const struct point *pa = *(const struct point **) a, *pb = *(const struct point **) b;
+    return((pa->row > pb->row) - (pa->row < pb->row));
+}
+
+
+/* Read a number, or an ISO date and time as seconds */
+static int parse_value(const char *s, int len, int date, double *v)
+{
+    char buf[64], *stop;
+    int year, month, day, hour = 0, minute = 0, used = 0;
+    double second = 0.0;
+
+    if (len <= 0 || len >= (int) sizeof(buf))
+        return(0);
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    *v = strtod(buf, &stop);
+    if (*stop == '\0')
+        return(isfinite(*v));
+    if (date && sscanf(buf, "%d-%d-%d%n", &year, &month, &day, &used) == 3) {
+        struct tm t;
+        if (buf[used] == 'T' || buf[used] == ' ')
+            sscanf(buf + used + 1, "%d:%d:%lf", &hour, &minute, &second);
+        memset(&t, 0, sizeof(t));
+        t.tm_year = year - 1900;
+        t.tm_mon = month - 1;
+        t.tm_mday = day;
+        t.tm_hour = hour;
+        t.tm_min = minute;
+        *v = (double) timegm(&t) + second;
+        return(1);
+    }
+    return(0);
+}
+
+
+int main (int argc, char **argv)
+{
+    struct reader r;
+    const char *line[BATCH];
+    size_t len[BATCH];
+    char **keyword = NULL, **header = NULL;
+    size_t *rest = NULL;
+    int *number = NULL;
+    int nheader = 0, hsize = 0;
+    char **colnames;
+    int col[3], desc[3];
+    int ncols, maxcol = -1;
+    int resolved = 0;
+    struct decimate d = {MINMAX, {0.0, 1.0, 1024, 0, 0, 0.0, 0.0}, {0.0, 1.0, 1024, 0, 0, 0.0, 0.0}, NULL, {NULL, 0, 0},
+                         {0.0, 0.0, 0, ""}, {0.0, 0.0, 0, ""}, 0, 0};
+    struct axis *ax = &d.ax, *ay = &d.ay;
+    struct point *start = (struct point *) malloc(START*sizeof(struct point));
+    long nstart = 0, row = 0, nkept = 0;
+    struct point **out;
+    int started = 0;
+    const char **tok = NULL;
+    int *toklen = NULL;
+    int n, c;
+
+    while ((c = getopt (argc, argv, "m:W:H:x:y:lLh")) != -1)
+        switch (c)
+        {
+            case 'm':
+                if (!strcmp(optarg, "minmax"))
+                    d.method = MINMAX;
+                else if (!strcmp(optarg, "lttb"))
+                    d.method = LTTB;
+                else if (!strcmp(optarg, "grid"))
+                    d.method = GRID;
+                else {
+                    fprintf(stderr,"Unknown method %s.\n",optarg);
+                    return(1);
+                }
+                break;
+            case 'W':
+                ax->n = atoi(optarg);
+                break;
+            case 'H':
+                ay->n = atoi(optarg);
+                break;
+            case 'x':
+                if (sscanf(optarg, "%lf,%lf", &ax->lo, &ax->width) != 2) {
+                    fprintf(stderr,"X range must be given as xmin,xmax.\n");
+                    return(1);
+                }
+                ax->fixed = 1;
+                break;
+            case 'y':
+                if (sscanf(optarg, "%lf,%lf", &ay->lo, &ay->width) != 2) {
+                    fprintf(stderr,"Y range must be given as ymin,ymax.\n");
+                    return(1);
+                }
+                ay->fixed = 1;
+                break;
+            case 'l':
+                ax->log = 1;
+                break;
+            case 'L':
+                ay->log = 1;
+                break;
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'm' || optopt == 'W' || optopt == 'H' || optopt == 'x' || optopt == 'y')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    ncols = argc - optind;
+    if (ncols < 2 || ncols > 3 || ax->n < 1 || ay->n < 1)
+    {
+        print_help();
+        return(1);
+    }
+    colnames = argv + optind;
+
+    /* Ranges are given as the plot shows them, and binned on the same
+     * scale as the values */
+    if (ax->fixed) {
+        double lo = ax->lo, hi = ax->width;
+        if (ax->log && !(lo > 0 && hi > 0)) {
+            fprintf(stderr,"A logarithmic range must be positive.\n");
+            return(1);
+        }
+        ax->lo = ax->log ? log10(fmin(lo, hi)) : fmin(lo, hi);
+        ax->width = (ax->log ? log10(fmax(lo, hi)) : fmax(lo, hi)) - ax->lo;
+    }
+    if (ay->fixed) {
+        double lo = ay->lo, hi = ay->width;
+        if (ay->log && !(lo > 0 && hi > 0)) {
+            fprintf(stderr,"A logarithmic range must be positive.\n");
+            return(1);
+        }
+        ay->lo = ay->log ? log10(fmin(lo, hi)) : fmin(lo, hi);
+        ay->width = (ay->log ? log10(fmax(lo, hi)) : fmax(lo, hi)) - ay->lo;
+    }
+    if ((ax->fixed && !(ax->width > 0)) || (ay->fixed && !(ay->width > 0))) {
+        fprintf(stderr,"An axis range must not be empty.\n");
+        return(1);
+    }
+    if (!ax->fixed)
+        ax->n *= 2;
+    if (d.method == GRID && !ay->fixed)
+        ay->n *= 2;
+    if (d.method != GRID)
+        d.bucket = (struct bucket *) calloc(ax->n, sizeof(struct bucket));
+
+    reader_init(&r, stdin);
+    while ((n = reader_lines(&r, line, len, BATCH)) > 0) {
+        for (int i = 0; i < n; i++) {
+            const char *s = line[i], *end = line[i] + len[i];
+            struct point p;
+            size_t used = 0;
+            int ok = 1;
+
+            if (s[0] == '#') {
+                char name[1024];
+                size_t at;
+                if (resolved || (len[i] > 1 && s[1] == '!'))
+                    continue;
+                if (nheader == hsize) {
+                    hsize = hsize ? 2*hsize : 64;
+                    keyword = (char **) realloc(keyword, hsize*sizeof(char *));
+                    header = (char **) realloc(header, hsize*sizeof(char *));
+                    rest = (size_t *) realloc(rest, hsize*sizeof(size_t));
+                    number = (int *) realloc(number, hsize*sizeof(int));
+                }
+                if (!header_column(s, len[i], &number[nheader], name, sizeof(name), &at)
+                    || number[nheader] < 1)
+                    continue;
+                keyword[nheader] = strdup(name);
+                header[nheader] = strndup(s, len[i]);
+                rest[nheader++] = at;
+                continue;
+            }
+
+            // The header is complete at the first data row
+            if (!resolved) {
+                for (int k = 0; k < ncols; k++) {
+                    desc[k] = -1;
+                    for (int j = 0; j < nheader && desc[k] < 0; j++)
+                        if (!strcmp(keyword[j], colnames[k]))
+                            desc[k] = j;
+                    if (desc[k] < 0) {
+                        fprintf(stderr,"Keyword %s not found.\n",colnames[k]);
+                        exit(1);
+                    }
+                    col[k] = number[desc[k]] - 1;
+                    if (col[k] > maxcol)
+                        maxcol = col[k];
+                }
+                for (int k = 0; k < ncols; k++) {
+                    const char *h = header[desc[k]];
+                    printf("#%4d%s", k + 1, h + rest[desc[k]]);
+                    if (h[strlen(h) - 1] != '\n')
+                        putchar('\n');
+                }
+                printf("#! tdecimate_method: %s\n", method_name[d.method]);
+                tok = (const char **) malloc((maxcol + 1)*sizeof(char *));
+                toklen = (int *) malloc((maxcol + 1)*sizeof(int));
+                resolved = 1;
+            }
+
+            for (int k = 0; k <= maxcol; k++) {
+                while (s < end && isspace((unsigned char) *s))
+                    s++;
+                tok[k] = s;
+                while (s < end && !isspace((unsigned char) *s))
+                    s++;
+                toklen[k] = (int) (s - tok[k]);
+            }
+            if (toklen[0] == 0)
+                continue;
+            row++;
+
+            // Keep the fields as they are, and the values on the plot axes
+            for (int k = 0; k < ncols; k++) {
+                double v;
+                int l = toklen[col[k]];
+                if (!parse_value(tok[col[k]], l, k == 0, &v) || used + l + 1 >= TEXT) {
+                    ok = 0;
+                    break;
+                }
+                if (k < 2 && (k == 0 ? ax->log : ay->log)) {
+                    if (!(v > 0)) {
+                        ok = 0;
+                        break;
+                    }
+                    v = log10(v);
+                }
+                if (k == 0)
+                    p.x = v;
+                else if (k == 1)
+                    p.y = v;
+                if (k > 0)
+                    p.text[used++] = ' ';
+                memcpy(p.text + used, tok[col[k]], l);
+                used += l;
+            }
+            if (!ok)
+                continue;
+            p.text[used] = '\0';
+            p.row = row;
+
+            // Hold the first rows until the ranges can be set from them
+            if (started)
+                decimate_add(&d, &p);
+            else {
+                start[nstart++] = p;
+                if (nstart == START) {
+                    axis_start(ax, &start[0].x, nstart, sizeof(struct point));
+                    axis_start(ay, &start[0].y, nstart, sizeof(struct point));
+                    for (long j = 0; j < nstart; j++)
+                        decimate_add(&d, &start[j]);
+                    started = 1;
+                }
+            }
+        }
+    }
+    reader_free(&r);
+    if (!started && nstart > 0) {
+        axis_start(ax, &start[0].x, nstart, sizeof(struct point));
+        axis_start(ay, &start[0].y, nstart, sizeof(struct point));
+        for (long j = 0; j < nstart; j++)
+            decimate_add(&d, &start[j]);
+    }
+    free(start);
+
+    if (d.method == GRID) {
+        out = (struct point **) malloc((d.g.used + 1)*sizeof(struct point *));
+        for (long i = 0; i < d.g.size; i++)
+            if (d.g.cell[i].key >= 0)
+                out[nkept++] = &d.g.cell[i].p;
+        qsort(out, nkept, sizeof(struct point *), compare_row);
+    }
+    else if (d.method == MINMAX) {
+        out = (struct point **) malloc((4*ax->n + 2)*sizeof(struct point *));
+        if (d.nleft)
+            out[nkept++] = &d.left;
+        for (long k = 0; k < ax->n; k++) {
+            struct bucket *b = &d.bucket[k];
+            struct point *q[4] = {&b->xlo, &b->ylo, &b->yhi, &b->xhi};
+            long from = nkept;
+            if (b->count == 0)
+                continue;
+            for (int j = 0; j < 4; j++) {
+                int dup = 0;
+                for (long m = from; m < nkept; m++)
+                    dup |= out[m]->row == q[j]->row;
+                if (!dup)
+                    out[nkept++] = q[j];
+            }
+            qsort(out + from, nkept - from, sizeof(struct point *), compare_x);
+        }
+        if (d.nright)
+            out[nkept++] = &d.right;
+    }
+    else {
+        /* Largest triangle three buckets: from each column, the extreme
+         * point making the largest triangle with the point chosen from the
+         * column before and the centroid of the column after */
+        long *full = (long *) malloc(ax->n*sizeof(long)), nfull = 0;
+        out = (struct point **) malloc((ax->n + 3)*sizeof(struct point *));
+        for (long k = 0; k < ax->n; k++)
+            if (d.bucket[k].count)
+                full[nfull++] = k;
+        if (d.nleft)
+            out[nkept++] = &d.left;
+        for (long j = 0; j < nfull; j++) {
+            struct bucket *b = &d.bucket[full[j]];
+            struct point *q[4] = {&b->xlo, &b->ylo, &b->yhi, &b->xhi}, *best = q[0];
+            if (j == 0 || j == nfull - 1) {
+                out[nkept++] = j == 0 ? &b->xlo : &b->xhi;
+                if (nfull == 1 && b->xhi.row != b->xlo.row)
+                    out[nkept++] = &b->xhi;
+                continue;
+            }
+            {
+                const struct point *a = out[nkept - 1];
+                const struct bucket *next = &d.bucket[full[j + 1]];
+                double cx = next->sx/next->count, cy = next->sy/next->count, area = -1.0;
+                for (int m = 0; m < 4; m++) {
+                    double t = fabs((a->x - cx)*(q[m]->y - a->y) - (a->x - q[m]->x)*(cy - a->y));
+                    if (t > area) {
+                        area = t;
+                        best = q[m];
+                    }
+                }
+            }
+            out[nkept++] = best;
+        }
+        if (d.nright)
+            out[nkept++] = &d.right;
+        free(full);
+    }
+    for (long j = 0; j < nkept; j++)
+        printf("%s\n", out[j]->text);
+
+    return(0);
+}
@@ -0,0 +1,167 @@
+// Select the rows of a table for which an expression is true. A native
+// replacement for Perl/tfilter.pl: the expression is compiled once and
+// evaluated on batches of rows (see expr.c), and matching rows are
+// passed through byte for byte.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include "table.h"
+#include "expr.h"
+
+char   *help[] = {
+"",
+"NAME",
+"    tfilter - select the rows of a table that satisfy a condition",
+"",
+"SYNOPSIS",
+"    % tfilter [OPTIONS] \"expression\" < table.txt ",
+"",
+"OPTIONS",
+"    -h       Print help",
+"",
+"DESCRIPTION",
+"",
+"    This program copies the rows of a SExtractor ASCII table provided",
+"    via standard input for which the expression is true, e.g.",
+"",
+"        tfilter \"MAG_AUTO<17 && FLAGS!=0\" < foo.txt",
+"        tfilter \"IMAGE_TYPE eq light\" < foo.txt",
+"",
+"    The expression uses Perl syntax, as the original tfilter did: the",
+"    arithmetic operators + - * / % **, the numeric comparisons < <= >",
+"    >= == !=, the string comparisons lt le gt ge eq ne, the logical",
+"    operators && || ! (and their low precedence forms and, or, not),",
+"    parentheses, numbers, quoted strings and the functions abs, sqrt,",
+"    log, log10, exp, int, floor, ceil, sin, cos, tan, asin, acos, atan,",
+"    sinh, cosh, tanh, atan2, pow and fmod. Column names stand for the",
+"    values in those columns; any other word is a string.",
+"    An expression that starts with a minus sign must follow \"--\".",
+"",
+"    The header is copied unchanged, and two comment lines recording the",
+"    expression and its form with the columns numbered are added before",
+"    the first row. The rows are copied exactly as they were read. Rows",
+"    for which the expression cannot be evaluated (e.g. because of a",
+"    division by zero) are left out.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+/* Copy the rows of a batch the expression selects */
+static void flush(struct expr *e, struct expr_batch *b, const char **line, size_t *len, int n)
+{
+    int sel[EXPR_BATCH];
+    int m;
+
+    if (n == 0)
+        return;
+    expr_batch_split(b, line, len, n, e->maxcol + 1);
+    m = expr_select(e, b, sel);
+    for (int k = 0; k < m; k++) {
+        fwrite(line[sel[k]], 1, len[sel[k]], stdout);
+        if (line[sel[k]][len[sel[k]] - 1] != '\n')
+            putchar('\n');
+    }
+}
+
+
+int main (int argc, char **argv)
+{
+    struct reader r;
+    struct expr e = {NULL, -1};
+    struct expr_batch b = {0};
+    const char *line[EXPR_BATCH], *data[EXPR_BATCH];
+    size_t len[EXPR_BATCH], dlen[EXPR_BATCH];
+    char keyword[1024], err[1024];
+    char *original, *modified;
+    int colnum = 0;
+    int compiled = 0;
+    int n, nd, c;
+
+    while ((c = getopt (argc, argv, "h")) != -1)
+        switch (c)
+        {
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'c')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    if (argc - optind != 1)
+    {
+        print_help();
+        return(1);
+    }
+    original = argv[optind];
+    modified = strdup(original);
+
+    reader_init(&r, stdin);
+    while ((n = reader_lines(&r, line, len, EXPR_BATCH)) > 0) {
+        nd = 0;
+        for (int i = 0; i < n; i++) {
+            if (line[i][0] == '#') {
+                // HEADER: rows before it are written first
+                flush(&e, &b, data, dlen, nd);
+                nd = 0;
+                fwrite(line[i], 1, len[i], stdout);
+                if (len[i] > 1 && line[i][1] == '!')
+                    continue;
+                if (expr_header_keyword(line[i], len[i], keyword, sizeof(keyword))) {
+                    char *s = expr_substitute(modified, keyword, colnum);
+                    free(modified);
+                    modified = s;
+                }
+                colnum++;
+                continue;
+            }
+
+            // DATA: the expression is fixed by the header above the first row
+            if (!compiled) {
+                printf("#! tfilter_string:%s\n", original);
+                printf("#! tfilter_string_modified:%s\n", modified);
+                if (expr_compile(&e, modified, err, sizeof(err))) {
+                    fflush(stdout);
+                    fprintf(stderr, "Syntax error: %s\n", err);
+                    exit(1);
+                }
+                expr_optimize(&e, 1);
+                compiled = 1;
+            }
+            data[nd] = line[i];
+            dlen[nd++] = len[i];
+        }
+        flush(&e, &b, data, dlen, nd);
+    }
+
+    expr_free(&e);
+    expr_batch_free(&b);
+    reader_free(&r);
+    free(modified);
+    return 0;
+}
@@ -1,32 +1,62 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <unistd.h>
 #include <ctype.h>
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
 #include <gsl/gsl_vector.h>
 #include <gsl/gsl_blas.h>
 #include <gsl/gsl_multifit_nlin.h>
+#include <gsl/gsl_linalg.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
 
-//#include "expfit.h"
-#include "gaussfit.h"
+#include "lm.h"
+#include "models.h"
+#include "resample.h"
 #include "table.h"
 
 #define MAXROW 100000
-void print_state (size_t iter, gsl_multifit_fdfsolver * s);
+#define MAXUNBINNED 10000000   /* bin larger samples rather than fit them unbinned */
+#define NBINS 1000             /* default number of bins for those */
+void print_state (size_t iter, const gsl_vector *x, const gsl_vector *f);
 
 
 char   *help[] = {
 "",
 "NAME",
-"    fithist - fit a gaussian to a histogram",
+"    fithist - fit a model to a histogram",
 "",
 "SYNOPSIS",
 "    % fithist [OPTIONS] xcol ycol < histogram.txt ",
+"    % fithist [OPTIONS] -u xcol < samples.txt ",
+"    % fithist [OPTIONS] -k keycol xcol ycol < histograms.txt ",
+"    % fithist [OPTIONS] xcol ycol histogram1.txt histogram2.txt ... ",
 "",
 "OPTIONS",
+"    -B n     Estimate uncertainties from n bootstrap replicates",
+"    -b nbins Bin the samples read with -u into nbins bins and fit the",
+"             histogram instead",
+"    -c ctol  Stop when an iteration lowers chisq by less than this fraction",
+"             [default: no chisq test]",
+"    -f       Fast mode: return the closed-form gaussian estimate without",
+"             iterating (single gaussian model only)",
+"    -G       Use the built-in Levenberg-Marquardt solver with geodesic",
+"             acceleration rather than GSL's lmsder",
+"    -g gtol  Stop when the scaled gradient of chisq falls below this",
+"             [default: no gradient test]",
+"    -I n     Maximum number of iterations [default 500]",
+"    -k key   Batch mode: fit one histogram for each value in column key",
+"    -M       Make the -B replicates by adding gaussian noise to the counts",
+"             rather than by resampling the bins",
+"    -m model Model to fit [default gaussian]. Components can be summed,",
+"             e.g. -m gaussian+constant or -m gaussian+gaussian",
+"    -q       Quiet mode (print only the best-fit parameters)", 
+"    -S seed  Random number seed for -B [default 1]",
+"    -u       Unbinned mode: fit the distribution of the values in xcol",
 "    -v       Verbose mode", 
+"    -x xtol  Stop when no parameter changes by more than xtol times",
+"             (1 + its size) in an iteration [default 1e-4]",
 "",
 "EXAMPLE",
 "    Generate an image with gaussian noise (mean=100, stddev=50) and then fit",
@@ -36,12 +66,65 @@ char   *help[] = {
 "    % imhist < rand.fits > hist.txt",
 "    % fithist PIXVAL COUNT < hist.txt",
 "",
+"    Fit a gaussian to the histogram of a column of a catalog:",
+"",
+"    % thist MAG_AUTO < cat.txt > hist.txt",
+"    % tfitdist PIXVAL COUNT < hist.txt",
+"",
 "DESCRIPTION",
 "",
-"    This program fits a gaussian to a histogram provided to the program",
-"    via standard input. The histogram must be a SExtractor-format table.",
-"    If the histogram is produced by IMHIST then the xcol and ycol strings",
-"    are PIXVAL and COUNT.",
+"    This program fits a gaussian, or another model chosen with -m, to a",
+"    histogram provided to the program via standard input. The histogram",
+"    must be a SExtractor-format table. If the histogram is produced by",
+"    IMHIST or THIST then the xcol and ycol strings are PIXVAL and COUNT.",
+"    The models available are listed below. Starting guesses for a sum are",
+"    made one component at a time, each from what the previous ones leave",
+"    unexplained, and the parameters of a sum are numbered by component",
+"    (e.g. mu_1, mu_2).",
+"",
+"    A gaussian is started from the closed-form estimate of Caruana: a",
+"    parabola fitted to the log of the counts, weighted for Poisson noise",
+"    (falling back to the weighted moments if the counts are not peaked).",
+"    This is usually within a few percent of the answer, so the fit",
+"    converges in a few iterations; the number taken is reported. With -f",
+"    the closed-form estimate itself is returned, with uncertainties",
+"    propagated from the parabola fit, and no iterations are done.",
+"",
+"    The fit is done by Levenberg-Marquardt, using GSL's lmsder unless -G",
+"    is given. With -G a built-in solver is used instead, which adds",
+"    geodesic acceleration (a correction for the curvature of the model)",
+"    to each step and solves the small normal equations by Cholesky",
+"    factorization. It usually needs fewer iterations, and less work per",
+"    iteration, for small fits like these. The fit stops when any of the",
+"    convergence tests chosen with -x, -g and -c is met, or after the -I",
+"    limit.",
+"",
+"    With -u the input is a column of samples rather than a histogram, and",
+"    the model is fitted to them by unbinned (extended) maximum likelihood.",
+"    Nothing is lost to binning and no histogram needs to be made first.",
+"    The model is then the number of samples per unit x, and it is",
+"    normalized over the range of the samples. The uncertainties come from",
+"    the inverse of the Fisher information. Samples of more than 10000000",
+"    values are binned into 1000 bins and the histogram is fitted instead,",
+"    as are samples of any size when -b or -f is given.",
+"",
+"    Many histograms can be fitted in one run, which is much faster than",
+"    running the program once for each when the histograms are small. They",
+"    are either stacked in one table with a column (given by -k) saying",
+"    which histogram each row belongs to, or given as a list of files. The",
+"    fits are spread over the available threads, each of which reuses one",
+"    solver for all of its fits. The output is a table with one row per",
+"    histogram: the key (or file name), each parameter and its uncertainty,",
+"    chisq/dof, the number of iterations and the GSL status (0 is success).",
+"",
+"    With -B the fit is repeated on n resampled copies of the histogram,",
+"    each started from the best fit, and the central 68% interval of each",
+"    parameter over the copies is reported (in quiet mode, as a second line",
+"    of lower and upper bounds). The copies either draw the bins with",
+"    replacement (a bootstrap) or, with -M, add gaussian noise of the",
+"    uncertainty in each bin. The copies are spread over the available",
+"    threads, and each is made from its own random number stream, so the",
+"    answer depends on the seed but not on the number of threads.",
 "",
 "AUTHOR",
 "    Roberto Abraham (abraham@astro.utoronto.ca)",
@@ -55,18 +138,657 @@ void print_help()
 {
     for (int i = 0; help[i] != 0; i++)
         fprintf(stdout,"%s\n",help[i]);
+    fprintf(stdout,"MODELS\n");
+    model_list(stdout);
+    fprintf(stdout,"\n");
+}
+
+
+void print_state (size_t iter, const gsl_vector *x, const gsl_vector *f)
+{
+    printf ("iter: %3u      parameters =", (unsigned int)iter);
+    for (size_t j = 0; j < x->size; j++)
+        printf (" % 15.8f", gsl_vector_get (x, j));
+    printf (" |f(p)| = %g\n", gsl_blas_dnrm2 (f));
+}
+
+
+/* How the fits are done: which solver to use, and when to stop */
+struct solver {
+    int geodesic;           /* use lm.c with geodesic acceleration */
+    double xtol;            /* step test */
+    double gtol;            /* gradient test, or 0 for none */
+    double ctol;            /* chi-square test, or 0 for none */
+    unsigned int maxiter;
+};
+
+/* A solver and its scratch space. They are kept from one fit to the next,
+ * so a batch of fits allocates them once per thread rather than once per
+ * fit. The solver is sized for a power of two rows and smaller histograms
+ * are padded out with rows of zero weight, which leave the fit unchanged. */
+struct workspace {
+    size_t size;
+    size_t npar;
+    int geodesic;
+    gsl_multifit_fdfsolver *s;
+    struct lm *lm;
+    gsl_matrix *covar;
+    gsl_vector *g;
+    double *x;
+    double *y;
+    double *sigma;
+    struct model_data d;
+};
+
+/* The outcome of a fit */
+struct fit {
+    double par[MAXMODELPAR];
+    double err[MAXMODELPAR];
+    double chisq_dof;
+    unsigned int iter;
+    int status;
+};
+
+void workspace_free(struct workspace *w)
+{
+    if (w->covar == NULL)
+        return;
+    if (w->s)
+        gsl_multifit_fdfsolver_free(w->s);
+    if (w->lm)
+        lm_free(w->lm);
+    gsl_matrix_free(w->covar);
+    gsl_vector_free(w->g);
+    model_data_free(&w->d);
+    free(w->x);
+    free(w->y);
+    free(w->sigma);
+    w->s = NULL;
+    w->lm = NULL;
+    w->covar = NULL;
+}
+
+/* Make sure the workspace can fit n rows with the model and solver.
+ * Returns 0 on success. */
+int workspace_reserve(struct workspace *w, const struct solver *solver, const struct model *model, size_t n)
+{
+    size_t size = 16;
+
+    while (size < n)
+        size *= 2;
+    if (w->covar != NULL && w->size == size && w->npar == model->npar && w->geodesic == solver->geodesic)
+        return(0);
+    workspace_free(w);
+    w->size = size;
+    w->npar = model->npar;
+    w->geodesic = solver->geodesic;
+    w->x = (double *) calloc(size, sizeof(double));
+    w->y = (double *) calloc(size, sizeof(double));
+    w->sigma = (double *) calloc(size, sizeof(double));
+    if (w->x == NULL || w->y == NULL || w->sigma == NULL
+        || model_data_init(&w->d, model, size, w->x, w->y, w->sigma))
+        return(1);
+    if (solver->geodesic)
+        w->lm = lm_alloc(size, model->npar, 1);
+    else
+        w->s = gsl_multifit_fdfsolver_alloc(gsl_multifit_fdfsolver_lmsder, size, model->npar);
+    w->covar = gsl_matrix_alloc(model->npar, model->npar);
+    w->g = gsl_vector_alloc(model->npar);
+    return((w->s == NULL && w->lm == NULL) || w->covar == NULL || w->g == NULL);
 }
 
+/* Convergence tests. The fit has converged when the last step was small,
+ * or (if asked for) the scaled gradient of chi-square is small or the last
+ * step lowered chi-square by only a small fraction. */
+int test_convergence(const struct solver *solver, const gsl_vector *x, const gsl_vector *dx,
+                     const gsl_vector *g, double chisq_old, double chisq)
+{
+    if (gsl_multifit_test_delta (dx, x, solver->xtol, solver->xtol) == GSL_SUCCESS)
+        return(GSL_SUCCESS);
+    if (solver->gtol > 0) {
+        double gmax = 0;
+        for (size_t j = 0; j < x->size; j++)
+            gmax = GSL_MAX_DBL(gmax, fabs(gsl_vector_get(g, j))*GSL_MAX_DBL(fabs(gsl_vector_get(x, j)), 1.0));
+        if (gmax <= solver->gtol*GSL_MAX_DBL(0.5*chisq, 1.0))
+            return(GSL_SUCCESS);
+    }
+    if (solver->ctol > 0 && chisq <= chisq_old && chisq_old - chisq <= solver->ctol*chisq)
+        return(GSL_SUCCESS);
+    return(GSL_CONTINUE);
+}
 
-void print_state (size_t iter, gsl_multifit_fdfsolver *s)
+/* Fit the model to n histogram rows, starting from guess. Returns 0 unless
+ * the workspace could not be allocated. */
+int fit_histogram(struct workspace *w, const struct solver *solver, const struct model *model,
+                  const double *x, const double *y, const double *sigma, size_t n,
+                  const double *guess, int verbose, struct fit *fit)
 {
-    printf ("iter: %3u      parameters = % 15.8f % 15.8f % 15.8f "
-            "|f(p)| = %g\n",
-            (unsigned int)iter,
-            gsl_vector_get (s->x, 0), 
-            gsl_vector_get (s->x, 1),
-            gsl_vector_get (s->x, 2), 
-            gsl_blas_dnrm2 (s->f));
+    const size_t p = model->npar;
+    double par[MAXMODELPAR];
+    gsl_vector_view xx = gsl_vector_view_array (par, p);
+    gsl_multifit_function_fdf f;
+    gsl_vector *pos, *res, *dx, *g;
+    gsl_matrix *J;
+    double chisq, chisq_old;
+    unsigned int iter = 0;
+    int status;
+    size_t i;
+
+    if (workspace_reserve(w, solver, model, n))
+        return(1);
+    for (i = 0; i < w->size; i++) {
+        w->x[i] = x[i < n ? i : 0];
+        w->y[i] = i < n ? y[i] : 0.0;
+        w->sigma[i] = i < n ? sigma[i] : GSL_POSINF;
+        w->d.isigma[i] = i < n ? 1.0/sigma[i] : 0.0;
+    }
+    w->d.model = model;
+    memcpy(par, guess, p*sizeof(double));
+
+    /* Define the model to fit */
+    if (solver->geodesic) {
+        lm_set(w->lm, &model_f, &model_df, &w->d, &xx.vector);
+        pos = w->lm->x;
+        res = w->lm->f;
+        dx = w->lm->dx;
+        g = w->lm->g;
+        J = w->lm->J;
+    }
+    else {
+        f.f = &model_f;
+        f.df = &model_df;
+        f.fdf = &model_fdf;
+        f.n = w->size;
+        f.p = p;
+        f.params = &w->d;
+        gsl_multifit_fdfsolver_set(w->s, &f, &xx.vector);
+        pos = w->s->x;
+        res = w->s->f;
+        dx = w->s->dx;
+        g = w->g;
+        J = w->s->J;
+    }
+    chisq = pow(gsl_blas_dnrm2(res), 2.0);
+
+    if (verbose) print_state (iter, pos, res);
+
+    /* Fit the model to the data */
+    do
+    {
+        iter++;
+        if (solver->geodesic)
+            status = lm_iterate(w->lm);
+        else
+            status = gsl_multifit_fdfsolver_iterate(w->s);
+
+        if (verbose) printf ("status = %s\n", gsl_strerror (status));
+        if (verbose) print_state (iter, pos, res);
+
+        if (status)
+            break;
+
+        chisq_old = chisq;
+        chisq = pow(gsl_blas_dnrm2(res), 2.0);
+        if (!solver->geodesic && solver->gtol > 0)
+            gsl_multifit_gradient(J, res, g);
+        status = test_convergence(solver, pos, dx, g, chisq_old, chisq);
+    }
+    while (status == GSL_CONTINUE && iter < solver->maxiter);
+
+    /* Compute covariance */
+    if (solver->geodesic)
+        lm_covar(w->lm, w->covar);
+    else
+        gsl_multifit_covar (J, 0.0, w->covar);
+
+    { 
+        double chi = gsl_blas_dnrm2(res);
+        double dof = n - p;
+        double c = GSL_MAX_DBL(1, chi / sqrt(dof)); 
+
+        for (i = 0; i < p; i++) {
+            fit->par[i] = gsl_vector_get(pos, i);
+            fit->err[i] = c*sqrt(gsl_matrix_get(w->covar,i,i));
+        }
+        fit->chisq_dof = pow(chi, 2.0) / dof;
+    }
+    fit->iter = iter;
+    fit->status = status;
+    return(0);
+}
+
+
+/* Refit nboot resampled copies of a histogram, starting from the best fit
+ * par, and return the central 68% interval of each parameter in lo and hi.
+ * Returns the number of copies whose fit succeeded. */
+long bootstrap_histogram(const struct solver *solver, struct model *model, const double *x, const double *y, const double *sigma,
+                         size_t n, const double *par, long nboot, unsigned long seed, int montecarlo,
+                         double *lo, double *hi)
+{
+    const size_t p = model->npar;
+    double *rep = (double *) malloc(p*nboot*sizeof(double));
+    long nok = 0;
+
+    gsl_set_error_handler_off();
+    #pragma omp parallel reduction(+:nok)
+    {
+        struct workspace w = {0};
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_mt19937);
+        double *bx = (double *) malloc(n*sizeof(double));
+        double *by = (double *) malloc(n*sizeof(double));
+        double *bs = (double *) malloc(n*sizeof(double));
+        size_t *idx = (size_t *) malloc(n*sizeof(size_t));
+        struct fit fit;
+
+        #pragma omp for schedule(dynamic)
+        for (long k = 0; k < nboot; k++) {
+            resample_seed(r, seed, k);
+            if (montecarlo) {
+                for (size_t i = 0; i < n; i++) {
+                    bx[i] = x[i];
+                    by[i] = y[i] + gsl_ran_gaussian_ziggurat(r, sigma[i]);
+                    bs[i] = sigma[i];
+                }
+            }
+            else {
+                resample_rows(r, n, idx);
+                for (size_t i = 0; i < n; i++) {
+                    bx[i] = x[idx[i]];
+                    by[i] = y[idx[i]];
+                    bs[i] = sigma[idx[i]];
+                }
+            }
+            if (fit_histogram(&w, solver, model, bx, by, bs, n, par, 0, &fit) || fit.status) {
+                for (size_t j = 0; j < p; j++)
+                    rep[j*nboot + k] = GSL_NAN;
+                continue;
+            }
+            for (size_t j = 0; j < p; j++)
+                rep[j*nboot + k] = fit.par[j];
+            nok++;
+        }
+        workspace_free(&w);
+        gsl_rng_free(r);
+        free(bx);
+        free(by);
+        free(bs);
+        free(idx);
+    }
+
+    for (size_t j = 0; j < p; j++)
+        resample_interval(rep + j*nboot, nboot, 0.6827, &lo[j], &hi[j]);
+    free(rep);
+    return(nok);
+}
+
+
+/* The closed-form estimate for a single gaussian, as a fit. Returns 0 on
+ * success. */
+int fit_closed_form(const double *x, const double *y, const double *sigma, size_t n, struct fit *fit)
+{
+    double cov[9];
+    double chisq = 0;
+
+    if (n <= 3 || gaussian_caruana(x, y, n, fit->par, cov))
+        return(1);
+    for (size_t i=0; i<n; i++)
+        chisq += pow((fit->par[0]*exp(-0.5*pow((x[i]-fit->par[1])/fit->par[2],2)) - y[i])/sigma[i], 2.0);
+    for (size_t j=0; j<3; j++)
+        fit->err[j] = sqrt(cov[4*j]);
+    fit->chisq_dof = chisq / (n - 3);
+    fit->iter = 0;
+    fit->status = GSL_SUCCESS;
+    return(0);
+}
+
+
+/* A histogram row in a batch, tagged with the histogram it belongs to and
+ * its position in the input */
+struct row {
+    double key;
+    long index;
+    double x;
+    double y;
+};
+
+int compare_rows(const void *a, const void *b)
+{
+    const struct row *ra = (const struct row *) a;
+    const struct row *rb = (const struct row *) b;
+
+    if (ra->key != rb->key)
+        return(ra->key < rb->key ? -1 : 1);
+    return(ra->index < rb->index ? -1 : ra->index > rb->index);
+}
+
+/* Fit every histogram in a batch and write one row of results for each.
+ * The histograms are told apart by the value in column keycol, or by the
+ * file they were read from if keycol is NULL. The fits are shared out
+ * between threads, each with its own workspace. */
+int fit_batch(const struct solver *solver, struct model *model, char *keycol, char *xcolname, char *ycolname,
+              char **files, int nfiles, int fast)
+{
+    const size_t p = model->npar;
+    char *colnames[3];
+    int col[3];
+    int ncol;
+    double values[3];
+    struct row *rows = NULL;
+    long nrow = 0, nalloc = 0;
+    long *first, ngroup = 0, maxlen = 0;
+    struct fit *fits;
+    char name[64];
+    int status = 0;
+    int f = 0;
+
+    /* LOAD THE HISTOGRAMS */
+    colnames[0] = xcolname;
+    colnames[1] = ycolname;
+    colnames[2] = keycol;
+    do {
+        if (nfiles > 0 && freopen(files[f], "r", stdin) == NULL) {
+            fprintf(stderr,"Cannot open %s.\n", files[f]);
+            return(1);
+        }
+        col[0] = col[1] = col[2] = -1;
+        ncol = 0;
+        while ((status = read_row(keycol ? 3 : 2, colnames, col, &ncol, values)) == 1) {
+            if (nrow == nalloc) {
+                nalloc = nalloc ? 2*nalloc : 65536;
+                rows = (struct row *) realloc(rows, sizeof(struct row)*nalloc);
+                if (rows == NULL) {
+                    fprintf(stderr,"Memory allocation error\n");
+                    return(1);
+                }
+            }
+            rows[nrow].key = keycol ? values[2] : f;
+            rows[nrow].index = nrow;
+            rows[nrow].x = values[0];
+            rows[nrow].y = values[1];
+            nrow++;
+        }
+        if (status < 0) {
+            fprintf(stderr,"Error reading data table.\n");
+            return(1);
+        }
+    } while (++f < nfiles);
+    if (keycol)
+        qsort(rows, nrow, sizeof(struct row), compare_rows);
+
+    /* Histogram g is rows first[g] to first[g+1]-1 */
+    first = (long *) malloc((nrow + 1)*sizeof(long));
+    for (long i = 0; i < nrow; i++) {
+        if (i == 0 || rows[i].key != rows[i-1].key)
+            first[ngroup++] = i;
+    }
+    first[ngroup] = nrow;
+    for (long g = 0; g < ngroup; g++)
+        maxlen = GSL_MAX(maxlen, first[g+1] - first[g]);
+    fits = (struct fit *) malloc(ngroup*sizeof(struct fit));
+
+    /* FIT THEM */
+    gsl_set_error_handler_off();
+    #pragma omp parallel
+    {
+        struct workspace w = {0};
+        double *x = (double *) malloc(maxlen*sizeof(double));
+        double *y = (double *) malloc(maxlen*sizeof(double));
+        double *sigma = (double *) malloc(maxlen*sizeof(double));
+        double guess[MAXMODELPAR];
+
+        #pragma omp for schedule(dynamic)
+        for (long g = 0; g < ngroup; g++) {
+            struct fit *fit = &fits[g];
+            size_t n = 0;
+
+            /* Weed out zero entries, as for a single histogram */
+            for (long i = first[g]; i < first[g+1]; i++) {
+                if (rows[i].y > 0) {
+                    x[n] = rows[i].x;
+                    y[n] = rows[i].y;
+                    sigma[n] = sqrt(rows[i].y);
+                    n++;
+                }
+            }
+            if (n <= p) {
+                for (size_t j = 0; j < p; j++)
+                    fit->par[j] = fit->err[j] = GSL_NAN;
+                fit->chisq_dof = GSL_NAN;
+                fit->iter = 0;
+                fit->status = GSL_EINVAL;
+                continue;
+            }
+            if (fast && !fit_closed_form(x, y, sigma, n, fit))
+                continue;
+            model_guess(model, x, y, n, guess);
+            if (fit_histogram(&w, solver, model, x, y, sigma, n, guess, 0, fit))
+                fit->status = GSL_ENOMEM;
+        }
+        workspace_free(&w);
+        free(x);
+        free(y);
+        free(sigma);
+    }
+
+    /* ONE ROW PER HISTOGRAM */
+    printf("# 1 %s\n", keycol ? keycol : "FILE");
+    for (size_t j = 0; j < p; j++) {
+        printf("# %d %s\n", (int) (2*j + 2), model_parname(model, j, name, sizeof(name)));
+        printf("# %d %s_ERR\n", (int) (2*j + 3), model_parname(model, j, name, sizeof(name)));
+    }
+    printf("# %d CHISQ_DOF\n", (int) (2*p + 2));
+    printf("# %d NITER\n", (int) (2*p + 3));
+    printf("# %d STATUS\n", (int) (2*p + 4));
+    for (long g = 0; g < ngroup; g++) {
+        if (keycol)
+            printf("%g", rows[first[g]].key);
+        else
+            printf("%s", files[(int) rows[first[g]].key]);
+        for (size_t j = 0; j < p; j++)
+            printf(" %g %g", fits[g].par[j], fits[g].err[j]);
+        printf(" %g %u %d\n", fits[g].chisq_dof, fits[g].iter, fits[g].status);
+    }
+
+    free(rows);
+    free(first);
+    free(fits);
+    return(0);
+}
+
+
+/* Read a column of samples of unknown length into a growing array */
+int read_samples(char *colname, double **v, long *n)
+{
+    char *colnames[1];
+    int col[1] = {-1};
+    int ncol = 0;
+    double value;
+    long nalloc = 0;
+    int status;
+
+    colnames[0] = colname;
+    *v = NULL;
+    *n = 0;
+    while ((status = read_row(1, colnames, col, &ncol, &value)) == 1) {
+        if (*n == nalloc) {
+            nalloc = nalloc ? 2*nalloc : 65536;
+            *v = (double *) realloc(*v, sizeof(double)*nalloc);
+            if (*v == NULL)
+                return(1);
+        }
+        (*v)[(*n)++] = value;
+    }
+    return(status < 0 || *n == 0);
+}
+
+
+/* Histogram of n samples in nbins equal bins spanning [lo,hi]. Each thread
+ * fills its own copy of the histogram and the copies are added at the end. */
+void bin_samples(const double *v, long n, double lo, double hi, long nbins, double *count)
+{
+    double ih = nbins/(hi - lo);
+
+    for (long b = 0; b < nbins; b++)
+        count[b] = 0.0;
+    #pragma omp parallel
+    {
+        double *c = (double *) calloc(nbins, sizeof(double));
+        #pragma omp for schedule(static)
+        for (long i = 0; i < n; i++) {
+            long b = (long) ((v[i] - lo)*ih);
+            c[b < nbins ? b : nbins - 1] += 1.0;
+        }
+        #pragma omp critical
+        for (long b = 0; b < nbins; b++)
+            count[b] += c[b];
+        free(c);
+    }
+}
+
+
+/* Improve a starting guess for an unbinned fit by fitting a histogram */
+void refine_guess(struct model *model, double *x, double *y, double *sigma, long n, double *par)
+{
+    struct solver solver = {0, 1e-3, 0, 0, 50};
+    struct workspace w = {0};
+    struct fit fit;
+
+    if (n > (long) model->npar && !fit_histogram(&w, &solver, model, x, y, sigma, n, par, 0, &fit))
+        memcpy(par, fit.par, model->npar*sizeof(double));
+    workspace_free(&w);
+}
+
+
+/* Fit the model to samples by unbinned maximum likelihood, using Fisher
+ * scoring with Levenberg-Marquardt damping: each step solves
+ * (I + lambda diag(I)) dp = -g, where g is the gradient of -ln L and I is
+ * the Fisher information, and lambda is raised until the step lowers
+ * -ln L. The starting guess is made from a histogram of the samples, and
+ * is refined by fitting the histogram if the model it gives is not positive
+ * at every sample (often the case for sums with a background). */
+int fit_samples(struct model *model, double *v, long n, double lo, double hi, int verbose, int quiet)
+{
+    const size_t p = model->npar;
+    long nb = GSL_MIN(GSL_MAX((long) sqrt((double) n), 10), MAXROW);
+    double *hx = (double *) malloc(nb*sizeof(double));
+    double *hy = (double *) malloc(nb*sizeof(double));
+    double *hs = (double *) malloc(nb*sizeof(double));
+    double par[MAXMODELPAR], trial[MAXMODELPAR], g[MAXMODELPAR];
+    double info[MAXMODELPAR*MAXMODELPAR];
+    double nll, lambda = 1e-3;
+    struct model_sample s;
+    gsl_matrix *a = gsl_matrix_alloc(p, p);
+    gsl_vector *dp = gsl_vector_alloc(p);
+    gsl_vector_view gv = gsl_vector_view_array(g, p);
+    char name[64];
+    int converged = 0;
+    int ok = 1;
+    unsigned int iter = 0;
+    long count = 0;
+    size_t j, k;
+
+    /* Starting guess from a histogram, in samples per unit x */
+    bin_samples(v, n, lo, hi, nb, hy);
+    for (long b = 0; b < nb; b++) {
+        if (hy[b] > 0) {
+            hx[count] = lo + (b + 0.5)*(hi - lo)/nb;
+            hs[count] = sqrt(hy[b])*nb/(hi - lo);
+            hy[count] = hy[b]*nb/(hi - lo);
+            count++;
+        }
+    }
+    model_guess(model, hx, hy, count, par);
+
+    if (model_sample_init(&s, model, n, v, lo, hi)) {
+        fprintf(stderr,"Memory allocation error\n");
+        exit(1);
+    }
+    nll = model_nll(&s, par, g, info);
+    if (!gsl_finite(nll)) {
+        refine_guess(model, hx, hy, hs, count, par);
+        nll = model_nll(&s, par, g, info);
+    }
+    free(hx);
+    free(hy);
+    free(hs);
+    if (!quiet) {
+        printf("Initial guess:");
+        for (j = 0; j < p; j++)
+            printf(" %s=%g", model_parname(model, j, name, sizeof(name)), par[j]);
+        printf("\n");
+    }
+    if (!gsl_finite(nll)) {
+        fprintf(stderr,"The model is not positive at every sample. Try fitting a histogram with -b.\n");
+        exit(1);
+    }
+
+    gsl_set_error_handler_off();
+    while (ok && !converged && iter < 500) {
+        double tnll = GSL_POSINF;
+
+        iter++;
+        for (;;) {
+            for (j = 0; j < p; j++)
+                for (k = 0; k < p; k++)
+                    gsl_matrix_set(a, j, k, info[j*p + k]*(j == k ? 1.0 + lambda : 1.0));
+            if (!gsl_linalg_cholesky_decomp(a)) {
+                gsl_linalg_cholesky_solve(a, &gv.vector, dp);
+                for (j = 0; j < p; j++)
+                    trial[j] = par[j] - gsl_vector_get(dp, j);
+                tnll = model_nll(&s, trial, NULL, NULL);
+                if (tnll <= nll)
+                    break;
+            }
+            lambda *= 10;
+            if (lambda > 1e10) {
+                ok = 0;   /* no step downhill: at the minimum or stuck */
+                break;
+            }
+        }
+        if (!ok)
+            break;
+
+        converged = 1;
+        for (j = 0; j < p; j++)
+            if (fabs(trial[j] - par[j]) >= 1e-4 + 1e-4*fabs(trial[j]))
+                converged = 0;
+        memcpy(par, trial, p*sizeof(double));
+        nll = model_nll(&s, par, g, info);
+        lambda = GSL_MAX_DBL(lambda/10, 1e-7);
+
+        if (verbose) {
+            printf ("iter: %3u      parameters =", iter);
+            for (j = 0; j < p; j++)
+                printf (" % 15.8f", par[j]);
+            printf (" -ln(L) = %g\n", nll);
+        }
+    }
+
+    /* The covariance is the inverse of the Fisher information */
+    for (j = 0; j < p; j++)
+        for (k = 0; k < p; k++)
+            gsl_matrix_set(a, j, k, info[j*p + k]);
+    if (gsl_linalg_cholesky_decomp(a) || gsl_linalg_cholesky_invert(a))
+        gsl_matrix_set_all(a, GSL_NAN);
+
+    if (!quiet) {
+        for (j = 0; j < p; j++)
+            printf ("%-4s = %.5f +/- %.5f\n", model_parname(model, j, name, sizeof(name)),
+                    par[j], sqrt(gsl_matrix_get(a, j, j)));
+        printf("-ln(L) = %g\n", nll);
+        printf("iterations = %u\n", iter);
+        printf("status = %s\n", converged || !ok ? "success" : "iteration limit reached");
+    }
+    else {
+        for (j = 0; j < p; j++)
+            printf(j ? " %.2f" : "%.2f", par[j]);
+        printf("\n");
+    }
+
+    model_sample_free(&s);
+    gsl_matrix_free(a);
+    gsl_vector_free(dp);
+    return(0);
 }
 
 
@@ -77,11 +799,60 @@ int main (int argc, char **argv)
     int quiet = 0;
     char xcolname[64];
     char ycolname[64];
+    char *modelname = "gaussian";
+    struct model model;
+    int fast = 0;
+    int unbinned = 0;
+    long nbins = 0;
+    char *keycol = NULL;
+    long nboot = 0;
+    unsigned long seed = 1;
+    int montecarlo = 0;
+    struct solver solver = {0, 1e-4, 0, 0, 500};
     int narg,c;
 
-    while ((c = getopt (argc, argv, "vqh")) != -1)
+    while ((c = getopt (argc, argv, "vqhfuMGB:S:b:k:m:x:g:c:I:")) != -1)
         switch (c)
         {
+            case 'G':
+                solver.geodesic = 1;
+                break;
+            case 'x':
+                solver.xtol = atof(optarg);
+                break;
+            case 'g':
+                solver.gtol = atof(optarg);
+                break;
+            case 'c':
+                solver.ctol = atof(optarg);
+                break;
+            case 'I':
+                solver.maxiter = atoi(optarg);
+                break;
+            case 'B':
+                nboot = atol(optarg);
+                break;
+            case 'M':
+                montecarlo = 1;
+                break;
+            case 'S':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'k':
+                keycol = optarg;
+                break;
+            case 'u':
+                unbinned = 1;
+                break;
+            case 'b':
+                nbins = atol(optarg);
+                break;
+            case 'f':
+                fast = 1;
+                break;
+            case 'm':
+                modelname = optarg;
+                break;
             case 'v':
                 verbose = 1;
                 break;
@@ -107,16 +878,39 @@ int main (int argc, char **argv)
                 abort();
         }
     narg = argc - optind;
-    if (narg == 2) 
+    if (narg >= 2 && !unbinned) 
     { 
         sscanf(argv[optind++],"%s",xcolname);
         sscanf(argv[optind++],"%s",ycolname);
     }
+    else if (narg == 1 && unbinned)
+        sscanf(argv[optind++],"%s",xcolname);
     else
     {
         print_help();
         return(1);
     }
+    if (model_parse(modelname, &model))
+        return(1);
+    if (nbins < 0 || nbins > MAXROW) {
+        fprintf(stderr,"The number of bins must be between 1 and %d.\n", MAXROW);
+        return(1);
+    }
+    if (fast && (model.ncomp != 1 || strcmp(model.comp[0]->name, "gaussian"))) {
+        fprintf(stderr,"The closed-form estimate (-f) is only available for a single gaussian.\n");
+        return(1);
+    }
+    if (nboot > 0 && (keycol || narg > 2 || (unbinned && nbins == 0))) {
+        fprintf(stderr,"Bootstrap uncertainties (-B) are only available for a single histogram.\n");
+        return(1);
+    }
+    if (keycol || narg > 2) {
+        if (unbinned) {
+            fprintf(stderr,"Batches of samples can not be fitted unbinned.\n");
+            return(1);
+        }
+        return(fit_batch(&solver, &model, keycol, xcolname, ycolname, argv + optind, narg - 2, fast));
+    }
 
     /* LOAD HISTOGRAM */
 
@@ -126,12 +920,50 @@ int main (int argc, char **argv)
     int nrow = 0;
     int count = 0;
     int status = 0;
+    double scale = 1.0;
 
-    status = read_xy(xcolname,ycolname,x,y,&nrow);
-    if (status)
-    {
-        fprintf(stderr,"Error reading data table.\n");
-        exit(1);
+    if (unbinned) {
+        double *v = NULL;
+        long nv = 0;
+        double lo, hi;
+
+        if (read_samples(xcolname, &v, &nv)) {
+            fprintf(stderr,"Error reading data table.\n");
+            exit(1);
+        }
+        lo = hi = v[0];
+        for (long i = 1; i < nv; i++) {
+            lo = GSL_MIN_DBL(lo, v[i]);
+            hi = GSL_MAX_DBL(hi, v[i]);
+        }
+        if (hi == lo) {
+            fprintf(stderr,"All the samples have the same value.\n");
+            exit(1);
+        }
+        if (nbins == 0 && (fast || nv > MAXUNBINNED))
+            nbins = NBINS;
+        if (nbins == 0) {
+            status = fit_samples(&model, v, nv, lo, hi, verbose, quiet);
+            free(v);
+            return(status);
+        }
+
+        /* Fit the histogram of the samples in units of samples per unit x,
+         * as an unbinned fit would */
+        bin_samples(v, nv, lo, hi, nbins, y);
+        for (long b = 0; b < nbins; b++)
+            x[b] = lo + (b + 0.5)*(hi - lo)/nbins;
+        nrow = nbins;
+        scale = nbins/(hi - lo);
+        free(v);
+    }
+    else {
+        status = read_xy(xcolname,ycolname,x,y,&nrow);
+        if (status)
+        {
+            fprintf(stderr,"Error reading data table.\n");
+            exit(1);
+        }
     }
     // Weed out zero entries for now - assuming poisson statistics 
     // they contribute infinite variance
@@ -144,110 +976,88 @@ int main (int argc, char **argv)
         }
     }
     nrow = count;
+    for (int i=0; i<nrow && scale != 1.0; i++) {
+        y[i] *= scale;
+        sigma[i] *= scale;
+    }
     if (verbose) for(int i=0;i<nrow;i++) printf("%20g %20g\n",x[i],y[i]);
 
 
     /* DETERMINE INITIAL GUESSES */
 
-    double norm = 0;
-    double mean = 0;
-    double rms = 0;
-    double npix = 0;
-    double mode = 0;
-    double maxcount = 0;
-    for (int i=0; i<nrow; i++) {
-        if (y[i]>maxcount){
-            maxcount = y[i];
-            mode = x[i];
-        }
-    }
-    norm = maxcount;
-    mean = mode;
-    rms = sqrt(mode);
-    if (!quiet)
-        printf("Initial guess: A=%g mu=%g sig=%g\n",norm,mean,rms);
+    const size_t p = model.npar;  /* number of free parameters */
+    double x_init[MAXMODELPAR];
+    char name[64];
 
-    /* FIT THE DATA */
-
-    const gsl_multifit_fdfsolver_type *T;
-    gsl_multifit_fdfsolver *s;
-    unsigned int i, iter = 0;
-    const size_t p = 3;          /* number of free parameters */
-    gsl_matrix *covar = gsl_matrix_alloc (p, p);
-    struct data d = {nrow, x, y, sigma};
-    gsl_multifit_function_fdf f;
-    double x_init[3] = {norm, mean, rms};
-    gsl_vector_view xx = gsl_vector_view_array (x_init, p);
-    const gsl_rng_type * type;
-    gsl_rng * r;
-
-    /* Set up GSL */
-    gsl_rng_env_setup();
-    type = gsl_rng_default;
-    r = gsl_rng_alloc (type);
-
-    /* Define the model to fit */
-    f.f = &gauss_f;
-    f.df = &gauss_df;
-    f.fdf = &gauss_fdf;
-    f.n = nrow;
-    f.p = p;
-    f.params = &d;
+    model_guess(&model, x, y, nrow, x_init);
+    if (!quiet) {
+        printf("Initial guess:");
+        for (size_t j = 0; j < p; j++)
+            printf(" %s=%g", model_parname(&model, j, name, sizeof(name)), x_init[j]);
+        printf("\n");
+    }
 
-    /* Define the solver we wish to use */
-    T = gsl_multifit_fdfsolver_lmsder;
-    s = gsl_multifit_fdfsolver_alloc(T, nrow, p);
-    gsl_multifit_fdfsolver_set(s, &f, &xx.vector);
+    /* CLOSED-FORM FAST PATH */
 
-    if (verbose) print_state (iter, s);
+    if (fast) {
+        struct fit fit;
+        if (!fit_closed_form(x, y, sigma, nrow, &fit)) {
+            if (!quiet) {
+                for (size_t j = 0; j < p; j++)
+                    printf ("%-4s = %.5f +/- %.5f\n", model_parname(&model, j, name, sizeof(name)),
+                            fit.par[j], fit.err[j]);
+                printf("chisq/dof = %g\n", fit.chisq_dof);
+                printf("iterations = 0\n");
+                printf("status = closed form\n");
+            }
+            else
+                printf("%.2f %.2f %.2f\n", fit.par[0], fit.par[1], fit.par[2]);
+            return 0;
+        }
+        if (!quiet)
+            printf("Closed-form estimate failed, fitting instead\n");
+    }
 
-    /* Fit the model to the data */
-    do
-    {
-        iter++;
-        status = gsl_multifit_fdfsolver_iterate(s);
+    /* FIT THE DATA */
 
-        if (verbose) printf ("status = %s\n", gsl_strerror (status));
-        if (verbose) print_state (iter, s);
+    struct workspace w = {0};
+    struct fit fit;
 
-        if (status)
-            break;
-
-        status = gsl_multifit_test_delta (s->dx, s->x, 1e-4, 1e-4);
+    if (fit_histogram(&w, &solver, &model, x, y, sigma, nrow, x_init, verbose, &fit)) {
+        fprintf(stderr,"Memory allocation error\n");
+        exit(1);
+    }
+    if (!quiet) {
+        for (size_t j = 0; j < p; j++)
+            printf ("%-4s = %.5f +/- %.5f\n", model_parname(&model, j, name, sizeof(name)),
+                    fit.par[j], fit.err[j]);
+        printf("chisq/dof = %g\n", fit.chisq_dof);
+        printf("iterations = %u\n", fit.iter);
+        printf ("status = %s\n", gsl_strerror (fit.status));
+    }
+    else {
+        for (size_t j = 0; j < p; j++)
+            printf(j ? " %.2f" : "%.2f", fit.par[j]);
+        printf("\n");
     }
-    while (status == GSL_CONTINUE && iter < 500);
-
-    /* Compute covariance */
-    gsl_multifit_covar (s->J, 0.0, covar);
-
-    { 
-        double chi = gsl_blas_dnrm2(s->f);
-        double dof = nrow - p;
-        double c = GSL_MAX_DBL(1, chi / sqrt(dof)); 
 
+    if (nboot > 0) {
+        double lo[MAXMODELPAR], hi[MAXMODELPAR];
+        long nok = bootstrap_histogram(&solver, &model, x, y, sigma, nrow, fit.par, nboot, seed, montecarlo, lo, hi);
         if (!quiet) {
-            printf ("A    = %.5f +/- %.5f\n", gsl_vector_get(s->x, 0), 
-                    c*sqrt(gsl_matrix_get(covar,0,0)));
-            printf ("mu   = %.5f +/- %.5f\n", gsl_vector_get(s->x, 1), 
-                    c*sqrt(gsl_matrix_get(covar,1,1)));
-            printf ("sig  = %.5f +/- %.5f\n", gsl_vector_get(s->x, 2), 
-                    c*sqrt(gsl_matrix_get(covar,2,2)));
-            printf("chisq/dof = %g\n",  pow(chi, 2.0) / dof);
+            printf("68%% intervals from %ld of %ld %s replicates:\n", nok, nboot,
+                   montecarlo ? "Monte Carlo" : "bootstrap");
+            for (size_t j = 0; j < p; j++)
+                printf ("%-4s in [%.5f, %.5f]\n", model_parname(&model, j, name, sizeof(name)), lo[j], hi[j]);
+        }
+        else {
+            for (size_t j = 0; j < p; j++)
+                printf(j ? " %.2f %.2f" : "%.2f %.2f", lo[j], hi[j]);
+            printf("\n");
         }
-        else 
-            printf("%.2f %.2f %.2f\n",
-                    gsl_vector_get(s->x, 0), 
-                    gsl_vector_get(s->x, 1),
-                    gsl_vector_get(s->x, 2));
-
     }
 
-    if (!quiet)
-        printf ("status = %s\n", gsl_strerror (status));
-
-    gsl_multifit_fdfsolver_free (s);
-    gsl_matrix_free (covar);
-    gsl_rng_free (r);
+    workspace_free(&w);
     return 0;
 }
 
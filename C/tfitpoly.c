@@ -2,10 +2,18 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
+#include <string.h>
 #include <gsl/gsl_multifit.h>
+#include <gsl/gsl_linalg.h>
 #include "table.h"
+#include "resample.h"
+#include "robust.h"
+#include "crossval.h"
+#include "linsolve.h"
   
 #define MAXROW 100000
+#define MAXRESP 64
 
 char   *help[] = {
 "",
@@ -14,11 +22,24 @@ char   *help[] = {
 "",
 "SYNOPSIS",
 "    % tfit [OPTIONS] xcol ycol [scol] < table.txt ",
+"    % tfit [OPTIONS] -m xcol ycol1[:scol1] ycol2[:scol2] ... < table.txt ",
 "",
 "OPTIONS",
+"    -B n     Estimate uncertainties from n bootstrap replicates",
+"    -m       Fit each of several Y columns (see below)",
+"    -M       Make the -B replicates by adding gaussian noise to Y rather",
+"             than by resampling the rows",
+"    -S seed  Random number seed for -B [default 1]",
 "    -v       Verbose mode", 
 "    -V       Extra verbose mode (prints input data)", 
 "    -n       Order of the polynomial (0=constant, 1=line, 2=parabola)", 
+"    -N max   Choose the order from 0 to max (see below)",
+"    -s name  Criterion for -N: cv, aic or bic [default cv]",
+"    -k n     Number of cross-validation folds for -N [default 5]",
+"    -l name  Least-squares solver: auto, cholesky, qr or svd [default auto]",
+"    -r name  Fit robustly with the named estimator: huber, tukey or clip",
+"    -t k     Tuning constant for -r, in units of the residual scale",
+"             [default 1.345 for huber, 4.685 for tukey, 3 for clip]",
 "",
 "DESCRIPTION",
 "",
@@ -28,6 +49,60 @@ char   *help[] = {
 "    three columns are named the last column is the uncertainty on the Y",
 "    axis measurements.",
 "",
+"    With -m any number of Y columns can be fitted against the same X",
+"    column in one run. Each can be given its own uncertainty column by",
+"    appending it after a colon (e.g. MAG_AUTO:MAGERR_AUTO). The design",
+"    matrix is factorized once for each distinct uncertainty column (and",
+"    once for all the columns without one) and the factorization is",
+"    reused for every Y column that shares it, so these fits are always",
+"    solved by QR and -l cannot be given. The output is a table with",
+"    one row per Y column: its name, the coefficients and their",
+"    uncertainties, chisq and the reduced chisq. With -v each best fit is",
+"    also printed as a comment.",
+"",
+"    With -B the fit is repeated on n resampled copies of the data and the",
+"    central 68% interval of each coefficient over the copies is reported,",
+"    as two extra lines of lower and upper bounds (or, with -v, as",
+"    comment lines). The copies either draw the rows with replacement (a",
+"    bootstrap) or, with -M, add gaussian noise to Y with the uncertainty",
+"    given in scol (or the rms residual of the fit if there is none). The",
+"    copies are spread over the available threads, and each is made from",
+"    its own random number stream, so the answer depends on the seed but",
+"    not on the number of threads.",
+"",
+"    The fit is solved by the cheapest method its conditioning allows:",
+"    the normal equations (by Cholesky factorization) when the design",
+"    matrix, with its columns scaled to unit length, has an estimated",
+"    condition number below 1e4, Householder QR below 1e10, and the",
+"    singular value decomposition otherwise. A solver can be forced with",
+"    -l (a forced cholesky or qr falls back to svd if the system is",
+"    singular); with -v the one used and the condition number are",
+"    printed. The copies made by -B are solved in the same way.",
+"",
+"    With -N the order is chosen rather than given, by fitting every",
+"    order from 0 to max and keeping the one with the best score. The",
+"    default score is the mean squared (weighted) residual of k-fold",
+"    cross validation, with the rows dealt into the folds in turn; aic",
+"    and bic score the fit to all the data by chisq plus 2 or ln(n) per",
+"    coefficient. The table is read once into the normal equations of",
+"    each fold, the fits leaving out one fold are solved from their sum",
+"    minus that fold, and all the fits run in parallel. The chosen order",
+"    is then fitted as usual; with -v the scores are also printed.",
+"",
+"    With -r outliers are down-weighted rather than fitted. The huber",
+"    estimator gives points more than k times the residual scale from",
+"    the fit a weight falling off as 1/|r|, tukey (the biweight) gives",
+"    them a weight falling smoothly to zero at k, and clip rejects them",
+"    outright. The scale is the median absolute residual (scaled to a",
+"    gaussian sigma), or for clip the rms residual of the points kept.",
+"    The fit is found by iteratively reweighted least squares: each pass",
+"    reweights the points by the residuals of the previous solution and",
+"    solves again, with the same choice of solver as an ordinary fit, and",
+"    the whole iteration runs on one read of the table. The uncertainties",
+"    and chisq are those of the final weighted fit; with -v the number",
+"    of passes, the scale and the number of points given less than half",
+"    weight are also printed.",
+"",
 "AUTHOR",
 "    Roberto Abraham (abraham@astro.utoronto.ca)",
 "",
@@ -43,6 +118,163 @@ void print_help()
 }
   
 
+/* Fit the polynomial to each of ny Y columns against x. Columns that
+ * share an uncertainty column (s[k], or NULL for none) share one QR
+ * factorization of the weighted design matrix, and each is then just a
+ * back substitution. */
+int fit_columns(double *x, double **y, double **s, char **ycolname, int ny, int nrow, int order, int verbose)
+{
+    const int ncol = order + 1;
+    gsl_matrix *QR = gsl_matrix_alloc(nrow, ncol);
+    gsl_matrix *cov = gsl_matrix_alloc(ncol, ncol);
+    gsl_matrix *Rinv = gsl_matrix_alloc(ncol, ncol);
+    gsl_vector *tau = gsl_vector_alloc(ncol);
+    gsl_vector *b = gsl_vector_alloc(nrow);
+    gsl_vector *res = gsl_vector_alloc(nrow);
+    gsl_vector *cvec = gsl_vector_alloc(ncol);
+    double **coef = (double **) malloc(ny*sizeof(double *));
+    double **err = (double **) malloc(ny*sizeof(double *));
+    double *chisq = (double *) malloc(ny*sizeof(double));
+    int *done = (int *) calloc(ny, sizeof(int));
+    int i, j, k, m;
+
+    if (nrow < ncol) {
+        fprintf(stderr,"Too few data points for a polynomial of order %d.\n", order);
+        return(1);
+    }
+
+    for (k = 0; k < ny; k++) {
+        if (done[k])
+            continue;
+
+        /* Factorize the design matrix, each row weighted by 1/sigma */
+        for (i = 0; i < nrow; i++) {
+            double w = s[k] ? 1.0/s[k][i] : 1.0;
+            for (j = 0; j <= order; j++)
+                gsl_matrix_set(QR, i, j, w*pow(x[i],j));
+        }
+        gsl_linalg_QR_decomp(QR, tau);
+
+        /* The covariance matrix (R^T R)^-1 = R^-1 R^-T is shared too */
+        gsl_matrix_set_identity(Rinv);
+        for (j = 0; j < ncol; j++) {
+            gsl_vector_view col = gsl_matrix_column(Rinv, j);
+            gsl_matrix_const_view R = gsl_matrix_const_submatrix(QR, 0, 0, ncol, ncol);
+            gsl_blas_dtrsv(CblasUpper, CblasNoTrans, CblasNonUnit, &R.matrix, &col.vector);
+        }
+        gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, Rinv, Rinv, 0.0, cov);
+
+        /* Solve for every column with the same uncertainties */
+        for (m = k; m < ny; m++) {
+            if (done[m] || s[m] != s[k])
+                continue;
+            for (i = 0; i < nrow; i++)
+                gsl_vector_set(b, i, (s[m] ? 1.0/s[m][i] : 1.0)*y[m][i]);
+            gsl_linalg_QR_lssolve(QR, tau, b, cvec, res);
+            coef[m] = (double *) malloc(ncol*sizeof(double));
+            err[m] = (double *) malloc(ncol*sizeof(double));
+            for (j = 0; j < ncol; j++) {
+                coef[m][j] = gsl_vector_get(cvec, j);
+                err[m][j] = sqrt(gsl_matrix_get(cov, j, j));
+            }
+            chisq[m] = pow(gsl_blas_dnrm2(res), 2.0);
+            done[m] = 1;
+        }
+    }
+
+    if (verbose) {
+        for (k = 0; k < ny; k++) {
+            printf("# best fit for %s: Y = %g", ycolname[k], coef[k][0]);
+            for (j=1;j<=order;j++)
+                printf(" + %g X^%d",coef[k][j],j);
+            printf("\n");
+        }
+    }
+    printf("# 1 COLUMN\n");
+    for (j = 0; j <= order; j++) {
+        printf("# %d C%d\n", 2*j + 2, j);
+        printf("# %d C%d_ERR\n", 2*j + 3, j);
+    }
+    printf("# %d CHISQ\n", 2*ncol + 2);
+    printf("# %d CHISQ_NU\n", 2*ncol + 3);
+    for (k = 0; k < ny; k++) {
+        printf("%s", ycolname[k]);
+        for (j = 0; j <= order; j++)
+            printf(" %.10g %.10g", coef[k][j], err[k][j]);
+        printf(" %g %g\n", chisq[k], chisq[k]/(nrow - order - 1));
+        free(coef[k]);
+        free(err[k]);
+    }
+
+    gsl_matrix_free(QR);
+    gsl_matrix_free(cov);
+    gsl_matrix_free(Rinv);
+    gsl_vector_free(tau);
+    gsl_vector_free(b);
+    gsl_vector_free(res);
+    gsl_vector_free(cvec);
+    free(coef);
+    free(err);
+    free(chisq);
+    free(done);
+    return(0);
+}
+
+
+/* Multiple Y columns: read them all (with x and any uncertainty columns)
+ * in one pass and hand them to fit_columns() */
+int multi(char **args, int nargs, int order, int verbose)
+{
+    char *colnames[2*MAXRESP + 1];
+    double *cols[2*MAXRESP + 1];
+    double *y[MAXRESP], *s[MAXRESP];
+    char *ycolname[MAXRESP];
+    int sidx[MAXRESP];
+    int ny = nargs - 1, ncols;
+    int nrow = 0, status, k, c;
+
+    if (ny < 1 || ny > MAXRESP) {
+        print_help();
+        return(1);
+    }
+    /* x, then the Y columns, then each distinct uncertainty column */
+    colnames[0] = args[0];
+    ncols = 1 + ny;
+    for (k = 0; k < ny; k++) {
+        char *sep = strchr(args[k + 1], ':');
+        ycolname[k] = colnames[k + 1] = args[k + 1];
+        sidx[k] = -1;
+        if (sep == NULL)
+            continue;
+        *sep = '\0';
+        for (c = 1 + ny; c < ncols; c++)
+            if (!strcmp(colnames[c], sep + 1))
+                sidx[k] = c;
+        if (sidx[k] < 0) {
+            sidx[k] = ncols;
+            colnames[ncols++] = sep + 1;
+        }
+    }
+
+    for (c = 0; c < ncols; c++)
+        cols[c] = (double *) malloc(sizeof(double)*MAXROW);
+    status = read_cols(ncols, colnames, cols, &nrow);
+    if (status)
+    {
+        fprintf(stderr,"Error reading data table.\n");
+        exit(1);
+    }
+    for (k = 0; k < ny; k++) {
+        y[k] = cols[k + 1];
+        s[k] = sidx[k] < 0 ? NULL : cols[sidx[k]];
+    }
+    status = fit_columns(cols[0], y, s, ycolname, ny, nrow, order, verbose);
+    for (c = 0; c < ncols; c++)
+        free(cols[c]);
+    return(status);
+}
+
+
 int main (int argc, char **argv)
 {
     double x[MAXROW];
@@ -63,11 +295,60 @@ int main (int argc, char **argv)
     char scolname[64];
     int has_uncertainties;
     int order = 2;
+    long nboot = 0;
+    unsigned long seed = 1;
+    int montecarlo = 0;
+    int multiple = 0;
+    struct robust robust = {ROBUST_NONE, 0.0, 100};
+    double tune = 0.0;
+    int maxorder = -1;
+    int criterion = CROSSVAL_CV;
+    int nfold = 5;
+    struct linsolve solver = {LINSOLVE_AUTO};
     int narg,c;
 
-    while ((c = getopt (argc, argv, "vVhn:")) != -1)
+    while ((c = getopt (argc, argv, "vVhmMn:B:S:r:t:N:s:k:l:")) != -1)
         switch (c)
         {
+            case 'l':
+                if ((solver.method = linsolve_method(optarg)) < 0) {
+                    fprintf(stderr,"Unknown solver %s.\n", optarg);
+                    return(1);
+                }
+                break;
+            case 'N':
+                maxorder = atoi(optarg);
+                break;
+            case 's':
+                if ((criterion = crossval_criterion(optarg)) < 0) {
+                    fprintf(stderr,"Unknown order selection criterion %s.\n", optarg);
+                    return(1);
+                }
+                break;
+            case 'k':
+                nfold = atoi(optarg);
+                break;
+            case 'r':
+                if (robust_method(optarg, &robust)) {
+                    fprintf(stderr,"Unknown robust estimator %s.\n", optarg);
+                    return(1);
+                }
+                break;
+            case 't':
+                tune = atof(optarg);
+                break;
+            case 'm':
+                multiple = 1;
+                break;
+            case 'B':
+                nboot = atol(optarg);
+                break;
+            case 'M':
+                montecarlo = 1;
+                break;
+            case 'S':
+                seed = strtoul(optarg, NULL, 10);
+                break;
             case 'v':
                 verbose = 1;
                 break;
@@ -97,6 +378,27 @@ int main (int argc, char **argv)
                 abort();
         }
     narg = argc - optind;
+    if (tune > 0.0)
+        robust.tune = tune;
+    if (robust.method != ROBUST_NONE && (multiple || nboot > 0)) {
+        fprintf(stderr,"Robust fits (-r) cannot be combined with -m or -B.\n");
+        return(1);
+    }
+    if (multiple) {
+        if (maxorder >= 0) {
+            fprintf(stderr,"Order selection (-N) is only available for a single Y column.\n");
+            return(1);
+        }
+        if (nboot > 0) {
+            fprintf(stderr,"Bootstrap uncertainties (-B) are only available for a single Y column.\n");
+            return(1);
+        }
+        if (solver.method != LINSOLVE_AUTO) {
+            fprintf(stderr,"A solver (-l) cannot be chosen with -m, which always uses QR.\n");
+            return(1);
+        }
+        return(multi(argv + optind, narg, order, verbose));
+    }
     if (narg == 2) 
     { 
         sscanf(argv[optind++],"%s",xcolname);
@@ -140,6 +442,45 @@ int main (int argc, char **argv)
         for(int i=0;i<nrow;i++) printf("%20g %20g %20g\n",x[i],y[i],sigma[i]); 
     }
 
+    /* CHOOSE THE ORDER */
+    if (maxorder >= 0) {
+        int *use = (int *) malloc((maxorder+1)*(maxorder+1)*sizeof(int));
+        double *score = (double *) malloc((maxorder+1)*sizeof(double));
+
+        if (criterion == CROSSVAL_CV && (nfold < 2 || nfold > nrow)) {
+            fprintf(stderr,"The number of folds must be between 2 and the number of rows.\n");
+            exit(1);
+        }
+        /* Polynomials in (x - x0)/dx span the same fits as those in x, and
+         * keep the normal equations well conditioned */
+        double x0, dx;
+        crossval_scale(x, nrow, &x0, &dx);
+        X = gsl_matrix_alloc(nrow, maxorder + 1);
+        yvec = gsl_vector_alloc(nrow);
+        wvec = gsl_vector_alloc(nrow);
+        for (i = 0; i < nrow; i++) {
+            gsl_vector_set(yvec, i, y[i]);
+            gsl_vector_set(wvec, i, 1.0/(sigma[i]*sigma[i]));
+            for (int j = 0; j <= maxorder; j++) 
+                gsl_matrix_set(X, i, j, pow((x[i] - x0)/dx,j));
+        }
+        for (int m = 0; m <= maxorder; m++)
+            for (int j = 0; j <= maxorder; j++)
+                use[m*(maxorder+1) + j] = j <= m;
+        order = crossval_select(X, wvec, yvec, maxorder + 1, use, criterion, nfold,
+                                has_uncertainties, score);
+        if (verbose) {
+            printf("# order selection by %s:\n", crossval_name(criterion));
+            for (int m = 0; m <= maxorder; m++)
+                printf("# order %d score %g%s\n", m, score[m], m == order ? " *" : "");
+        }
+        gsl_matrix_free(X);
+        gsl_vector_free(yvec);
+        gsl_vector_free(wvec);
+        free(use);
+        free(score);
+    }
+
     /* EXECUTE THE FIT */
     ncol = order + 1;
     X = gsl_matrix_alloc(nrow, ncol);
@@ -169,11 +510,13 @@ int main (int argc, char **argv)
 
 
 
-    {
-        gsl_multifit_linear_workspace *work = gsl_multifit_linear_alloc(nrow, ncol);
-        gsl_multifit_wlinear(X, wvec, yvec, cvec, cov, &chisq, work);
-        gsl_multifit_linear_free(work);
+    if (robust.method != ROBUST_NONE) {
+        if (robust_fit(X, yvec, wvec, &robust, &solver, cvec, cov, &chisq))
+            fprintf(stderr,"Warning: robust fit stopped after %d passes, when the %s solver failed.\n",
+                    robust.iter, linsolve_name(solver.used));
     }
+    else if (linsolve_fit(&solver, X, wvec, yvec, cvec, cov, &chisq))
+        fprintf(stderr,"Warning: the %s solver failed.\n", linsolve_name(solver.used));
 
     #define C(i) (gsl_vector_get(cvec,(i)))
     #define COV(i,j) (gsl_matrix_get(cov,(i),(j)))
@@ -194,6 +537,10 @@ int main (int argc, char **argv)
 
         printf("# chisq = %g\n", chisq);
         printf("# chisq_nu = %g\n", chisq/(nrow - order -1));
+        printf("# solver: %s (condition number %g)\n", linsolve_name(solver.used), solver.cond);
+        if (robust.method != ROBUST_NONE)
+            printf("# robust: %s (k = %g), %d passes, scale = %g, %ld of %d points below half weight\n",
+                   robust_name(&robust), robust.tune, robust.iter, robust.scale, robust.nlow, nrow);
     }
     else {
         for (i=0;i<=order;i++)
@@ -202,6 +549,34 @@ int main (int argc, char **argv)
 
     }
 
+    if (nboot > 0) {
+        double *lo = (double *) malloc(ncol*sizeof(double));
+        double *hi = (double *) malloc(ncol*sizeof(double));
+        long nok;
+
+        /* Without uncertainties the noise is the scatter about the fit */
+        if (montecarlo && !has_uncertainties)
+            for (i = 0; i < nrow; i++)
+                sigma[i] = sqrt(chisq/(nrow - ncol));
+        nok = resample_linear(X, wvec, yvec, sigma, &solver, nboot, seed, montecarlo, 0.6827, lo, hi);
+        if (verbose) {
+            printf("# 68%% intervals from %ld of %ld %s replicates:\n", nok, nboot,
+                   montecarlo ? "Monte Carlo" : "bootstrap");
+            for (i=0;i<=order;i++)
+                printf("# C%d in [%g, %g]\n", i, lo[i], hi[i]);
+        }
+        else {
+            for (i=0;i<=order;i++)
+                printf("%.10g ",lo[i]);
+            printf("\n");
+            for (i=0;i<=order;i++)
+                printf("%.10g ",hi[i]);
+            printf("\n");
+        }
+        free(lo);
+        free(hi);
+    }
+
     gsl_matrix_free (X);
     gsl_vector_free (yvec);
     gsl_vector_free (wvec);
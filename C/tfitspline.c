@@ -0,0 +1,398 @@
+// Least-squares cubic B-spline fitting. Each point touches only four
+// basis functions, so the normal equations are banded (bandwidth 4) and
+// are accumulated and solved in time linear in the number of rows and
+// memory linear in the number of knots.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <string.h>
+#include <math.h>
+#include "table.h"
+
+#define ORDER 4            /* cubic */
+#define MAXKNOT 100000
+
+char   *help[] = {
+"",
+"NAME",
+"    tfitspline - fit a cubic spline to table columns",
+"",
+"SYNOPSIS",
+"    % tfitspline [OPTIONS] xcol ycol [scol] < table.txt ",
+"",
+"OPTIONS",
+"    -n n     Number of intervals between the breakpoints [default 10]",
+"    -k list  Comma-separated breakpoints (e.g. -k 0,10,20,50,100)",
+"    -x a,b   Place the -n breakpoints evenly over [a,b]",
+"    -v       Verbose mode",
+"    -h       Print help",
+"",
+"DESCRIPTION",
+"",
+"    This program fits a cubic B-spline to named columns in a SExtractor",
+"    ASCII table provided via standard input. As with tfit, the first",
+"    two columns named are X and Y, and an optional third column is the",
+"    uncertainty on Y. Unlike a high-order polynomial the spline is only",
+"    as flexible as its breakpoints allow, and does not ring at the ends",
+"    of the data.",
+"",
+"    The spline is cubic between breakpoints b0 < b1 < ... < bn, with",
+"    continuous second derivatives at the interior ones, and is written",
+"    as a sum of n+3 B-splines on the clamped knot vector (b0 and bn each",
+"    repeated four times). By default the breakpoints are placed at",
+"    quantiles of X, so each interval holds the same number of points.",
+"    They can instead be given with -k, or spread evenly over a range",
+"    with -x. In those two cases the table is streamed rather than",
+"    loaded, so there is no limit on its length; points outside the",
+"    breakpoints are skipped.",
+"",
+"    The output is two lines: the breakpoints and the n+3 coefficients.",
+"    With -v the coefficients are followed by their covariance matrix,",
+"    chisq and the reduced chisq, all as comment lines.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+/* The fit. Band storage: A[i*ORDER + d] holds element (i, i+d) of the
+ * symmetric normal matrix, and after factorization L[i*ORDER + d] holds
+ * element (i+d, i) of its Cholesky factor. */
+struct spline {
+    int nbreak;
+    double *b;      /* breakpoints */
+    int ncoef;
+    double *A;
+    double *rhs;
+    double yy;
+    long n;
+};
+
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return((x > y) - (x < y));
+}
+
+/* Find the interval holding x and the four nonzero basis functions there
+ * (Cox-de Boor recursion). Returns the index of the first coefficient they
+ * multiply, or -1 if x is outside the breakpoints. */
+static int basis(const struct spline *sp, double x, double *N)
+{
+    const int L = sp->nbreak - 1;
+    double left[ORDER], right[ORDER], saved, temp;
+    int lo = 0, hi = L, l;
+
+    if (x < sp->b[0] || x > sp->b[L])
+        return(-1);
+    while (hi - lo > 1) {
+        int mid = (lo + hi)/2;
+        if (x < sp->b[mid])
+            hi = mid;
+        else
+            lo = mid;
+    }
+    l = lo;
+
+    /* Knot t[l+3+j] is b[l+j] clamped to the ends */
+    #define T(k) (sp->b[(k) < 0 ? 0 : ((k) > L ? L : (k))])
+    N[0] = 1.0;
+    for (int j = 1; j < ORDER; j++) {
+        left[j] = x - T(l + 1 - j);
+        right[j] = T(l + j) - x;
+        saved = 0.0;
+        for (int r = 0; r < j; r++) {
+            temp = N[r]/(right[r + 1] + left[j - r]);
+            N[r] = saved + right[r + 1]*temp;
+            saved = left[j - r]*temp;
+        }
+        N[j] = saved;
+    }
+    #undef T
+    return(l);
+}
+
+static void accumulate(struct spline *sp, double x, double y, double w)
+{
+    double N[ORDER];
+    int l = basis(sp, x, N);
+
+    if (l < 0)
+        return;
+    for (int a = 0; a < ORDER; a++) {
+        for (int c = a; c < ORDER; c++)
+            sp->A[(l + a)*ORDER + c - a] += w*N[a]*N[c];
+        sp->rhs[l + a] += w*N[a]*y;
+    }
+    sp->yy += w*y*y;
+    sp->n++;
+}
+
+/* Banded Cholesky factorization, in place. Returns the first column that
+ * is not positive definite (plus one), or 0. */
+static int factor(double *A, int n)
+{
+    #define L(i,k) A[(k)*ORDER + (i) - (k)]
+    for (int j = 0; j < n; j++) {
+        double s = L(j, j);
+        for (int k = (j >= ORDER ? j - ORDER + 1 : 0); k < j; k++)
+            s -= L(j, k)*L(j, k);
+        if (s <= 0.0)
+            return(j + 1);
+        L(j, j) = sqrt(s);
+        for (int i = j + 1; i < n && i < j + ORDER; i++) {
+            s = L(i, j);
+            for (int k = (i >= ORDER ? i - ORDER + 1 : 0); k < j; k++)
+                s -= L(i, k)*L(j, k);
+            L(i, j) = s/L(j, j);
+        }
+    }
+    return(0);
+}
+
+/* Solve L L^T c = r for c, overwriting r */
+static void solve(const double *A, int n, double *r)
+{
+    for (int i = 0; i < n; i++) {
+        for (int k = (i >= ORDER ? i - ORDER + 1 : 0); k < i; k++)
+            r[i] -= L(i, k)*r[k];
+        r[i] /= L(i, i);
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        for (int k = i + 1; k < n && k < i + ORDER; k++)
+            r[i] -= L(k, i)*r[k];
+        r[i] /= L(i, i);
+    }
+    #undef L
+}
+
+static int parse_list(const char *s, double *v, int max)
+{
+    int n = 0;
+    char *end;
+
+    while (n < max) {
+        v[n++] = strtod(s, &end);
+        if (end == s)
+            return(-1);
+        if (*end != ',')
+            break;
+        s = end + 1;
+    }
+    return(*end == '\0' ? n : -1);
+}
+
+
+int main (int argc, char **argv)
+{
+    struct spline sp = {0, NULL, 0, NULL, NULL, 0.0, 0};
+    char *colnames[3];
+    int col[3] = {-1, -1, -1};
+    int ncol = 0;
+    double values[3];
+    double range[2];
+    double *x = NULL, *y = NULL, *w = NULL;
+    double *c, chisq;
+    long nrow = 0, nalloc = 0;
+    int nint = 10;
+    int has_range = 0;
+    int verbose = 0;
+    int has_uncertainties;
+    int stream;
+    int narg, status, c_;
+
+    sp.b = (double *) malloc(MAXKNOT*sizeof(double));
+    while ((c_ = getopt (argc, argv, "vhn:k:x:")) != -1)
+        switch (c_)
+        {
+            case 'n':
+                nint = atoi(optarg);
+                if (nint < 1 || nint >= MAXKNOT) {
+                    fprintf(stderr,"The number of intervals must be between 1 and %d\n", MAXKNOT - 1);
+                    return(1);
+                }
+                break;
+            case 'k':
+                sp.nbreak = parse_list(optarg, sp.b, MAXKNOT);
+                if (sp.nbreak < 2) {
+                    fprintf(stderr,"At least two breakpoints are needed\n");
+                    return(1);
+                }
+                for (int i = 1; i < sp.nbreak; i++)
+                    if (sp.b[i] <= sp.b[i-1]) {
+                        fprintf(stderr,"Breakpoints must increase\n");
+                        return(1);
+                    }
+                break;
+            case 'x':
+                if (parse_list(optarg, range, 2) != 2 || range[1] <= range[0]) {
+                    fprintf(stderr,"Range must be given as a,b with a < b\n");
+                    return(1);
+                }
+                has_range = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'c')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    narg = argc - optind;
+    if (narg != 2 && narg != 3)
+    {
+        print_help();
+        return(1);
+    }
+    for (int i = 0; i < narg; i++)
+        colnames[i] = argv[optind + i];
+    has_uncertainties = (narg == 3);
+    if (has_range && !sp.nbreak) {
+        sp.nbreak = nint + 1;
+        for (int i = 0; i <= nint; i++)
+            sp.b[i] = range[0] + (range[1] - range[0])*i/nint;
+    }
+    stream = (sp.nbreak > 0);
+
+    /* LOAD (OR STREAM) THE DATA */
+    if (stream) {
+        sp.ncoef = sp.nbreak + 2;
+        sp.A = (double *) calloc(sp.ncoef*ORDER, sizeof(double));
+        sp.rhs = (double *) calloc(sp.ncoef, sizeof(double));
+    }
+    while ((status = read_row(narg, colnames, col, &ncol, values)) == 1) {
+        double wi = has_uncertainties ? 1.0/(values[2]*values[2]) : 1.0;
+        if (stream) {
+            accumulate(&sp, values[0], values[1], wi);
+            nrow++;
+            continue;
+        }
+        if (nrow == nalloc) {
+            nalloc = nalloc ? 2*nalloc : 65536;
+            x = (double *) realloc(x, sizeof(double)*nalloc);
+            y = (double *) realloc(y, sizeof(double)*nalloc);
+            w = (double *) realloc(w, sizeof(double)*nalloc);
+        }
+        x[nrow] = values[0];
+        y[nrow] = values[1];
+        w[nrow] = wi;
+        nrow++;
+    }
+    if (status < 0 || nrow == 0)
+    {
+        fprintf(stderr,"Error reading data table.\n");
+        exit(1);
+    }
+
+    /* Breakpoints at quantiles of x, dropping any that coincide */
+    if (!stream) {
+        double *xs = (double *) malloc(sizeof(double)*nrow);
+        memcpy(xs, x, sizeof(double)*nrow);
+        qsort(xs, nrow, sizeof(double), compare_doubles);
+        sp.b[0] = xs[0];
+        sp.nbreak = 1;
+        for (int i = 1; i <= nint; i++) {
+            double q = (i == nint) ? xs[nrow - 1] : xs[(long) ((double) i*nrow/nint)];
+            if (q > sp.b[sp.nbreak - 1])
+                sp.b[sp.nbreak++] = q;
+        }
+        free(xs);
+        if (sp.nbreak < 2) {
+            fprintf(stderr,"X does not vary, so no spline can be fitted.\n");
+            exit(1);
+        }
+        sp.ncoef = sp.nbreak + 2;
+        sp.A = (double *) calloc(sp.ncoef*ORDER, sizeof(double));
+        sp.rhs = (double *) calloc(sp.ncoef, sizeof(double));
+        for (long i = 0; i < nrow; i++)
+            accumulate(&sp, x[i], y[i], w[i]);
+        free(x);
+        free(y);
+        free(w);
+    }
+    if (sp.n < nrow && verbose)
+        printf("# %ld of %ld points lie outside the breakpoints and were skipped\n", nrow - sp.n, nrow);
+
+    /* EXECUTE THE FIT */
+    if ((status = factor(sp.A, sp.ncoef))) {
+        fprintf(stderr,"Too few points to constrain coefficient %d; use fewer breakpoints.\n", status - 1);
+        exit(1);
+    }
+    c = (double *) malloc(sp.ncoef*sizeof(double));
+    memcpy(c, sp.rhs, sp.ncoef*sizeof(double));
+    solve(sp.A, sp.ncoef, c);
+    chisq = sp.yy;
+    for (int i = 0; i < sp.ncoef; i++)
+        chisq -= c[i]*sp.rhs[i];
+    if (chisq < 0.0)
+        chisq = 0.0;
+
+    if (verbose) {
+        printf("# breakpoints:");
+        for (int i = 0; i < sp.nbreak; i++)
+            printf(" %g", sp.b[i]);
+        printf("\n");
+        printf("# coefficients:");
+        for (int i = 0; i < sp.ncoef; i++)
+            printf(" %g", c[i]);
+        printf("\n");
+
+        /* The covariance is the inverse of the normal matrix, one column
+         * at a time */
+        double *e = (double *) malloc(sp.ncoef*sizeof(double));
+        printf("# covariance matrix:\n");
+        for (int j = 0; j < sp.ncoef; j++) {
+            memset(e, 0, sp.ncoef*sizeof(double));
+            e[j] = 1.0;
+            solve(sp.A, sp.ncoef, e);
+            for (int i = 0; i < sp.ncoef; i++)
+                printf("%+.5e ", e[i]);
+            printf("\n");
+        }
+        free(e);
+
+        printf("# chisq = %g\n", chisq);
+        printf("# chisq_nu = %g\n", chisq/(sp.n - sp.ncoef));
+    }
+    else {
+        for (int i = 0; i < sp.nbreak; i++)
+            printf("%.10g ", sp.b[i]);
+        printf("\n");
+        for (int i = 0; i < sp.ncoef; i++)
+            printf("%.10g ", c[i]);
+        printf("\n");
+    }
+
+    free(c);
+    free(sp.A);
+    free(sp.rhs);
+    free(sp.b);
+    return 0;
+}
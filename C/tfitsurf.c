@@ -3,8 +3,13 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <math.h>
+#include <gsl/gsl_math.h>
 #include <gsl/gsl_multifit.h>
 #include "table.h"
+#include "resample.h"
+#include "robust.h"
+#include "crossval.h"
+#include "linsolve.h"
 
 #define MAXROW 100000
 
@@ -17,13 +22,43 @@ char   *help[] = {
 "    tfitsurf [OPTIONS] xcol ycol zcol [sigma_col] < table.txt",
 "",
 "OPTIONS",
+"    -B n          Estimate uncertainties from n bootstrap replicates",
+"    -M            Make the -B replicates by adding gaussian noise to Z rather than by resampling the points",
+"    -S seed       Random number seed for -B [default 1]",
 "    -n            Order of the polynomial (0=constant, 1=ramp, 2=paraboloid, 3=bicubic) [default 1]", 
+"    -N max        Choose the order from 0 to max (max <= 3) by cross validation or -s",
+"    -s name       Criterion for -N: cv, aic or bic [default cv]",
+"    -k n          Number of cross-validation folds for -N [default 5]",
+"    -l name       Least-squares solver: auto, cholesky, qr or svd [default auto]",
+"    -r name       Fit robustly with the named estimator: huber, tukey or clip",
+"    -t k          Tuning constant for -r [default 1.345 for huber, 4.685 for tukey, 3 for clip]",
 "    -h            Print help",
 "    -v            Verbose mode", 
 "",
 "DESCRIPTION",
 "    This program fits a polynomial to a set of X,Y,Z data points.",
 "",
+"    With -B the fit is repeated on n resampled copies of the data and the",
+"    central 68% interval of each coefficient over the copies is added to",
+"    the output. The copies either draw the points with replacement (a",
+"    bootstrap) or, with -M, add gaussian noise to Z with the uncertainty",
+"    given in sigma_col (or the rms residual of the fit if there is none).",
+"    Each copy is made from its own random number stream, so the answer",
+"    depends on the seed but not on the number of threads.",
+"",
+"    The fit is solved by Cholesky, QR or SVD according to its estimated",
+"    condition number, as in tfitpoly, unless a solver is forced with -l.",
+"    The output records the solver used and the condition number.",
+"",
+"    With -N every order up to max is scored, as in tfitpoly -N, and the",
+"    best is fitted. The output then also records the criterion and the",
+"    score of each order.",
+"",
+"    With -r outliers (cosmic rays, blended stars) are down-weighted by",
+"    iteratively reweighted least squares, as in tfitpoly -r. The output",
+"    then also records the estimator, the number of passes, the residual",
+"    scale and the number of points given less than half weight.",
+"",
 "AUTHOR",
 "    Roberto Abraham (abraham@astro.utoronto.ca)",
 "",
@@ -72,10 +107,62 @@ int main (int argc, char **argv)
     int use_sigma_map = 0;
     int has_uncertainties = 0;
     int extra_verbose = 0;
-
-    while ((c = getopt (argc, argv, "vn:o:h")) != -1)
+    long nboot = 0;
+    unsigned long seed = 1;
+    int montecarlo = 0;
+    double *lo = NULL, *hi = NULL;
+    long nok = 0;
+    struct robust robust = {ROBUST_NONE, 0.0, 100};
+    double tune = 0.0;
+    int maxorder = -1;
+    int criterion = CROSSVAL_CV;
+    int nfold = 5;
+    double score[4];
+    struct linsolve solver = {LINSOLVE_AUTO};
+
+    while ((c = getopt (argc, argv, "vn:o:hMB:S:r:t:N:s:k:l:")) != -1)
         switch (c)
         {
+            case 'l':
+                if ((solver.method = linsolve_method(optarg)) < 0) {
+                    fprintf(stderr,"Unknown solver %s.\n", optarg);
+                    return(1);
+                }
+                break;
+            case 'N':
+                maxorder = atoi(optarg);
+                if (maxorder >= 4) {
+                    fprintf(stderr,"Order must be less than or equal to 3\n");
+                    abort();
+                }
+                break;
+            case 's':
+                if ((criterion = crossval_criterion(optarg)) < 0) {
+                    fprintf(stderr,"Unknown order selection criterion %s.\n", optarg);
+                    return(1);
+                }
+                break;
+            case 'k':
+                nfold = atoi(optarg);
+                break;
+            case 'r':
+                if (robust_method(optarg, &robust)) {
+                    fprintf(stderr,"Unknown robust estimator %s.\n", optarg);
+                    return(1);
+                }
+                break;
+            case 't':
+                tune = atof(optarg);
+                break;
+            case 'B':
+                nboot = atol(optarg);
+                break;
+            case 'M':
+                montecarlo = 1;
+                break;
+            case 'S':
+                seed = strtoul(optarg, NULL, 10);
+                break;
             case 'v':
                 verbose = 1;
                 break;
@@ -110,6 +197,12 @@ int main (int argc, char **argv)
 
     /* Handle non-option arguments */
     narg = argc - optind;
+    if (tune > 0.0)
+        robust.tune = tune;
+    if (robust.method != ROBUST_NONE && nboot > 0) {
+        fprintf(stderr,"Robust fits (-r) cannot be combined with -B.\n");
+        return(1);
+    }
     if (narg == 3) 
     { 
         sscanf(argv[optind++],"%s",xcolname);
@@ -165,6 +258,46 @@ int main (int argc, char **argv)
     }
 
 
+    /* Choose the order. The candidates share one design matrix, with the
+     * term x^i y^j in column i + (maxorder+1)*j, and order m keeps the
+     * terms with i,j <= m. x and y are centred and scaled first, which
+     * keeps the normal equations well conditioned without changing the
+     * fits. The fits below have unit weights, so these do too. */
+    if (maxorder >= 0) {
+        int np = (maxorder + 1)*(maxorder + 1);
+        int *use = (int *) malloc((maxorder + 1)*np*sizeof(int));
+
+        if (criterion == CROSSVAL_CV && (nfold < 2 || nfold > nrow)) {
+            fprintf(stderr,"The number of folds must be between 2 and the number of rows.\n");
+            exit(1);
+        }
+        double x0, dx, y0, dy;
+
+        crossval_scale(x, nrow, &x0, &dx);
+        crossval_scale(y, nrow, &y0, &dy);
+        X = gsl_matrix_alloc(nrow, np);
+        zvec = gsl_vector_alloc(nrow);
+        sigvec = gsl_vector_alloc(nrow);
+        for (i = 0; i < nrow; i++) {
+            gsl_vector_set(zvec, i, z[i]);
+            gsl_vector_set(sigvec, i, 1.0);
+            for (j = 0; j <= maxorder; j++)
+                for (int k = 0; k <= maxorder; k++)
+                    gsl_matrix_set(X, i, k + (maxorder + 1)*j,
+                                   pow((x[i] - x0)/dx,k)*pow((y[i] - y0)/dy,j));
+        }
+        for (int m = 0; m <= maxorder; m++)
+            for (j = 0; j <= maxorder; j++)
+                for (int k = 0; k <= maxorder; k++)
+                    use[m*np + k + (maxorder + 1)*j] = j <= m && k <= m;
+        order = crossval_select(X, sigvec, zvec, maxorder + 1, use, criterion, nfold, 0, score);
+        gsl_matrix_free(X);
+        gsl_vector_free(zvec);
+        gsl_vector_free(sigvec);
+        free(use);
+    }
+
+
     /* Now do the heavy lifting! */
 
     /* Define the number of parameters */
@@ -278,10 +411,23 @@ int main (int argc, char **argv)
 
 
     // Compute the answer
-    {
-        gsl_multifit_linear_workspace *work = gsl_multifit_linear_alloc(nrow, npar);
-        gsl_multifit_wlinear(X, sigvec, zvec, cvec, cov, &chisq, work);
-        gsl_multifit_linear_free(work);
+    if (robust.method != ROBUST_NONE) {
+        if (robust_fit(X, zvec, sigvec, &robust, &solver, cvec, cov, &chisq))
+            fprintf(stderr,"Warning: robust fit stopped after %d passes, when the %s solver failed.\n",
+                    robust.iter, linsolve_name(solver.used));
+    }
+    else if (linsolve_fit(&solver, X, sigvec, zvec, cvec, cov, &chisq))
+        fprintf(stderr,"Warning: the %s solver failed.\n", linsolve_name(solver.used));
+
+
+    // Resampled uncertainties
+    if (nboot > 0) {
+        lo = (double *) malloc(npar*sizeof(double));
+        hi = (double *) malloc(npar*sizeof(double));
+        if (montecarlo && !has_uncertainties)
+            for (i = 0; i < nrow; i++)
+                s[i] = sqrt(chisq/(nrow - npar));
+        nok = resample_linear(X, sigvec, zvec, s, &solver, nboot, seed, montecarlo, 0.6827, lo, hi);
     }
 
 
@@ -344,6 +490,45 @@ int main (int argc, char **argv)
     }
     printf("    ],\n");
 
+    if (nboot > 0) {
+        printf("  \"resampling\": \"%s\",\n", montecarlo ? "monte carlo" : "bootstrap");
+        printf("  \"replicates\": %ld,\n", nok);
+        printf("  \"intervals_68\": [");
+        for (i=0;i<npar;i++){
+            printf("[%.10g, %.10g]",lo[i],hi[i]);
+            if (i<(npar-1))
+                printf(", ");
+        }
+        printf("],\n");
+    }
+
+    if (maxorder >= 0) {
+        printf("  \"order_selection\": \"%s\",\n", crossval_name(criterion));
+        if (criterion == CROSSVAL_CV)
+            printf("  \"folds\": %d,\n", nfold);
+        printf("  \"order_scores\": [");
+        for (i=0;i<=maxorder;i++){
+            if (gsl_finite(score[i]))
+                printf("%.10g",score[i]);
+            else
+                printf("null");
+            if (i<maxorder)
+                printf(", ");
+        }
+        printf("],\n");
+    }
+
+    printf("  \"solver\": \"%s\",\n", linsolve_name(solver.used));
+    if (gsl_finite(solver.cond))
+        printf("  \"condition_number\": %g,\n", solver.cond);
+    if (robust.method != ROBUST_NONE) {
+        printf("  \"robust\": \"%s\",\n", robust_name(&robust));
+        printf("  \"robust_tune\": %g,\n", robust.tune);
+        printf("  \"robust_passes\": %d,\n", robust.iter);
+        printf("  \"robust_scale\": %g,\n", robust.scale);
+        printf("  \"robust_downweighted\": %ld,\n", robust.nlow);
+    }
+
     if (has_uncertainties)
         printf("  \"axes\": [\"%s\",\"%s\",\"%s\",\"%s\"],\n",xcolname,ycolname,zcolname,scolname);
     else
@@ -403,6 +588,8 @@ int main (int argc, char **argv)
     gsl_vector_free (sigvec);
     gsl_vector_free (cvec);
     gsl_matrix_free (cov);
+    free(lo);
+    free(hi);
 
     return 0;
 }
@@ -0,0 +1,755 @@
+// Histograms of one column, or density maps of two, in one streaming pass.
+// The rows of each block are binned in parallel into one histogram per
+// thread, and these are summed at the end.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <fitsio.h>
+#include "table.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define BATCH 16384
+#define FINE 65536          /* bins of a histogram whose bins are chosen at the end */
+#define OVERSAMPLE 4        /* the same, per requested bin of a map */
+#define MAXBINS (1L << 28)
+
+char   *help[] = {
+"",
+"NAME",
+"    thist - histogram of a table column, or density map of two",
+"",
+"SYNOPSIS",
+"    % thist [OPTIONS] xcolname [ycolname] < table.txt ",
+"",
+"OPTIONS",
+"    -n nx[,ny]        Number of bins",
+"    -b wx[,wy]        Width of the bins (in dex for log bins)",
+"    -x xmin,xmax      Range of xcolname",
+"    -y ymin,ymax      Range of ycolname",
+"    -a rule           Rule choosing the bins of a histogram: fd, scott",
+"                      or sturges [default fd]",
+"    -l                Bin xcolname logarithmically",
+"    -L                Bin ycolname logarithmically",
+"    -o file.fits      Write a density map as a FITS image",
+"    -h                Print help",
+"",
+"EXAMPLE",
+"    Fit a gaussian to the distribution of a column:",
+"",
+"    % thist MAG_AUTO < cat.txt > hist.txt",
+"    % tfitdist PIXVAL COUNT < hist.txt",
+"",
+"    Make a 512 x 512 map of the density of objects on an image:",
+"",
+"    % thist -n 512 -o density.fits X_IMAGE Y_IMAGE < cat.txt",
+"",
+"DESCRIPTION",
+"",
+"    With one column this program writes a SExtractor-format table of",
+"    the histogram of the column, with the centre of each bin in PIXVAL",
+"    and the number of rows in it in COUNT, which tfitdist can fit.",
+"    With two columns it makes a two-dimensional histogram (a density",
+"    map), written as a FITS image with -o, whose WCS gives the centres",
+"    of the bins, or otherwise as a table of the two bin centres and",
+"    COUNT.",
+"",
+"    The bins are set by",
+"",
+"        -x/-y and -n    that many bins across the range",
+"        -b              bins of that width, starting at the low end",
+"                        of the range or at a multiple of the width",
+"        -n alone        about that many bins across the values",
+"        neither         (histograms) the rule of -a, which is",
+"                        Freedman-Diaconis (2 IQR / N^1/3), Scott",
+"                        (3.49 sigma / N^1/3) or Sturges (log2 N + 1",
+"                        bins); (maps) 256 bins each way",
+"",
+"    Rows outside a range that is given are left out, and counted in a",
+"    #! line of the table. So are rows that are not numbers and, with -l",
+"    or -L, rows that are not positive. Log bins are equal in log10, and",
+"    the PIXVAL of a log bin is the geometric centre of its edges.",
+"",
+"    The table is read once. When the bins are not fixed by the options",
+"    the values are first gathered into a fine histogram (65536 bins, or",
+"    4 for each bin asked for of a map) whose range doubles, merging",
+"    pairs of bins, as values arrive outside it. The bins written are",
+"    whole numbers of these fine bins, so their width is rounded to",
+"    within 1/16384 of the range of the values. Bins of a given width",
+"    grow the histogram at either end instead, and are exact.",
+"",
+"    Each block of rows is parsed and binned by all the threads when",
+"    built with OpenMP, each into its own histogram, so no counts are",
+"    shared between threads until the histograms are summed at the end.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+enum {FIXED, ANCHORED, DOUBLING};
+enum {RULE_FD, RULE_SCOTT, RULE_STURGES};
+
+/* The bins of one axis: bin k covers [lo + k*width, lo + (k+1)*width) in
+ * the binned (possibly log10) values, for 0 <= k < n. A FIXED axis has a
+ * range that was given. An ANCHORED axis has bins of a given width at
+ * multiples of it, and n grows to take in the values. A DOUBLING axis has
+ * n fine bins whose width doubles to take in the values. */
+struct axis {
+    int mode;
+    int log;
+    int started;
+    double lo, width;
+    long n;
+    double dmin, dmax;      /* range of the values binned */
+    long group;             /* fine bins per bin written */
+};
+
+/* One histogram per thread, each n[0] x n[1] */
+struct hist {
+    int nthread;
+    unsigned long **count;
+};
+
+
+static int threads(void)
+{
+#ifdef _OPENMP
+    return(omp_get_max_threads());
+#else
+    return(1);
+#endif
+}
+
+
+static int thread(void)
+{
+#ifdef _OPENMP
+    return(omp_get_thread_num());
+#else
+    return(0);
+#endif
+}
+
+
+/* Move the counts of every thread after axis a (0 or 1) changes, so that
+ * old bin k becomes bin (k + shift)/div of n new bins */
+static void hist_regroup(struct hist *h, long *n, int a, long shift, long div, long newn)
+{
+    long nx = n[0], ny = n[1];
+    long mx = a == 0 ? newn : nx, my = a == 1 ? newn : ny;
+
+    if (mx*my > MAXBINS) {
+        fprintf(stderr,"Too many bins: give a range or wider bins.\n");
+        exit(1);
+    }
+    for (int t = 0; t < h->nthread; t++) {
+        unsigned long *old = h->count[t];
+        unsigned long *c = (unsigned long *) calloc(mx*my, sizeof(unsigned long));
+        for (long j = 0; j < ny; j++)
+            for (long i = 0; i < nx; i++) {
+                unsigned long v = old[j*nx + i];
+                long ii = i, jj = j;
+                if (!v)
+                    continue;
+                if (a == 0)
+                    ii = (i + shift)/div;
+                else
+                    jj = (j + shift)/div;
+                c[jj*mx + ii] += v;
+            }
+        free(old);
+        h->count[t] = c;
+    }
+    n[a] = newn;
+}
+
+
+/* Bin of v on an axis, or -1 if it is outside */
+static long axis_bin(const struct axis *a, double v)
+{
+    double f = (v - a->lo)/a->width;
+    long k;
+
+    if (!(f >= 0.0))
+        return(-1);
+    if (a->mode == FIXED) {
+        /* The top of a given range belongs to the last bin */
+        if (v > a->dmax)
+            return(-1);
+        k = (long) f;
+        return(k < a->n ? k : a->n - 1);
+    }
+    k = (long) f;
+    return(k < a->n ? k : -1);
+}
+
+
+/* Make axis a (0 or 1) take in the values from bmin to bmax */
+static void axis_cover(struct axis *ax, int a, double bmin, double bmax, struct hist *h, long *n)
+{
+    if (ax->mode == FIXED)
+        return;
+
+    if (!ax->started) {
+        if (ax->mode == ANCHORED) {
+            ax->lo = floor(bmin/ax->width)*ax->width;
+            hist_regroup(h, n, a, 0, 1, (long) floor((bmax - ax->lo)/ax->width) + 1);
+            ax->n = n[a];
+        }
+        else {
+            double span = bmax - bmin;
+            if (!(span > 0))
+                span = bmin != 0 ? fabs(bmin)*1e-6 : 1e-6;
+            ax->lo = bmin - 0.25*span;
+            ax->width = 1.5*span/ax->n;
+            while (!(ax->lo + ax->n*ax->width > bmax))
+                ax->width *= 2;
+        }
+        ax->dmin = bmin;
+        ax->dmax = bmax;
+        ax->started = 1;
+        return;
+    }
+
+    if (ax->mode == ANCHORED) {
+        /* Add bins at either end, with room for more */
+        long kmin = (long) floor((bmin - ax->lo)/ax->width);
+        long kmax = (long) floor((bmax - ax->lo)/ax->width);
+        if (kmin < 0 || kmax >= ax->n) {
+            long below = kmin < 0 ? -kmin + ax->n/2 : 0;
+            long above = kmax >= ax->n ? kmax - ax->n + 1 + ax->n/2 : 0;
+            hist_regroup(h, n, a, below, 1, ax->n + below + above);
+            ax->lo -= below*ax->width;
+            ax->n = n[a];
+        }
+    }
+    else {
+        /* Double the bins, leaving room on the side that overflowed */
+        for (;;) {
+            double lo = bmin < ax->dmin ? bmin : ax->dmin;
+            double hi = bmax > ax->dmax ? bmax : ax->dmax;
+            double smin, smax;
+            long shift;
+            if (lo >= ax->lo && hi < ax->lo + ax->n*ax->width)
+                break;
+            smin = ceil((ax->lo - lo)/ax->width);
+            smax = floor((ax->lo + 2*ax->n*ax->width - hi)/ax->width);
+            if (smin < 0)
+                smin = 0;
+            if (smax > ax->n)
+                smax = ax->n;
+            if (smin <= smax)
+                shift = (long) (lo < ax->lo ? smax : smin);
+            else
+                shift = lo < ax->lo ? ax->n : 0;
+            hist_regroup(h, n, a, shift, 2, ax->n);
+            ax->lo -= shift*ax->width;
+            ax->width *= 2;
+        }
+    }
+    if (bmin < ax->dmin)
+        ax->dmin = bmin;
+    if (bmax > ax->dmax)
+        ax->dmax = bmax;
+}
+
+
+/* Quantile q of the values from the counts of a fine axis */
+static double fine_quantile(const unsigned long *c, const struct axis *ax, unsigned long total, double q)
+{
+    double target = q*total, sum = 0.0;
+
+    for (long k = 0; k < ax->n; k++) {
+        if (sum + c[k] >= target && c[k] > 0)
+            return(ax->lo + (k + (target - sum)/c[k])*ax->width);
+        sum += c[k];
+    }
+    return(ax->lo + ax->n*ax->width);
+}
+
+
+/* Choose how many fine bins of a DOUBLING (or FIXED and fine) axis go in
+ * each bin written: to give about nbins bins, or by a rule from the
+ * marginal counts c */
+static void axis_group(struct axis *ax, long nbins, int rule, const unsigned long *c)
+{
+    long k0 = axis_bin(ax, ax->dmin), k1 = axis_bin(ax, ax->dmax);
+    unsigned long total = 0;
+    double h = 0.0;
+
+    if (ax->mode == FIXED) {
+        k0 = 0;
+        k1 = ax->n - 1;
+    }
+    if (k0 < 0) k0 = 0;
+    if (k1 < 0) k1 = ax->n - 1;
+    for (long k = 0; k < ax->n; k++)
+        total += c[k];
+
+    if (nbins <= 0 && total > 1) {
+        if (rule == RULE_FD) {
+            double iqr = fine_quantile(c, ax, total, 0.75) - fine_quantile(c, ax, total, 0.25);
+            h = 2.0*iqr/cbrt((double) total);
+        }
+        else if (rule == RULE_SCOTT) {
+            double mean = 0.0, var = 0.0;
+            for (long k = 0; k < ax->n; k++)
+                mean += c[k]*(ax->lo + (k + 0.5)*ax->width);
+            mean /= total;
+            for (long k = 0; k < ax->n; k++) {
+                double d = ax->lo + (k + 0.5)*ax->width - mean;
+                var += c[k]*d*d;
+            }
+            h = 3.49*sqrt(var/total)/cbrt((double) total);
+        }
+        if (!(h > 0))
+            nbins = (long) ceil(log2((double) total)) + 1;
+    }
+    if (nbins > 0)
+        ax->group = (k1 - k0 + 1 + nbins - 1)/nbins;
+    else
+        ax->group = (long) floor(h/ax->width + 0.5);
+    if (ax->group < 1)
+        ax->group = 1;
+}
+
+
+/* Read the wanted fields of a line; returns 0 if the line is a comment or
+ * empty, and sets a value to NAN if it is not a number */
+static int parse_row(const char *s, size_t len, const int *col, int ncols, int maxcol, double *v)
+{
+    const char *end = s + len;
+    int found = 0;
+
+    if (s[0] == '#')
+        return(0);
+    v[0] = v[1] = NAN;
+    for (int c = 0; c <= maxcol; c++) {
+        const char *t;
+        while (s < end && isspace((unsigned char) *s))
+            s++;
+        if (s == end)
+            break;
+        t = s;
+        while (s < end && !isspace((unsigned char) *s))
+            s++;
+        found = 1;
+        for (int k = 0; k < ncols; k++)
+            if (col[k] == c) {
+                char *stop;
+                double x = strtod(t, &stop);
+                v[k] = (stop == s && isfinite(x)) ? x : NAN;
+            }
+    }
+    return(found);
+}
+
+
+static int parse_pair(const char *s, double *a, double *b)
+{
+    return(sscanf(s, "%lf,%lf", a, b) == 2);
+}
+
+
+/* Centre of written bin j of an axis, in the units of the column */
+static double bin_centre(const struct axis *ax, long first, long j)
+{
+    double lo = ax->lo + (first + j*ax->group)*ax->width;
+    double c = lo + 0.5*ax->group*ax->width;
+    return(ax->log ? pow(10.0, c) : c);
+}
+
+
+static int write_fits(const char *file, const long long *map, long nx, long ny,
+                      const struct axis *ax, const long *first, char **colnames)
+{
+    fitsfile *fptr;
+    int status = 0;
+    long naxes[2];
+    char ctype[FLEN_VALUE], name[FLEN_FILENAME];
+
+    naxes[0] = nx;
+    naxes[1] = ny;
+    snprintf(name, sizeof(name), "!%s", file);
+    fits_create_file(&fptr, name, &status);
+    fits_create_img(fptr, LONGLONG_IMG, 2, naxes, &status);
+    for (int a = 0; a < 2; a++) {
+        char key[FLEN_KEYWORD];
+        double crval = ax[a].lo + (first[a] + 0.5*ax[a].group)*ax[a].width;
+        double cdelt = ax[a].group*ax[a].width;
+        if (ax[a].log)
+            snprintf(ctype, sizeof(ctype), "LOG10(%s)", colnames[a]);
+        else
+            snprintf(ctype, sizeof(ctype), "%s", colnames[a]);
+        snprintf(key, sizeof(key), "CTYPE%d", a + 1);
+        fits_update_key(fptr, TSTRING, key, ctype, "Column binned along this axis", &status);
+        snprintf(key, sizeof(key), "CRPIX%d", a + 1);
+        fits_update_key(fptr, TDOUBLE, key, &(double){1.0}, "Reference pixel", &status);
+        snprintf(key, sizeof(key), "CRVAL%d", a + 1);
+        fits_update_key(fptr, TDOUBLE, key, &crval, "Centre of the first bin", &status);
+        snprintf(key, sizeof(key), "CDELT%d", a + 1);
+        fits_update_key(fptr, TDOUBLE, key, &cdelt, "Width of a bin", &status);
+    }
+    fits_update_key(fptr, TSTRING, "BUNIT", "COUNT", "Number of rows in each bin", &status);
+    fits_write_img(fptr, TLONGLONG, 1, nx*ny, (void *) map, &status);
+    fits_close_file(fptr, &status);
+    if (status)
+        fits_report_error(stderr, status);
+    return(status);
+}
+
+
+int main (int argc, char **argv)
+{
+    struct reader r;
+    const char *line[BATCH];
+    size_t len[BATCH];
+    char **keyword = NULL;
+    int *number = NULL;
+    int nheader = 0, hsize = 0;
+    char **colnames;
+    int col[2], ncols, maxcol = -1;
+    int resolved = 0;
+    long nbins[2] = {0, 0};
+    double bwidth[2] = {0.0, 0.0}, range[2][2];
+    int has_range[2] = {0, 0}, logax[2] = {0, 0};
+    int rule = RULE_FD;
+    char *outfile = NULL;
+    struct axis ax[2];
+    struct hist h;
+    long n[2], first[2], nw[2];
+    double *v;
+    unsigned long nbad = 0, nout = 0, nbinned = 0;
+    unsigned long *total;
+    int nn, c;
+
+    while ((c = getopt (argc, argv, "n:b:x:y:a:lLo:h")) != -1)
+        switch (c)
+        {
+            case 'n':
+                if (sscanf(optarg, "%ld,%ld", &nbins[0], &nbins[1]) == 1)
+                    nbins[1] = nbins[0];
+                break;
+            case 'b':
+                if (sscanf(optarg, "%lf,%lf", &bwidth[0], &bwidth[1]) == 1)
+                    bwidth[1] = bwidth[0];
+                break;
+            case 'x':
+                if (!(has_range[0] = parse_pair(optarg, &range[0][0], &range[0][1]))) {
+                    fprintf(stderr,"Range must be given as min,max.\n");
+                    return(1);
+                }
+                break;
+            case 'y':
+                if (!(has_range[1] = parse_pair(optarg, &range[1][0], &range[1][1]))) {
+                    fprintf(stderr,"Range must be given as min,max.\n");
+                    return(1);
+                }
+                break;
+            case 'a':
+                if (!strcmp(optarg, "fd"))
+                    rule = RULE_FD;
+                else if (!strcmp(optarg, "scott"))
+                    rule = RULE_SCOTT;
+                else if (!strcmp(optarg, "sturges"))
+                    rule = RULE_STURGES;
+                else {
+                    fprintf(stderr,"Unknown rule %s.\n",optarg);
+                    return(1);
+                }
+                break;
+            case 'l':
+                logax[0] = 1;
+                break;
+            case 'L':
+                logax[1] = 1;
+                break;
+            case 'o':
+                outfile = optarg;
+                break;
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'n' || optopt == 'b' || optopt == 'x' || optopt == 'y'
+                    || optopt == 'a' || optopt == 'o')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    ncols = argc - optind;
+    if (ncols < 1 || ncols > 2)
+    {
+        print_help();
+        return(1);
+    }
+    if (outfile && ncols != 2) {
+        fprintf(stderr,"-o needs two columns.\n");
+        return(1);
+    }
+    colnames = argv + optind;
+
+    /* Set up the axes */
+    for (int a = 0; a < 2; a++) {
+        struct axis *x = &ax[a];
+
+        memset(x, 0, sizeof(struct axis));
+        x->log = logax[a];
+        x->group = 1;
+        if (a >= ncols) {
+            x->mode = FIXED;
+            x->n = 1;
+            x->width = 1.0;
+            continue;
+        }
+        if (nbins[a] < 0 || bwidth[a] < 0 || (nbins[a] > 0 && bwidth[a] > 0)) {
+            fprintf(stderr,"Give either a number of bins or a width, and not both.\n");
+            return(1);
+        }
+        if (has_range[a]) {
+            double lo = fmin(range[a][0], range[a][1]), hi = fmax(range[a][0], range[a][1]);
+            if (x->log && !(lo > 0)) {
+                fprintf(stderr,"A logarithmic range must be positive.\n");
+                return(1);
+            }
+            x->mode = FIXED;
+            x->started = 1;
+            x->lo = x->log ? log10(lo) : lo;
+            x->dmin = x->lo;
+            x->dmax = x->log ? log10(hi) : hi;
+            if (!(x->dmax > x->lo)) {
+                fprintf(stderr,"A range must not be empty.\n");
+                return(1);
+            }
+            if (bwidth[a] > 0)
+                x->n = (long) ceil((x->dmax - x->lo)/bwidth[a]);
+            else
+                x->n = nbins[a] > 0 ? nbins[a] : (ncols == 1 ? FINE : OVERSAMPLE*256);
+            x->width = bwidth[a] > 0 ? bwidth[a] : (x->dmax - x->lo)/x->n;
+        }
+        else if (bwidth[a] > 0) {
+            x->mode = ANCHORED;
+            x->width = bwidth[a];
+            x->n = 0;
+        }
+        else {
+            x->mode = DOUBLING;
+            x->n = ncols == 1 ? FINE : OVERSAMPLE*(nbins[a] > 0 ? nbins[a] : 256);
+        }
+    }
+    n[0] = ax[0].n;
+    n[1] = ax[1].n;
+    h.nthread = threads();
+    h.count = (unsigned long **) malloc(h.nthread*sizeof(unsigned long *));
+    for (int t = 0; t < h.nthread; t++)
+        h.count[t] = (unsigned long *) calloc(n[0]*n[1] + 1, sizeof(unsigned long));
+    v = (double *) malloc(2*BATCH*sizeof(double));
+
+    reader_init(&r, stdin);
+    while ((nn = reader_lines(&r, line, len, BATCH)) > 0) {
+        int start = 0;
+        double bmin[2], bmax[2];
+        double bmin0 = INFINITY, bmin1 = INFINITY, bmax0 = -INFINITY, bmax1 = -INFINITY;
+        unsigned long bad = 0, out = 0, binned = 0;
+
+        /* Header lines can only come before the first data row */
+        if (!resolved) {
+            for (; start < nn; start++) {
+                char name[1024];
+                size_t at;
+                if (line[start][0] != '#')
+                    break;
+                if (len[start] > 1 && line[start][1] == '!')
+                    continue;
+                if (nheader == hsize) {
+                    hsize = hsize ? 2*hsize : 64;
+                    keyword = (char **) realloc(keyword, hsize*sizeof(char *));
+                    number = (int *) realloc(number, hsize*sizeof(int));
+                }
+                if (!header_column(line[start], len[start], &number[nheader], name, sizeof(name), &at)
+                    || number[nheader] < 1)
+                    continue;
+                keyword[nheader++] = strdup(name);
+            }
+            if (start == nn)
+                continue;
+            for (int k = 0; k < ncols; k++) {
+                int j;
+                for (j = 0; j < nheader && strcmp(keyword[j], colnames[k]); j++)
+                    ;
+                if (j == nheader) {
+                    fprintf(stderr,"Keyword %s not found.\n",colnames[k]);
+                    exit(1);
+                }
+                col[k] = number[j] - 1;
+                if (col[k] > maxcol)
+                    maxcol = col[k];
+            }
+            resolved = 1;
+        }
+
+        /* Parse the block, finding the range of its values */
+        #pragma omp parallel for schedule(static) reduction(+:bad) \
+            reduction(min:bmin0,bmin1) reduction(max:bmax0,bmax1)
+        for (int i = start; i < nn; i++) {
+            double *vi = v + 2*i;
+            if (!parse_row(line[i], len[i], col, ncols, maxcol, vi)) {
+                vi[0] = INFINITY;
+                continue;
+            }
+            for (int k = 0; k < ncols; k++)
+                if (ax[k].log)
+                    vi[k] = vi[k] > 0 ? log10(vi[k]) : NAN;
+            if (isnan(vi[0]) || (ncols == 2 && isnan(vi[1]))) {
+                vi[0] = NAN;
+                bad++;
+                continue;
+            }
+            if (vi[0] < bmin0) bmin0 = vi[0];
+            if (vi[0] > bmax0) bmax0 = vi[0];
+            if (ncols == 2) {
+                if (vi[1] < bmin1) bmin1 = vi[1];
+                if (vi[1] > bmax1) bmax1 = vi[1];
+            }
+        }
+        bmin[0] = bmin0;
+        bmin[1] = bmin1;
+        bmax[0] = bmax0;
+        bmax[1] = bmax1;
+
+        /* Grow the axes to take in the block before it is binned */
+        if (bmin[0] <= bmax[0])
+            for (int k = 0; k < ncols; k++)
+                axis_cover(&ax[k], k, bmin[k], bmax[k], &h, n);
+
+        #pragma omp parallel reduction(+:out,binned)
+        {
+            unsigned long *cnt = h.count[thread()];
+            #pragma omp for schedule(static)
+            for (int i = start; i < nn; i++) {
+                const double *vi = v + 2*i;
+                long kx, ky = 0;
+                if (!isfinite(vi[0]))
+                    continue;
+                kx = axis_bin(&ax[0], vi[0]);
+                if (ncols == 2)
+                    ky = axis_bin(&ax[1], vi[1]);
+                if (kx < 0 || ky < 0) {
+                    out++;
+                    continue;
+                }
+                cnt[ky*n[0] + kx]++;
+                binned++;
+            }
+        }
+        nbad += bad;
+        nout += out;
+        nbinned += binned;
+    }
+    reader_free(&r);
+
+    if (!nbinned) {
+        fprintf(stderr,"No rows to bin.\n");
+        return(1);
+    }
+
+    /* Sum the histograms of the threads */
+    total = h.count[0];
+    #pragma omp parallel for schedule(static)
+    for (long k = 0; k < n[0]*n[1]; k++)
+        for (int t = 1; t < h.nthread; t++)
+            total[k] += h.count[t][k];
+
+    /* Choose the bins written, as groups of the bins held */
+    for (int a = 0; a < ncols; a++) {
+        struct axis *x = &ax[a];
+        int fine = x->mode == DOUBLING || (x->mode == FIXED && nbins[a] == 0 && bwidth[a] == 0);
+        if (fine) {
+            unsigned long *marg = (unsigned long *) calloc(x->n, sizeof(unsigned long));
+            for (long j = 0; j < n[1]; j++)
+                for (long i = 0; i < n[0]; i++)
+                    marg[a == 0 ? i : j] += total[j*n[0] + i];
+            axis_group(x, ncols == 2 && nbins[a] == 0 ? 256 : nbins[a], rule, marg);
+            free(marg);
+        }
+        if (x->mode == FIXED) {
+            first[a] = 0;
+            nw[a] = (x->n + x->group - 1)/x->group;
+        }
+        else {
+            first[a] = axis_bin(x, x->dmin);
+            nw[a] = (axis_bin(x, x->dmax) - first[a])/x->group + 1;
+        }
+    }
+    if (ncols == 1) {
+        first[1] = 0;
+        nw[1] = 1;
+    }
+
+    {
+        long long *map = (long long *) calloc(nw[0]*nw[1], sizeof(long long));
+
+        for (long j = 0; j < n[1]; j++)
+            for (long i = 0; i < n[0]; i++) {
+                long wi = (i - first[0]), wj = (j - first[1]);
+                if (wi < 0 || wj < 0)
+                    continue;
+                wi /= ax[0].group;
+                wj /= ax[1].group;
+                if (wi < nw[0] && wj < nw[1])
+                    map[wj*nw[0] + wi] += total[j*n[0] + i];
+            }
+
+        if (outfile) {
+            if (write_fits(outfile, map, nw[0], nw[1], ax, first, colnames))
+                return(1);
+        }
+        else if (ncols == 1) {
+            printf("#   1 PIXVAL         Centre of the bin of %s\n", colnames[0]);
+            printf("#   2 COUNT          Number of rows in the bin\n");
+            printf("#! thist: %lu rows binned, %lu outside the range, %lu not numbers\n",
+                   nbinned, nout, nbad);
+            for (long i = 0; i < nw[0]; i++)
+                printf("%.10g %lld\n", bin_centre(&ax[0], first[0], i), map[i]);
+        }
+        else {
+            printf("#   1 %-14s Centre of the bin\n", colnames[0]);
+            printf("#   2 %-14s Centre of the bin\n", colnames[1]);
+            printf("#   3 COUNT          Number of rows in the bin\n");
+            printf("#! thist: %lu rows binned, %lu outside the range, %lu not numbers\n",
+                   nbinned, nout, nbad);
+            for (long j = 0; j < nw[1]; j++)
+                for (long i = 0; i < nw[0]; i++)
+                    printf("%.10g %.10g %lld\n", bin_centre(&ax[0], first[0], i),
+                           bin_centre(&ax[1], first[1], j), map[j*nw[0] + i]);
+        }
+        free(map);
+    }
+
+    return 0;
+}
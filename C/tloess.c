@@ -0,0 +1,488 @@
+// Two-dimensional local regression (LOESS) of scattered data, after
+// Cleveland & Devlin (1988), JASA 83, 596. Neighbors are found with a k-d
+// tree so each evaluation costs O(k log n) rather than O(n).
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "table.h"
+
+#define FALSE 0
+#define TRUE 1
+#define LEAFSIZE 8
+#define MAXPAR 6
+
+char   *help[] = {
+"",
+"NAME",
+"    tloess - smooths a column over the plane of two other columns",
+"",
+"SYNOPSIS",
+"    % tloess [OPTIONS] xcol ycol zcol < table.txt ",
+"",
+"OPTIONS",
+"    -k n     Number of nearest neighbors used in each local fit [default 50]",
+"    -n order Order of the local surface (1=plane, 2=quadratic) [default 1]",
+"    -g NXxNY Evaluate on an NX by NY grid spanning the data instead of at",
+"             the data points (e.g. -g 100x100)",
+"    -s       Output the residuals (data minus smooth) instead of the smooth",
+"    -h       Print help",
+"",
+"DESCRIPTION",
+"",
+"    This program smooths zcol as a function of position (xcol, ycol)",
+"    using locally weighted regression. At each evaluation point the k",
+"    nearest data points are found with a k-d tree, given tricube weights",
+"    in distance, and fit with a plane or a full quadratic surface. Where",
+"    the neighbors are too degenerate to constrain the surface (e.g. all",
+"    on a line) a lower order is used.",
+"",
+"    By default the smooth is evaluated at each data point and the output",
+"    has the columns xcol, ycol, zcol and Smoothed<zcol>. With -g the output",
+"    is a table of xcol, ycol and Smoothed<zcol> on a regular grid, which is",
+"    convenient for maps (e.g. of FWHM over the focal plane). When built",
+"    with OpenMP the evaluations are spread over all available cores.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+struct point {
+    double x;
+    double y;
+    double z;
+};
+
+/* An implicit k-d tree. The points are stored in tree order: the node of
+ * the subarray [lo,hi) is the point at mid = lo + (hi-lo)/2, which splits
+ * the rest of the subarray along axis[mid] (0 for x, 1 for y). */
+struct kdtree {
+    long n;
+    struct point *p;
+    char *axis;
+};
+
+/* Bounded max-heap holding the k nearest points found so far */
+struct heap {
+    long k;
+    long n;
+    double *d2;
+    long *idx;
+};
+
+
+static double coord(const struct point *p, int axis)
+{
+    return(axis ? p->y : p->x);
+}
+
+/* Reorder p[lo..hi-1] so that p[k] is in its sorted place along axis */
+static void select_point(struct point *p, long lo, long hi, long k, int axis)
+{
+    long i, j, mid;
+    double pivot;
+    struct point t;
+
+    #define SWAP(a,b) { t = p[a]; p[a] = p[b]; p[b] = t; }
+    hi--;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (coord(&p[mid],axis) < coord(&p[lo],axis)) SWAP(lo, mid);
+        if (coord(&p[hi],axis) < coord(&p[lo],axis)) SWAP(lo, hi);
+        if (coord(&p[hi],axis) < coord(&p[mid],axis)) SWAP(mid, hi);
+        pivot = coord(&p[mid],axis);
+        i = lo; j = hi;
+        do {
+            while (coord(&p[i],axis) < pivot) i++;
+            while (pivot < coord(&p[j],axis)) j--;
+            if (i <= j) {
+                SWAP(i, j);
+                i++; j--;
+            }
+        } while (i <= j);
+        if (j < k) lo = i;
+        if (k < i) hi = j;
+    }
+    #undef SWAP
+}
+
+static void build(struct kdtree *t, long lo, long hi)
+{
+    long i, mid;
+    int axis;
+    double xmin, xmax, ymin, ymax;
+
+    if (hi - lo <= LEAFSIZE) return;
+
+    /* split along the wider extent of the points in this node */
+    xmin = xmax = t->p[lo].x;
+    ymin = ymax = t->p[lo].y;
+    for (i = lo + 1; i < hi; i++) {
+        if (t->p[i].x < xmin) xmin = t->p[i].x;
+        if (t->p[i].x > xmax) xmax = t->p[i].x;
+        if (t->p[i].y < ymin) ymin = t->p[i].y;
+        if (t->p[i].y > ymax) ymax = t->p[i].y;
+    }
+    axis = (ymax - ymin > xmax - xmin);
+    mid = lo + (hi - lo) / 2;
+    select_point(t->p, lo, hi, mid, axis);
+    t->axis[mid] = axis;
+
+    build(t, lo, mid);
+    build(t, mid + 1, hi);
+}
+
+static void heap_push(struct heap *h, double d2, long idx)
+{
+    long i, c;
+
+    if (h->n == h->k) {
+        if (d2 >= h->d2[0]) return;
+        /* replace the farthest and sift down */
+        i = 0;
+        for (;;) {
+            c = 2*i + 1;
+            if (c >= h->n) break;
+            if (c + 1 < h->n && h->d2[c + 1] > h->d2[c]) c++;
+            if (h->d2[c] <= d2) break;
+            h->d2[i] = h->d2[c];
+            h->idx[i] = h->idx[c];
+            i = c;
+        }
+    }
+    else {
+        /* append and sift up */
+        i = h->n++;
+        while (i > 0 && h->d2[(i - 1)/2] < d2) {
+            h->d2[i] = h->d2[(i - 1)/2];
+            h->idx[i] = h->idx[(i - 1)/2];
+            i = (i - 1)/2;
+        }
+    }
+    h->d2[i] = d2;
+    h->idx[i] = idx;
+}
+
+static void search(const struct kdtree *t, long lo, long hi, double qx, double qy, struct heap *h)
+{
+    long i, mid;
+    double d, dx, dy;
+
+    if (hi - lo <= LEAFSIZE) {
+        for (i = lo; i < hi; i++) {
+            dx = t->p[i].x - qx;
+            dy = t->p[i].y - qy;
+            heap_push(h, dx*dx + dy*dy, i);
+        }
+        return;
+    }
+
+    mid = lo + (hi - lo) / 2;
+    dx = t->p[mid].x - qx;
+    dy = t->p[mid].y - qy;
+    heap_push(h, dx*dx + dy*dy, mid);
+
+    d = t->axis[mid] ? qy - t->p[mid].y : qx - t->p[mid].x;
+    if (d < 0.0) {
+        search(t, lo, mid, qx, qy, h);
+        if (h->n < h->k || d*d < h->d2[0])
+            search(t, mid + 1, hi, qx, qy, h);
+    }
+    else {
+        search(t, mid + 1, hi, qx, qy, h);
+        if (h->n < h->k || d*d < h->d2[0])
+            search(t, lo, mid, qx, qy, h);
+    }
+}
+
+/* Solve the p x p symmetric positive definite system A c = b in place by
+ * Cholesky decomposition. Returns FALSE if A is not numerically positive
+ * definite. */
+static int solve_spd(double A[MAXPAR][MAXPAR], double *b, int p)
+{
+    int i, j, k;
+    double s;
+
+    for (j = 0; j < p; j++) {
+        s = A[j][j];
+        for (k = 0; k < j; k++) s -= A[j][k] * A[j][k];
+        if (s <= 1e-12 * (A[j][j] > 0 ? A[j][j] : 1.0)) return(FALSE);
+        A[j][j] = sqrt(s);
+        for (i = j + 1; i < p; i++) {
+            s = A[i][j];
+            for (k = 0; k < j; k++) s -= A[i][k] * A[j][k];
+            A[i][j] = s / A[j][j];
+        }
+    }
+    for (i = 0; i < p; i++) {
+        s = b[i];
+        for (k = 0; k < i; k++) s -= A[i][k] * b[k];
+        b[i] = s / A[i][i];
+    }
+    for (i = p - 1; i >= 0; i--) {
+        s = b[i];
+        for (k = i + 1; k < p; k++) s -= A[k][i] * b[k];
+        b[i] = s / A[i][i];
+    }
+    return(TRUE);
+}
+
+/* Fit the local surface about (qx, qy) to the neighbors held in the heap
+ * and return its value there. Coordinates are taken relative to the
+ * evaluation point and scaled by the window radius, so the value is just
+ * the constant term. */
+static double loess_at(const struct kdtree *t, const struct heap *h, double qx, double qy, int order)
+{
+    double A[MAXPAR][MAXPAR], b[MAXPAR], basis[MAXPAR];
+    double radius, r, w, u, v, sw = 0.0, swz = 0.0;
+    int i, j, p;
+    long m;
+
+    radius = 0.0;
+    for (m = 0; m < h->n; m++)
+        if (h->d2[m] > radius) radius = h->d2[m];
+    radius = 1.001 * sqrt(radius); /* so the farthest neighbor keeps some weight */
+
+    for (p = (order == 2) ? 6 : 3; p >= 1; p = (p == 6) ? 3 : 1) {
+        for (i = 0; i < p; i++) {
+            b[i] = 0.0;
+            for (j = 0; j < p; j++) A[i][j] = 0.0;
+        }
+        for (m = 0; m < h->n; m++) {
+            const struct point *pt = &t->p[h->idx[m]];
+            if (radius > 0.0) {
+                r = sqrt(h->d2[m]) / radius;
+                w = 1.0 - r*r*r;
+                w = w*w*w;
+                u = (pt->x - qx) / radius;
+                v = (pt->y - qy) / radius;
+            }
+            else {
+                w = 1.0;
+                u = v = 0.0;
+            }
+            basis[0] = 1.0;
+            basis[1] = u;
+            basis[2] = v;
+            basis[3] = u*u;
+            basis[4] = u*v;
+            basis[5] = v*v;
+            for (i = 0; i < p; i++) {
+                b[i] += w * basis[i] * pt->z;
+                for (j = 0; j <= i; j++)
+                    A[i][j] += w * basis[i] * basis[j];
+            }
+            if (p == 1) {
+                sw += w;
+                swz += w * pt->z;
+            }
+        }
+        if (p == 1)
+            return(sw > 0.0 ? swz / sw : t->p[h->idx[0]].z);
+        if (solve_spd(A, b, p))
+            return(b[0]);
+    }
+    return(0.0); /* not reached */
+}
+
+int main (int argc, char **argv)
+{
+    char *colnames[3];
+    int col[3] = {-1, -1, -1};
+    int ncol = 0;
+    double values[3];
+    double *x, *y, *z, *zs;
+    double *gx = NULL, *gy = NULL;
+    struct kdtree tree;
+    long nrow = 0, nalloc = 0, neval, k = 50;
+    int order = 1;
+    int subtract = 0;
+    int gridx = 0, gridy = 0;
+    int status = 0;
+    int narg,c;
+
+    while ((c = getopt (argc, argv, "k:n:g:sh")) != -1)
+        switch (c)
+        {
+            case 'k':
+                k = atol(optarg);
+                if (k < 3) {
+                    fprintf(stderr,"Need at least 3 neighbors\n");
+                    return(1);
+                }
+                break;
+            case 'n':
+                order = atoi(optarg);
+                if (order < 1 || order > 2) {
+                    fprintf(stderr,"Order must be 1 or 2\n");
+                    return(1);
+                }
+                break;
+            case 'g':
+                if (sscanf(optarg,"%dx%d",&gridx,&gridy) != 2 || gridx < 1 || gridy < 1) {
+                    fprintf(stderr,"Grid must be given as NXxNY\n");
+                    return(1);
+                }
+                break;
+            case 's':
+                subtract = 1;
+                break;
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'c')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    narg = argc - optind;
+    if (narg != 3)
+    {
+        print_help();
+        return(1);
+    }
+    for (int i = 0; i < 3; i++)
+        colnames[i] = argv[optind + i];
+    if (subtract && gridx) {
+        fprintf(stderr,"Residuals are only available at the data points\n");
+        return(1);
+    }
+
+    /* LOAD DATA COLUMNS */
+    x = y = z = NULL;
+    while ((status = read_row(3, colnames, col, &ncol, values)) == 1) {
+        if (nrow == nalloc) {
+            nalloc = nalloc ? 2*nalloc : 65536;
+            x = (double *) realloc(x, sizeof(double)*nalloc);
+            y = (double *) realloc(y, sizeof(double)*nalloc);
+            z = (double *) realloc(z, sizeof(double)*nalloc);
+        }
+        x[nrow] = values[0];
+        y[nrow] = values[1];
+        z[nrow] = values[2];
+        nrow++;
+    }
+    if (status < 0 || nrow == 0)
+    {
+        fprintf(stderr,"Error reading data table.\n");
+        exit(1);
+    }
+    if (k > nrow)
+        k = nrow;
+
+    /* BUILD THE SPATIAL INDEX */
+    tree.n = nrow;
+    tree.p = (struct point *) malloc(sizeof(struct point)*nrow);
+    tree.axis = (char *) calloc(nrow, sizeof(char));
+    for (long i = 0; i < nrow; i++) {
+        tree.p[i].x = x[i];
+        tree.p[i].y = y[i];
+        tree.p[i].z = z[i];
+    }
+    build(&tree, 0, nrow);
+
+    /* Define the evaluation points */
+    if (gridx) {
+        double xmin = x[0], xmax = x[0], ymin = y[0], ymax = y[0];
+        for (long i = 1; i < nrow; i++) {
+            if (x[i] < xmin) xmin = x[i];
+            if (x[i] > xmax) xmax = x[i];
+            if (y[i] < ymin) ymin = y[i];
+            if (y[i] > ymax) ymax = y[i];
+        }
+        neval = (long) gridx * gridy;
+        gx = (double *) malloc(sizeof(double)*neval);
+        gy = (double *) malloc(sizeof(double)*neval);
+        for (long j = 0; j < gridy; j++)
+            for (long i = 0; i < gridx; i++) {
+                gx[j*gridx + i] = (gridx > 1) ? xmin + i*(xmax - xmin)/(gridx - 1) : 0.5*(xmin + xmax);
+                gy[j*gridx + i] = (gridy > 1) ? ymin + j*(ymax - ymin)/(gridy - 1) : 0.5*(ymin + ymax);
+            }
+    }
+    else {
+        neval = nrow;
+        gx = x;
+        gy = y;
+    }
+    zs = (double *) malloc(sizeof(double)*neval);
+
+    /* SMOOTH */
+    #pragma omp parallel
+    {
+        struct heap h;
+        h.k = k;
+        h.d2 = (double *) malloc(sizeof(double)*k);
+        h.idx = (long *) malloc(sizeof(long)*k);
+
+        #pragma omp for schedule(dynamic,256)
+        for (long i = 0; i < neval; i++) {
+            h.n = 0;
+            search(&tree, 0, nrow, gx[i], gy[i], &h);
+            zs[i] = loess_at(&tree, &h, gx[i], gy[i], order);
+        }
+
+        free(h.d2);
+        free(h.idx);
+    }
+
+    /* OUTPUT */
+    printf("# 1 %s\n", colnames[0]);
+    printf("# 2 %s\n", colnames[1]);
+    if (gridx) {
+        printf("# 3 Smoothed%s\n", colnames[2]);
+        for (long i = 0; i < neval; i++)
+            printf("%f %f %f\n", gx[i], gy[i], zs[i]);
+    }
+    else {
+        printf("# 3 %s\n", colnames[2]);
+        if (subtract)
+            printf("# 4 Subtracted%s\n", colnames[2]);
+        else
+            printf("# 4 Smoothed%s\n", colnames[2]);
+        for (long i = 0; i < nrow; i++) {
+            if (subtract)
+                printf("%f %f %f %f\n", x[i], y[i], z[i], z[i] - zs[i]);
+            else
+                printf("%f %f %f %f\n", x[i], y[i], z[i], zs[i]);
+        }
+    }
+
+    if (gridx) {
+        free(gx);
+        free(gy);
+    }
+    free(x);
+    free(y);
+    free(z);
+    free(zs);
+    free(tree.p);
+    free(tree.axis);
+
+    return 0;
+}
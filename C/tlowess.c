@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <gsl/gsl_multifit.h>
@@ -12,6 +13,8 @@
 #define FALSE 0
 #define TRUE 1
 #define MAXROW 100000
+#define MAXRESP 64
+#define NCHECK 256
 
 char   *help[] = {
 "",
@@ -19,15 +22,50 @@ char   *help[] = {
 "    tlowess - smooths a data column",
 "",
 "SYNOPSIS",
-"    % tlowess [OPTIONS] xcol ycol [scol] < table.txt ",
+"    % tlowess [OPTIONS] xcol ycol [ycol2 ...] < table.txt ",
 "",
 "OPTIONS",
+"    -f span  Fraction of the points used in each local fit [default 0.25]",
+"    -i n     Number of robustness iterations [default 3]",
+"    -d delta Distance in x within which points are interpolated rather",
+"             than fitted [default 0.3]",
+"    -a tol   Choose delta automatically, as the largest value for which",
+"             the interpolation error is below tol times the range of the",
+"             smooth (e.g. 0.001). Overrides -d.",
+"    -w n     Streaming mode: smooth in blocks of n points",
+"    -W xspan Streaming mode: smooth in blocks spanning xspan in x",
+"    -s       Output the residuals (data minus smooth) instead of the smooth",
 "    -v       Verbose mode", 
+"    -V       Extra verbose mode (prints input data)", 
 "",
 "DESCRIPTION",
 "",
 "    This program smooths a column of a data table using the LOWESS",
-"    algorithm.",
+"    algorithm. The table must be sorted on xcol (tsort xcol will do it).",
+"    Any number of columns can be smoothed against the same xcol in one",
+"    pass: the neighborhoods and distance weights are computed once and",
+"    shared by all of them, while the robustness weights are tracked",
+"    separately for each column.",
+"    The output has xcol followed by a (data, smoothed) pair of columns for",
+"    each ycol.",
+"",
+"    Evaluating the local fit at every point is expensive for long, densely",
+"    sampled series, so points closer than delta (in the units of xcol) to",
+"    the last fitted point are interpolated instead. With -a the value of",
+"    delta is found by halving from 1/16 of the x range until the",
+"    interpolated values, checked against exact fits at a sample of points,",
+"    meet the tolerance. In verbose mode the trials are reported in #!",
+"    comment lines.",
+"",
+"    Normally the whole table is read before anything is written. With -w",
+"    or -W the input is treated as an unbounded stream and only a bounded",
+"    block of it is held in memory. With -w the span is a fraction of the",
+"    block size; with -W it is a fraction of the points in each block.",
+"    Each point is written as soon as the block holding it extends far",
+"    enough to the right to complete its neighborhood, and output is",
+"    flushed after every block, so tlowess can sit at the end of a live",
+"    pipe. Robustness weights are computed within each block, so the",
+"    result is close to, but not identical to, smoothing the whole table.",
 "",
 "AUTHOR",
 "    Roberto Abraham (abraham@astro.utoronto.ca)",
@@ -68,76 +106,234 @@ int static compar(const void *aa, const void *bb)
   else return(0);
 }
 
-static void lowest(double *x, double *y, size_t n, double xs, double *ys, long nleft, long nright,
-        double *w, int userw, double *rw, int *ok)
+/* Compute the tricube weights in x for the neighborhood [nleft, nright]
+ * about xs. These depend only on x, so they are shared by every response
+ * column. Ties on the right are picked up, so the index of the rightmost
+ * point actually used is returned, and *h is set to the window radius. */
+static long tricube(double *x, size_t n, double xs, long nleft, long nright,
+        double *w, double *h)
 {
-    double range, h, h1, h9, a, b, c, r;
-    long j, nrt;
+    double h1, h9, r;
+    long j;
 
-    range = x[n - 1] - x[0];
-    h = fmax(xs - x[nleft], x[nright] - xs);
-    h9 = .999 * h;
-    h1 = .001 * h;
+    *h = fmax(xs - x[nleft], x[nright] - xs);
+    h9 = .999 * *h;
+    h1 = .001 * *h;
 
-    /* compute weights (pick up all ties on right) */
-    a = 0.0; /* sum of weights */
     for(j = nleft; j < n; j++) {
         w[j]=0.0;
         r = fabs(x[j] - xs);
         if (r <= h9) { /* small enough for non-zero weight */
-            if (r > h1) w[j] = pow3(1.0-pow3(r/h));
+            if (r > h1) w[j] = pow3(1.0-pow3(r / *h));
             else w[j] = 1.0;
-            if (userw) w[j] = rw[j] * w[j];
-            a += w[j];
         }
         else if (x[j] > xs) break; /* get out at first zero wt on right */
     }
-    nrt = j - 1; /* rightmost pt (may be greater than nright because of ties) */
-    if (a <= 0.0) *ok = FALSE;
-    else { /* weighted least squares */
-        *ok = TRUE;
+    return(j - 1); /* rightmost pt (may be greater than nright because of ties) */
+}
 
-        /* make sum of w[j] == 1 */
-        for (j = nleft; j <= nrt; j++) w[j] = w[j] / a;
+/* Turn the tricube weights w[nleft..nrt] (times the robustness weights rw
+ * if userw is set) into the equivalent kernel l of the local linear fit,
+ * so that the fitted value at xs is the sum of l[j] * y[j]. Returns FALSE
+ * if all the weights are zero. */
+static int lowest(double *x, size_t n, double xs, long nleft, long nrt, double h,
+        double *w, int userw, double *rw, double *l)
+{
+    double range, a, b, c;
+    long j;
 
-        if (h > 0.0) { /* use linear fit */
+    range = x[n - 1] - x[0];
 
-            /* find weighted center of x values */
-            for (j = nleft, a = 0.0; j <= nrt; j++) a += w[j] * x[j];
+    a = 0.0; /* sum of weights */
+    for (j = nleft; j <= nrt; j++) {
+        l[j] = w[j];
+        if (userw) l[j] = rw[j] * l[j];
+        a += l[j];
+    }
+    if (a <= 0.0) return(FALSE);
 
-            b = xs - a;
-            for (j = nleft, c = 0.0; j <= nrt; j++)
-                c += w[j] * (x[j] - a) * (x[j] - a);
+    /* make sum of l[j] == 1 */
+    for (j = nleft; j <= nrt; j++) l[j] = l[j] / a;
 
-            if(sqrt(c) > .001 * range) {
-                /* points are spread out enough to compute slope */
-                b = b/c;
-                for (j = nleft; j <= nrt; j++)
-                    w[j] = w[j] * (1.0 + b*(x[j] - a));
-            }
+    if (h > 0.0) { /* use linear fit */
+
+        /* find weighted center of x values */
+        for (j = nleft, a = 0.0; j <= nrt; j++) a += l[j] * x[j];
+
+        b = xs - a;
+        for (j = nleft, c = 0.0; j <= nrt; j++)
+            c += l[j] * (x[j] - a) * (x[j] - a);
+
+        if(sqrt(c) > .001 * range) {
+            /* points are spread out enough to compute slope */
+            b = b/c;
+            for (j = nleft; j <= nrt; j++)
+                l[j] = l[j] * (1.0 + b*(x[j] - a));
         }
-        for (j = nleft, *ys = 0.0; j <= nrt; j++) *ys += w[j] * y[j];
     }
+    return(TRUE);
 }
 
 
-static void sort(double *x, size_t n)
+/* Partially reorder a[0..n-1] so that a[k] holds the value it would
+ * have if the array were sorted, with nothing larger to its left and
+ * nothing smaller to its right. This is Hoare's FIND with a median-of-three
+ * pivot, so it runs in linear expected time. If partitioning stops making
+ * progress (pathological inputs) we fall back to sorting what is left,
+ * which bounds the worst case at n log n. */
+static double select_kth(double *a, long n, long k)
 {
-    extern void qsort();
+    long lo = 0, hi = n - 1, mid, i, j;
+    int depth = 0, maxdepth = 2;
+    double pivot, t;
 
-    qsort(x, n, sizeof(double), compar);
+    for (i = n; i > 1; i >>= 1) maxdepth += 2;  /* ~2 log2(n) */
+
+    #define SWAP(p,q) { t = a[p]; a[p] = a[q]; a[q] = t; }
+    while (lo < hi) {
+        if (++depth > maxdepth) {
+            qsort(a + lo, hi - lo + 1, sizeof(double), compar);
+            break;
+        }
+        mid = lo + (hi - lo) / 2;
+        if (a[mid] < a[lo]) SWAP(lo, mid);
+        if (a[hi] < a[lo]) SWAP(lo, hi);
+        if (a[hi] < a[mid]) SWAP(mid, hi);
+        pivot = a[mid];
+        i = lo; j = hi;
+        do {
+            while (a[i] < pivot) i++;
+            while (pivot < a[j]) j--;
+            if (i <= j) {
+                SWAP(i, j);
+                i++; j--;
+            }
+        } while (i <= j);
+        if (j < k) lo = i;
+        if (k < i) hi = j;
+    }
+    #undef SWAP
+    return(a[k]);
 }
 
-int lowess(double *x, double *y, size_t n,
-        double f, size_t nsteps,
-        double delta, double *ys, double *rw, double *res)
+/* Number of points in each local neighborhood: at least two, at most n */
+static long span_points(double f, size_t n)
 {
-    int iter, ok;
-    long i, j, last, m1, m2, nleft, nright, ns;
-    double d1, d2, denom, alpha, cut, cmad, c9, c1, r;
+    return(max(min((long) (f * n), n), 2));
+}
+
+/* Find the ns points of the sorted x nearest to xs, sliding the window
+ * right in the same way as the main lowess loop does. */
+static void neighborhood(double *x, size_t n, long ns, double xs, long *nleft, long *nright)
+{
+    long lo = 0, hi = n;
 
-    if (n < 2) { ys[0] = y[0]; return(1); }
-    ns = max(min((long) (f * n), n), 2); /* at least two, at most n points */
+    while (lo < hi) { /* first point with x >= xs */
+        long mid = lo + (hi - lo) / 2;
+        if (x[mid] < xs) lo = mid + 1;
+        else hi = mid;
+    }
+    *nleft = max(lo - ns, 0);
+    *nright = *nleft + ns - 1;
+    while (*nright < n - 1 && xs - x[*nleft] > x[*nright + 1] - xs) {
+        (*nleft)++;
+        (*nright)++;
+    }
+}
+
+/* Estimate the error made by interpolating between the anchor points by
+ * evaluating the local fit exactly at NCHECK points spread through the
+ * data, using the robustness weights of the final pass. The error for each
+ * response is taken relative to the range of its smooth, and the largest
+ * one is returned. */
+static double interpolation_error(double *x, double **y, size_t n, size_t ny,
+        long ns, int userw, double **rw, double **ys)
+{
+    long i, j, k, m, nleft, nright, nrt;
+    double h, fit, lo, hi, err = 0.0;
+    double *w, *l, *scale;
+    int ok;
+
+    if (n < 3) return(0.0);
+    w = (double *) malloc(sizeof(double)*n);
+    l = (double *) malloc(sizeof(double)*n);
+    scale = (double *) malloc(sizeof(double)*ny);
+    for (k = 0; k < ny; k++) {
+        for (i = 0, lo = hi = ys[k][0]; i < n; i++) {
+            if (ys[k][i] < lo) lo = ys[k][i];
+            if (ys[k][i] > hi) hi = ys[k][i];
+        }
+        scale[k] = (hi > lo) ? hi - lo : 1.0;
+    }
+
+    for (m = 0; m < NCHECK; m++) {
+        i = (m * (long) (n - 1)) / (NCHECK - 1);
+        neighborhood(x, n, ns, x[i], &nleft, &nright);
+        nrt = tricube(x, n, x[i], nleft, nright, w, &h);
+        if (!userw)
+            ok = lowest(x, n, x[i], nleft, nrt, h, w, FALSE, NULL, l);
+        for (k = 0; k < ny; k++) {
+            if (userw)
+                ok = lowest(x, n, x[i], nleft, nrt, h, w, TRUE, rw[k], l);
+            if (ok)
+                for (j = nleft, fit = 0.0; j <= nrt; j++) fit += l[j] * y[k][j];
+            else
+                fit = y[k][i];
+            err = fmax(err, fabs(fit - ys[k][i]) / scale[k]);
+        }
+    }
+    free(w);
+    free(l);
+    free(scale);
+    return(err);
+}
+
+/* Compute the bisquare robustness weights from the residuals. rw doubles
+ * as scratch space for finding the median absolute residual, since it is
+ * not needed again until the new weights are written. */
+static void robustness_weights(double *res, size_t n, double *rw)
+{
+    long i, m1, m2;
+    double cmad, c9, c1, r;
+
+    for (i = 0; i < n; i++)
+        rw[i] = fabs(res[i]);
+    m1 = n / 2; m2 = n - m1 - 1; /* upper and lower middle (0-based) */
+    cmad = select_kth(rw, n, m1);
+    if (m2 < m1) { /* even n: lower middle is the max of the left part */
+        for (i = 0, r = rw[0]; i < m1; i++) if (rw[i] > r) r = rw[i];
+        cmad += r;
+    }
+    else cmad += cmad;
+    cmad *= 3.0; /* 6 median abs resid */
+    c9 = .999 * cmad; c1 = .001 * cmad;
+    for (i = 0; i < n; i++) {
+        r = fabs(res[i]);
+        if(r <= c1) rw[i] = 1.0; /* near 0, avoid underflow */
+        else if(r > c9) rw[i] = 0.0; /* near 1, avoid underflow */
+        else rw[i] = pow2(1.0 - pow2(r / cmad));
+    }
+}
+
+/* Smooth the ny response columns y[0..ny-1] against a common, sorted x,
+ * fitting each point from its ns nearest neighbors.
+ * The neighborhoods, tricube weights and interpolation anchors depend only
+ * on x and are computed once for all responses. On the first pass the
+ * equivalent kernel is shared too; on later passes each response has its
+ * own robustness weights rw[k], and res[k] receives its residuals. */
+int lowess(double *x, double **y, size_t n, size_t ny,
+        long ns, size_t nsteps,
+        double delta, double **ys, double **rw, double **res)
+{
+    int iter, ok;
+    long i, j, k, last, nleft, nright, nrt;
+    double d1, d2, h, denom, alpha, cut;
+    double *w, *l;
+
+    if (n < 2) { for (k = 0; k < ny; k++) ys[k][0] = y[k][0]; return(1); }
+    w = (double *) malloc(sizeof(double)*n);
+    l = (double *) malloc(sizeof(double)*n);
+    ns = max(min(ns, n), 2);
     for(iter = 1; iter <= nsteps + 1; iter++){ /* robustness iterations */
         nleft = 0; nright = ns - 1;
         last = -1; /* index of prev estimated point */
@@ -147,25 +343,30 @@ int lowess(double *x, double *y, size_t n,
                 /* move nleft, nright to right if radius decreases */
                 d1 = x[i] - x[nleft];
                 d2 = x[nright + 1] - x[i];
-                /* if d1 <= d2 with x[nright+1] == x[nright], lowest fixes */
+                /* if d1 <= d2 with x[nright+1] == x[nright], tricube fixes */
                 if (d1 <= d2) break;
                 /* radius will not decrease by move right */
                 nleft++;
                 nright++;
             }
-            lowest(x, y,
-                    n, x[i],
-                    &ys[i],
-                    nleft, nright,
-                    res, (iter > 1), rw, &ok);
-            /* fitted value at x[i] */
-            if (! ok) ys[i] = y[i];
-            /* all weights zero - copy over value (all rw==0) */
-            if (last < i - 1) { /* skipped points -- interpolate */
-                denom = x[i] - x[last]; /* non-zero - proof? */
-                for(j = last + 1; j < i; j = j + 1){
-                    alpha = (x[j] - x[last]) / denom;
-                    ys[j] = alpha * ys[i] + (1.0 - alpha) * ys[last];
+            nrt = tricube(x, n, x[i], nleft, nright, w, &h);
+            if (iter == 1)
+                ok = lowest(x, n, x[i], nleft, nrt, h, w, FALSE, NULL, l);
+            for (k = 0; k < ny; k++) {
+                if (iter > 1)
+                    ok = lowest(x, n, x[i], nleft, nrt, h, w, TRUE, rw[k], l);
+                /* fitted value at x[i] */
+                if (ok)
+                    for (j = nleft, ys[k][i] = 0.0; j <= nrt; j++) ys[k][i] += l[j] * y[k][j];
+                else
+                    ys[k][i] = y[k][i];
+                /* all weights zero - copy over value (all rw==0) */
+                if (last < i - 1) { /* skipped points -- interpolate */
+                    denom = x[i] - x[last]; /* non-zero - proof? */
+                    for(j = last + 1; j < i; j = j + 1){
+                        alpha = (x[j] - x[last]) / denom;
+                        ys[k][j] = alpha * ys[k][i] + (1.0 - alpha) * ys[k][last];
+                    }
                 }
             }
             last = i; /* last point actually estimated */
@@ -173,62 +374,198 @@ int lowess(double *x, double *y, size_t n,
             for(i=last + 1; i < n; i++) { /* find close points */
                 if (x[i] > cut) break; /* i one beyond last pt within cut */
                 if(x[i] == x[last]) { /* exact match in x */
-                    ys[i] = ys[last];
+                    for (k = 0; k < ny; k++) ys[k][i] = ys[k][last];
                     last = i;
                 }
             }
             i = max(last + 1,i - 1);
             /* back 1 point so interpolation within delta, but always go forward */
         } while(last < n - 1);
-        for (i = 0; i < n; i++) /* residuals */
-            res[i] = y[i] - ys[i];
+        for (k = 0; k < ny; k++) /* residuals */
+            for (i = 0; i < n; i++)
+                res[k][i] = y[k][i] - ys[k][i];
         if (iter > nsteps) break; /* compute robustness weights except last time */
-        for (i = 0; i < n; i++)
-            rw[i] = fabs(res[i]);
-        sort(rw,n);
-        m1 = 1 + n / 2; m2 = n - m1 + 1;
-        cmad = 3.0 * (rw[m1] + rw[m2]); /* 6 median abs resid */
-        c9 = .999 * cmad; c1 = .001 * cmad;
-        for (i = 0; i < n; i++) {
-            r = fabs(res[i]);
-            if(r <= c1) rw[i] = 1.0; /* near 0, avoid underflow */
-            else if(r > c9) rw[i] = 0.0; /* near 1, avoid underflow */
-            else rw[i] = pow2(1.0 - pow2(r / cmad));
+        for (k = 0; k < ny; k++)
+            robustness_weights(res[k], n, rw[k]);
+    }
+    free(w);
+    free(l);
+    return(0);
+}
+
+void print_header(char **colnames, int ny, int subtract)
+{
+    printf("# 1 %s\n", colnames[0]);
+    for (int k = 0; k < ny; k++) {
+        printf("# %d %s\n", 2*k + 2, colnames[k + 1]);
+        if (subtract)
+            printf("# %d Subtracted%s\n", 2*k + 3, colnames[k + 1]);
+        else
+            printf("# %d Smoothed%s\n", 2*k + 3, colnames[k + 1]);
+    }
+}
+
+void print_rows(double *x, double **y, double **ys, int ny, long first, long last, int subtract)
+{
+    for(long i = first; i < last; i++) {
+        printf("%f", x[i]);
+        for (int k = 0; k < ny; k++) {
+            if (subtract)
+                printf(" %f %f", y[k][i], y[k][i]-ys[k][i]);
+            else
+                printf(" %f %f", y[k][i], ys[k][i]);
+        }
+        printf("\n");
+    }
+}
+
+/* Smooth an x-sorted stream of unknown length while holding only a bounded
+ * block of it in memory. The block is filled up to window points (or until
+ * the points not yet written span xspan in x), smoothed, and every point
+ * at least ns points from the right edge of the block is written out: no
+ * later point can enter its neighborhood. The last ns written points are
+ * kept as left context for the next block, along with the points still
+ * waiting to be written, and robustness weights are recomputed within each
+ * block. Output is flushed after every block. */
+int stream_lowess(char **colnames, int ny, long window, double xspan,
+        double f, int nsteps, double delta, int subtract)
+{
+    long cap = window ? window : MAXROW;
+    long n = 0, start = 0, end, keep, ns;
+    int col[MAXRESP + 1];
+    int ncol = 0;
+    double values[MAXRESP + 1];
+    double *x;
+    double *y[MAXRESP], *ys[MAXRESP], *rw[MAXRESP], *res[MAXRESP];
+    int eof = 0;
+    int status;
+
+    x = (double *) malloc(sizeof(double)*cap);
+    for (int k = 0; k < ny; k++) {
+        y[k] = (double *) malloc(sizeof(double)*cap);
+        ys[k] = (double *) malloc(sizeof(double)*cap);
+        rw[k] = (double *) malloc(sizeof(double)*cap);
+        res[k] = (double *) malloc(sizeof(double)*cap);
+    }
+    for (int k = 0; k <= ny; k++)
+        col[k] = -1;
+
+    print_header(colnames, ny, subtract);
+    while (!eof) {
+
+        /* Top up the block */
+        while (n < cap && !(xspan > 0.0 && n > start && x[n-1] - x[start] >= xspan)) {
+            status = read_row(ny + 1, colnames, col, &ncol, values);
+            if (status < 0)
+                return(1);
+            if (status == 0) {
+                eof = 1;
+                break;
+            }
+            if (n > 0 && values[0] < x[n-1]) {
+                fprintf(stderr,"Input is not sorted on %s.\n",colnames[0]);
+                return(1);
+            }
+            x[n] = values[0];
+            for (int k = 0; k < ny; k++)
+                y[k][n] = values[k + 1];
+            n++;
         }
+        if (n == 0)
+            break;
+
+        ns = window ? span_points(f, window) : span_points(f, n);
+        lowess(x, y, n, ny, ns, nsteps, delta, ys, rw, res);
+        end = eof ? n : max(n - ns, start + 1);
+        print_rows(x, y, ys, ny, start, end, subtract);
+        fflush(stdout);
+        if (eof)
+            break;
+
+        /* Slide the block along, keeping ns points of context */
+        keep = max(end - ns, 0);
+        n -= keep;
+        start = end - keep;
+        memmove(x, x + keep, n*sizeof(double));
+        for (int k = 0; k < ny; k++)
+            memmove(y[k], y[k] + keep, n*sizeof(double));
+    }
+
+    free(x);
+    for (int k = 0; k < ny; k++) {
+        free(y[k]);
+        free(ys[k]);
+        free(rw[k]);
+        free(res[k]);
     }
     return(0);
 }
 
 int main (int argc, char **argv)
 {
-    double x[MAXROW];
-    double y[MAXROW];
-    double sigma[MAXROW];
+    double *x;
+    double *y[MAXRESP];
+    double *ys[MAXRESP];
+    double *rw[MAXRESP];
+    double *res[MAXRESP];
+    double *cols[MAXRESP + 1];
+    char *colnames[MAXRESP + 1];
     int nrow = 0;
-    int count = 0;
+    int ny;
     int status = 0;
-    int i, n;
-    double xi, yi, ei, chisq;
-    gsl_matrix *X, *cov;
-    gsl_vector *yvec, *wvec, *cvec;
     int verbose = 0;
     int subtract = 0;
     int extra_verbose = 0;
-    char xcolname[64];
-    char ycolname[64];
-    char scolname[64];
-    int has_uncertainties;
     int order = 2;
     int narg,c;
 
     // Lowess parameters
-    const double f = 0.25;
-    const size_t nsteps = 3;
-    const double delta = 0.3;
-
-    while ((c = getopt (argc, argv, "svVhn:")) != -1)
+    double f = 0.25;
+    int nsteps = 3;
+    double delta = 0.3;
+    double tol = 0.0;
+    int auto_delta = 0;
+    long window = 0;
+    double xspan = 0.0;
+
+    while ((c = getopt (argc, argv, "svVhn:f:i:d:a:w:W:")) != -1)
         switch (c)
         {
+            case 'f':
+                f = atof(optarg);
+                if (f <= 0.0 || f > 1.0) {
+                    fprintf(stderr,"Span must be in the range (0,1]\n");
+                    return(1);
+                }
+                break;
+            case 'i':
+                nsteps = atoi(optarg);
+                if (nsteps < 0) {
+                    fprintf(stderr,"Number of iterations must be non-negative\n");
+                    return(1);
+                }
+                break;
+            case 'd':
+                delta = atof(optarg);
+                if (delta < 0.0) {
+                    fprintf(stderr,"Delta must be non-negative\n");
+                    return(1);
+                }
+                break;
+            case 'w':
+                window = atol(optarg);
+                break;
+            case 'W':
+                xspan = atof(optarg);
+                break;
+            case 'a':
+                tol = atof(optarg);
+                if (tol <= 0.0) {
+                    fprintf(stderr,"Tolerance must be positive\n");
+                    return(1);
+                }
+                auto_delta = 1;
+                break;
             case 's':
                 subtract = 1;
                 break;
@@ -261,71 +598,93 @@ int main (int argc, char **argv)
                 abort();
         }
     narg = argc - optind;
-    if (narg == 2) 
-    { 
-        sscanf(argv[optind++],"%s",xcolname);
-        sscanf(argv[optind++],"%s",ycolname);
-        has_uncertainties = 0;
-    }
-    else if (narg == 3) 
-    { 
-        sscanf(argv[optind++],"%s",xcolname);
-        sscanf(argv[optind++],"%s",ycolname);
-        sscanf(argv[optind++],"%s",scolname);
-        has_uncertainties = 1;
-    }
-    else
+    if (narg < 2 || narg > MAXRESP + 1)
     {
         print_help();
         return(1);
     }
+    ny = narg - 1;
+    for (int k = 0; k < narg; k++)
+        colnames[k] = argv[optind + k];
+
+    /* STREAMING MODE */
+    if (window > 0 || xspan > 0.0) {
+        if (auto_delta) {
+            fprintf(stderr,"Automatic delta is not available when streaming\n");
+            return(1);
+        }
+        if ((window > 0 && window <= 2*span_points(f, window)) || (window == 0 && f >= 0.5)) {
+            fprintf(stderr,"Window is too small for the span\n");
+            return(1);
+        }
+        if (window > MAXROW) {
+            fprintf(stderr,"Window must be at most %d points\n",MAXROW);
+            return(1);
+        }
+        return(stream_lowess(colnames, ny, window, xspan, f, nsteps, delta, subtract));
+    }
 
-    /* LOAD DATA COLUMNS */
-    if (has_uncertainties)
-        status = read_xyz(xcolname,ycolname,scolname,x,y,sigma,&nrow);
-    else
-        status = read_xy(xcolname,ycolname,x,y,&nrow);
+    for (int k = 0; k < narg; k++)
+        cols[k] = (double *) malloc(sizeof(double)*MAXROW);
 
+    /* LOAD DATA COLUMNS */
+    status = read_cols(narg, colnames, cols, &nrow);
     if (status)
     {
         fprintf(stderr,"Error reading data table.\n");
         exit(1);
     }
-
-    /* Define sigma as unity for now */
-    if (!has_uncertainties)
-        for (int i=0; i<nrow; i++){
-            sigma[i] = 1.0;
-        }
+    x = cols[0];
+    for (int k = 0; k < ny; k++)
+        y[k] = cols[k + 1];
 
     if (extra_verbose) {
         printf("# data:\n");
-        for(int i=0;i<nrow;i++) printf("%20g %20g %20g\n",x[i],y[i],sigma[i]); 
+        for(int i=0;i<nrow;i++) {
+            printf("%20g",x[i]);
+            for (int k = 0; k < ny; k++) printf(" %20g",y[k][i]);
+            printf("\n");
+        }
     }
 
-    double *ys = (double *) malloc(sizeof(double)*nrow);
-    double *rw = (double *) malloc(sizeof(double)*nrow); 
-    double *res = (double *) malloc(sizeof(double)*nrow); 
-    lowess(x, y, nrow, f, nsteps, delta, ys, rw, res);
-
-    printf("# 1 %s\n", xcolname);
-    printf("# 2 %s\n", ycolname);
-    if (subtract) {
-        printf("# 3 Subtracted%s\n", ycolname);
-    }
-    else {
-        printf("# 3 Smoothed%s\n", ycolname);
+    for (int k = 0; k < ny; k++) {
+        ys[k] = (double *) malloc(sizeof(double)*nrow);
+        rw[k] = (double *) malloc(sizeof(double)*nrow);
+        res[k] = (double *) malloc(sizeof(double)*nrow);
     }
-    for(long i = 0; i < nrow; i++) {
-        if (subtract)
-            printf("%f %f %f\n", x[i], y[i], y[i]-ys[i]);
-        else
-            printf("%f %f %f\n", x[i], y[i], ys[i]);
+    if (auto_delta && nrow > 2) {
+        /* Start coarse and halve delta until interpolating between the
+         * anchors reproduces the exact smooth to within the tolerance.
+         * The cost of each trial roughly doubles, so the failed trials
+         * together cost no more than the one that is kept. */
+        double range = x[nrow-1] - x[0];
+        double err;
+        delta = range / 16.0;
+        for (;;) {
+            lowess(x, y, nrow, ny, span_points(f, nrow), nsteps, delta, ys, rw, res);
+            err = interpolation_error(x, y, nrow, ny, span_points(f, nrow), nsteps > 0, rw, ys);
+            if (verbose)
+                printf("#! tlowess_delta:%g max_interpolation_error:%g\n", delta, err);
+            if (err <= tol || delta == 0.0)
+                break;
+            delta /= 2.0;
+            if (delta < range / nrow)
+                delta = 0.0; /* evaluate every point */
+        }
     }
+    else
+        lowess(x, y, nrow, ny, span_points(f, nrow), nsteps, delta, ys, rw, res);
+
+    print_header(colnames, ny, subtract);
+    print_rows(x, y, ys, ny, 0, nrow, subtract);
 
-    free(ys);
-    free(rw);
-    free(res);
+    for (int k = 0; k < ny; k++) {
+        free(ys[k]);
+        free(rw[k]);
+        free(res[k]);
+    }
+    for (int k = 0; k < narg; k++)
+        free(cols[k]);
 
     return 0;
 }
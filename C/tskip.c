@@ -0,0 +1,529 @@
+// Slice or subsample the rows of a table in one streaming pass. A native
+// replacement for Bash/tskip.sh, which copied the input to temporary
+// files three times (and leaked one of them).
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <gsl/gsl_rng.h>
+#include "table.h"
+
+#define BATCH 1024
+#define INDEX_EVERY 1024
+
+char   *help[] = {
+"",
+"NAME",
+"    tskip - skip, slice or subsample the rows of a table",
+"",
+"SYNOPSIS",
+"    % tskip [OPTIONS] [number] < table.txt ",
+"",
+"OPTIONS",
+"    -r             Do not print the header",
+"    -n count       Write at most count rows",
+"    -k stride      Write every stride-th row",
+"    -R first,last  Write rows first to last (counting from 1)",
+"    -s count       Write a uniform random sample of count rows",
+"    -p fraction    Keep each row with probability fraction",
+"    -S seed        Random number seed for -s and -p [default 1]",
+"    -w file        Write a row-offset index of the table to file",
+"    -i file        Seek using a row-offset index made by -w",
+"    -h             Print help",
+"",
+"DESCRIPTION",
+"",
+"    This program writes a subset of the data rows of a table provided",
+"    via standard input. Header and comment lines (those starting with",
+"    #) are passed through unless -r is given. With a number, the first",
+"    number data rows are dropped, as before:",
+"",
+"        extract foo.fits | tskip 100",
+"",
+"    The other options are applied in the order range (or number),",
+"    stride, sampling and count, so",
+"",
+"        tskip -R 1001,2000 -k 10 < big.txt",
+"",
+"    writes rows 1001, 1011, ..., 1991. A random sample of -s rows is",
+"    drawn by reservoir sampling in one pass, holding only the rows kept,",
+"    and written in its original order. -p keeps each row independently",
+"    with the given probability, and skips over the rows it does not",
+"    keep without drawing a random number for each of them. Both depend",
+"    only on the seed and the input, so a sample can be reproduced.",
+"",
+"    The table is read once, and reading stops as soon as no later row",
+"    can be written (e.g. with -n or -R on a long table).",
+"",
+"    ROW-OFFSET INDEX",
+"",
+"    -w writes, alongside the usual output, a small index giving the",
+"    byte offset of every 1024th data row of the table. Given that",
+"    index and the same table as a file on standard input, -i seeks",
+"    straight to the rows wanted instead of reading the rows before",
+"    them, so slicing the end of a large catalog, or sampling a small",
+"    fraction of it, touches only a few blocks of the file:",
+"",
+"        tskip -w big.idx 0 < big.txt > /dev/null",
+"        tskip -i big.idx -s 1000 -S 7 < big.txt > sample.txt",
+"",
+"    With -i only the leading header is written, comment lines within",
+"    the data are skipped, and -s picks its rows directly rather than",
+"    by reservoir sampling, so the sample differs from the one drawn",
+"    without the index for the same seed. The index must have been",
+"    made from the same file.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+struct kept {
+    long row;
+    char *line;
+    size_t len;
+};
+
+
+static int compare_kept(const void *a, const void *b)
+{
+    long ra = ((const struct kept *) a)->row;
+    long rb = ((const struct kept *) b)->row;
+    return((ra > rb) - (ra < rb));
+}
+
+
+static int compare_long(const void *a, const void *b)
+{
+    long ra = *(const long *) a;
+    long rb = *(const long *) b;
+    return((ra > rb) - (ra < rb));
+}
+
+
+/* Number of candidates passed over before the next one is kept, when each
+ * is kept with probability p */
+static long geometric_skip(gsl_rng *rng, double p)
+{
+    double skip;
+
+    if (p >= 1.0)
+        return(0);
+    skip = floor(log(gsl_rng_uniform_pos(rng))/log1p(-p));
+    return(skip < (double) LONG_MAX ? (long) skip : LONG_MAX);
+}
+
+
+/* Row next + k*stride, or -1 if that is past any possible row */
+static long advance(long next, long k, long stride)
+{
+    if (k > (LONG_MAX - next)/stride)
+        return(-1);
+    return(next + k*stride);
+}
+
+
+/* State of reservoir sampling (Li's algorithm L), which draws random
+ * numbers only for the candidates that enter the reservoir */
+struct reservoir {
+    struct kept *kept;
+    long size;
+    long seen;
+    long next;
+    double w;
+};
+
+
+static void reservoir_init(struct reservoir *res, long size, gsl_rng *rng)
+{
+    res->kept = (struct kept *) calloc(size, sizeof(struct kept));
+    res->size = size;
+    res->seen = 0;
+    res->w = exp(log(gsl_rng_uniform_pos(rng))/size);
+    res->next = size + (long) floor(log(gsl_rng_uniform_pos(rng))/log1p(-res->w));
+}
+
+
+static void reservoir_add(struct reservoir *res, gsl_rng *rng, long row, const char *line, size_t len)
+{
+    long slot = -1;
+
+    if (res->seen < res->size)
+        slot = res->seen;
+    else if (res->seen == res->next) {
+        slot = (long) gsl_rng_uniform_int(rng, res->size);
+        res->w *= exp(log(gsl_rng_uniform_pos(rng))/res->size);
+        res->next += 1 + (long) floor(log(gsl_rng_uniform_pos(rng))/log1p(-res->w));
+    }
+    res->seen++;
+    if (slot < 0)
+        return;
+    free(res->kept[slot].line);
+    res->kept[slot].row = row;
+    res->kept[slot].line = (char *) malloc(len);
+    memcpy(res->kept[slot].line, line, len);
+    res->kept[slot].len = len;
+}
+
+
+/* Write a line, supplying the newline the last line of a file may lack */
+static void write_line(const char *line, size_t len)
+{
+    fwrite(line, 1, len, stdout);
+    if (len == 0 || line[len - 1] != '\n')
+        putchar('\n');
+}
+
+
+struct index {
+    long every;
+    long nrows;
+    long long bytes;
+    long noff;
+    long long *off;
+};
+
+
+static int read_index(const char *file, struct index *ix)
+{
+    FILE *fp;
+    long size = 0;
+
+    if (!(fp = fopen(file, "r")))
+        return(0);
+    if (fscanf(fp, "#! tskip_index %ld %ld %lld", &ix->every, &ix->nrows, &ix->bytes) != 3
+        || ix->every < 1 || ix->nrows < 0) {
+        fclose(fp);
+        return(0);
+    }
+    ix->noff = 0;
+    ix->off = NULL;
+    for (;;) {
+        long long o;
+        if (fscanf(fp, "%lld", &o) != 1)
+            break;
+        if (ix->noff == size) {
+            size = size ? 2*size : 1024;
+            ix->off = (long long *) realloc(ix->off, size*sizeof(long long));
+        }
+        ix->off[ix->noff++] = o;
+    }
+    fclose(fp);
+    return(ix->noff == (ix->nrows + ix->every - 1)/ix->every);
+}
+
+
+/* Sequential access to the data rows of a seekable table through its
+ * index. Rows must be asked for in increasing order. */
+struct seeker {
+    struct index *ix;
+    char *line;
+    size_t cap;
+    long row;           /* data row the file is positioned at */
+};
+
+
+static ssize_t seek_row(struct seeker *sk, long row)
+{
+    ssize_t got;
+
+    /* Jump when the row is in a later block than the one being read */
+    if (row/sk->ix->every > sk->row/sk->ix->every || sk->row > row) {
+        long block = row/sk->ix->every;
+        if (fseeko(stdin, (off_t) sk->ix->off[block], SEEK_SET) != 0)
+            return(-1);
+        sk->row = block*sk->ix->every;
+    }
+    while ((got = getline(&sk->line, &sk->cap, stdin)) > 0) {
+        if (sk->line[0] == '#')
+            continue;
+        if (sk->row++ == row)
+            return(got);
+    }
+    return(-1);
+}
+
+
+int main (int argc, char **argv)
+{
+    struct reader r;
+    const char *line[BATCH];
+    size_t len[BATCH];
+    int print_header = 1;
+    long first = 0, last = LONG_MAX, stride = 1, count = LONG_MAX, nsample = 0;
+    double fraction = 1.0;
+    unsigned long seed = 1;
+    char *index_out = NULL, *index_in = NULL;
+    int have_range = 0;
+    gsl_rng *rng;
+    int n, c;
+
+    while ((c = getopt (argc, argv, "rn:k:R:s:p:S:w:i:h")) != -1)
+        switch (c)
+        {
+            case 'r':
+                print_header = 0;
+                break;
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 'k':
+                stride = atol(optarg);
+                break;
+            case 'R':
+                if (sscanf(optarg, "%ld,%ld", &first, &last) != 2 || first < 1 || last < first) {
+                    fprintf(stderr,"Range must be given as first,last with 1 <= first <= last.\n");
+                    return(1);
+                }
+                first--;
+                last--;
+                have_range = 1;
+                break;
+            case 's':
+                nsample = atol(optarg);
+                break;
+            case 'p':
+                fraction = atof(optarg);
+                break;
+            case 'S':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                index_out = optarg;
+                break;
+            case 'i':
+                index_in = optarg;
+                break;
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'n' || optopt == 'k' || optopt == 'R' || optopt == 's'
+                    || optopt == 'p' || optopt == 'S' || optopt == 'w' || optopt == 'i')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+
+    if (argc - optind == 1) {
+        if (have_range) {
+            fprintf(stderr,"Give either a number of rows to skip or -R, not both.\n");
+            return(1);
+        }
+        first = atol(argv[optind]);
+    }
+    else if (argc - optind > 1 || (argc == 1)) {
+        print_help();
+        return(1);
+    }
+    if (first < 0 || stride < 1 || count < 0 || nsample < 0 || fraction <= 0.0 || fraction > 1.0) {
+        fprintf(stderr,"Row counts must be positive and the fraction in (0,1].\n");
+        return(1);
+    }
+    if (nsample > 0 && (fraction < 1.0 || count != LONG_MAX)) {
+        fprintf(stderr,"-s cannot be used together with -p or -n.\n");
+        return(1);
+    }
+    if (index_in && index_out) {
+        fprintf(stderr,"-i and -w cannot be used together.\n");
+        return(1);
+    }
+
+    rng = gsl_rng_alloc(gsl_rng_mt19937);
+    gsl_rng_set(rng, seed);
+
+    if (index_in) {
+        struct index ix;
+        struct seeker sk;
+        struct stat st;
+        long ncand, wanted;
+        char *buf;
+
+        if (!read_index(index_in, &ix)) {
+            fprintf(stderr,"Cannot read index %s.\n",index_in);
+            return(1);
+        }
+        if (fstat(fileno(stdin), &st) != 0 || !S_ISREG(st.st_mode)) {
+            fprintf(stderr,"-i needs the table as a file on standard input.\n");
+            return(1);
+        }
+        if ((long long) st.st_size != ix.bytes) {
+            fprintf(stderr,"Index %s does not match the input.\n",index_in);
+            return(1);
+        }
+
+        /* The leading header is everything before the first data row */
+        if (print_header) {
+            long long hbytes = ix.nrows ? ix.off[0] : ix.bytes;
+            buf = (char *) malloc(hbytes > 0 ? hbytes : 1);
+            if (fread(buf, 1, hbytes, stdin) != (size_t) hbytes) {
+                fprintf(stderr,"Cannot read the header.\n");
+                return(1);
+            }
+            fwrite(buf, 1, hbytes, stdout);
+            free(buf);
+        }
+
+        if (last > ix.nrows - 1)
+            last = ix.nrows - 1;
+        ncand = first <= last ? (last - first)/stride + 1 : 0;
+        sk.ix = &ix;
+        sk.line = NULL;
+        sk.cap = 0;
+        sk.row = LONG_MAX;
+
+        if (nsample > 0) {
+            /* Floyd's algorithm picks distinct candidates directly */
+            long *pick, m = 0, size = 1;
+            long *table;
+            if (nsample > ncand)
+                nsample = ncand;
+            while (size < 2*nsample)
+                size *= 2;
+            pick = (long *) malloc((nsample > 0 ? nsample : 1)*sizeof(long));
+            table = (long *) malloc(size*sizeof(long));
+            for (long j = 0; j < size; j++)
+                table[j] = -1;
+            for (long j = ncand - nsample; j < ncand; j++) {
+                long t = (long) gsl_rng_uniform_int(rng, j + 1);
+                for (int pass = 0; pass < 2; pass++) {
+                    unsigned long h = ((unsigned long) t*0x9e3779b97f4a7c15UL) & (size - 1);
+                    while (table[h] >= 0 && table[h] != t)
+                        h = (h + 1) & (size - 1);
+                    if (table[h] < 0) {
+                        table[h] = t;
+                        pick[m++] = t;
+                        break;
+                    }
+                    t = j;
+                }
+            }
+            qsort(pick, m, sizeof(long), compare_long);
+            for (long j = 0; j < m; j++) {
+                ssize_t got = seek_row(&sk, first + pick[j]*stride);
+                if (got < 0)
+                    break;
+                write_line(sk.line, got);
+            }
+            free(pick);
+            free(table);
+        }
+        else {
+            wanted = 0;
+            for (long j = geometric_skip(rng, fraction); j >= 0 && j < ncand && wanted < count;
+                 j = advance(j, 1 + geometric_skip(rng, fraction), 1)) {
+                ssize_t got = seek_row(&sk, first + j*stride);
+                if (got < 0)
+                    break;
+                write_line(sk.line, got);
+                wanted++;
+            }
+        }
+        free(sk.line);
+        gsl_rng_free(rng);
+        return(0);
+    }
+
+    {
+        struct reservoir res = {0};
+        FILE *ixfp = NULL;
+        long row = 0, written = 0, next = first;
+        long long bytes = 0, *off = NULL;
+        long noff = 0, offsize = 0;
+        int done = 0;
+
+        if (nsample > 0)
+            reservoir_init(&res, nsample, rng);
+        if (fraction < 1.0)
+            next = advance(next, geometric_skip(rng, fraction), stride);
+        if (index_out && !(ixfp = fopen(index_out, "w"))) {
+            fprintf(stderr,"Cannot write index %s.\n",index_out);
+            return(1);
+        }
+
+        reader_init(&r, stdin);
+        while (!(done && !ixfp) && (n = reader_lines(&r, line, len, BATCH)) > 0) {
+            for (int i = 0; i < n; i++) {
+                const char *s = line[i];
+                long long at = bytes;
+
+                bytes += len[i];
+                if (s[0] == '#') {
+                    if (print_header && !done)
+                        write_line(s, len[i]);
+                    continue;
+                }
+                if (ixfp && row % INDEX_EVERY == 0) {
+                    if (noff == offsize) {
+                        offsize = offsize ? 2*offsize : 1024;
+                        off = (long long *) realloc(off, offsize*sizeof(long long));
+                    }
+                    off[noff++] = at;
+                }
+                row++;
+                if (done || row - 1 != next)
+                    continue;
+
+                /* Row row-1 is a candidate; find the next one */
+                if (nsample > 0) {
+                    reservoir_add(&res, rng, row - 1, s, len[i]);
+                    next = advance(next, 1, stride);
+                }
+                else if (written < count) {
+                    write_line(s, len[i]);
+                    written++;
+                    next = advance(next, 1 + (fraction < 1.0 ? geometric_skip(rng, fraction) : 0), stride);
+                }
+                if (next > last || next < 0 || written >= count)
+                    done = 1;
+            }
+        }
+        reader_free(&r);
+
+        if (nsample > 0) {
+            long m = res.seen < res.size ? res.seen : res.size;
+            qsort(res.kept, m, sizeof(struct kept), compare_kept);
+            for (long j = 0; j < m; j++) {
+                write_line(res.kept[j].line, res.kept[j].len);
+                free(res.kept[j].line);
+            }
+            free(res.kept);
+        }
+
+        if (ixfp) {
+            fprintf(ixfp, "#! tskip_index %d %ld %lld\n", INDEX_EVERY, row, bytes);
+            for (long j = 0; j < noff; j++)
+                fprintf(ixfp, "%lld\n", off[j]);
+            fclose(ixfp);
+            free(off);
+        }
+    }
+
+    gsl_rng_free(rng);
+    return 0;
+}
@@ -0,0 +1,641 @@
+// Sort the rows of a table by one or more columns. The keys of each row
+// are parsed once; rows that fit in the memory budget are sorted in
+// parallel in memory, and larger tables are sorted in runs on disk that
+// are then merged.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <sys/resource.h>
+#include "table.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define BATCH 1024
+#define MAXKEYS 16
+#define CHUNK (8 << 20)     /* bytes of rows held per allocation */
+#define FANIN 64            /* most runs open, and merged, at once */
+#define RUNBUF (1 << 20)    /* largest buffer of a run being written or merged */
+
+char   *help[] = {
+"",
+"NAME",
+"    tsort - sort the rows of a table by one or more columns",
+"",
+"SYNOPSIS",
+"    % tsort [OPTIONS] colname [colname ...] < table.txt ",
+"",
+"OPTIONS",
+"    -r             Sort in decreasing order",
+"    -m megabytes   Memory to use for sorting [default 512]",
+"    -T dir         Directory for temporary files [default $TMPDIR",
+"                   or /tmp]",
+"    -h             Print help",
+"",
+"EXAMPLE",
+"    Sort a light curve by time before smoothing it:",
+"",
+"    % tsort MJD < lc.txt | tlowess MJD FLUX > smooth.txt",
+"",
+"DESCRIPTION",
+"",
+"    This program writes the rows of a SExtractor-format table provided",
+"    via standard input in increasing (or, with -r, decreasing) numerical",
+"    order of the first column named, then of the second, and so on. The",
+"    rows are written whole, and rows with equal keys keep their order.",
+"    Values that are not numbers are sorted after all the numbers. The",
+"    header is written first, followed by any comment lines found among",
+"    the rows; empty rows are dropped.",
+"",
+"    The keys of each row are parsed once, as the table is read. While",
+"    the rows read so far fit in the memory given by -m they are kept in",
+"    memory, and sorted in parallel by all the threads when built with",
+"    OpenMP. A table larger than that is sorted in pieces (runs) that",
+"    fit, each written with its keys to a temporary file. Runs are merged",
+"    as they pile up, 16 of a size at a time, so that no more than 64",
+"    (fewer if the limit on open files is lower) are open at once, and",
+"    the buffers of the runs being merged share the memory given by -m.",
+"    Tables much larger than the memory of the machine can thus be",
+"    sorted with about as much free disk space as the table itself. The",
+"    temporary files are removed as soon as they are created, so nothing",
+"    is left behind if the program is stopped.",
+"",
+"AUTHOR",
+"    Roberto Abraham (abraham@astro.utoronto.ca)",
+"",
+"LAST UPDATE",
+"    Oct. 2026",
+0};
+
+
+void print_help()
+{
+    for (int i = 0; help[i] != 0; i++)
+        fprintf(stdout,"%s\n",help[i]);
+}
+
+
+static int nkeys;
+static int reverse;
+static size_t chunk = CHUNK;
+static int fanin = FANIN;
+static size_t runbuf = RUNBUF;
+
+/* A row held in memory: its keys, followed by its text, ending in a
+ * newline. seq is the position of the row in the table. */
+struct rec {
+    const double *key;
+    size_t len;
+    long seq;
+};
+
+#define REC_TEXT(r) ((const char *) ((r)->key + nkeys))
+
+
+static int compare_keys(const double *ka, long sa, const double *kb, long sb)
+{
+    for (int k = 0; k < nkeys; k++) {
+        double x = ka[k], y = kb[k];
+        int c;
+        if (isnan(x) || isnan(y)) {
+            /* Values that are not numbers go last either way */
+            c = isnan(x) - isnan(y);
+            if (c)
+                return(c);
+            continue;
+        }
+        c = (x > y) - (x < y);
+        if (c)
+            return(reverse ? -c : c);
+    }
+    return((sa > sb) - (sa < sb));
+}
+
+
+static int compare_rec(const void *a, const void *b)
+{
+    const struct rec *ra = (const struct rec *) a;
+    const struct rec *rb = (const struct rec *) b;
+    return(compare_keys(ra->key, ra->seq, rb->key, rb->seq));
+}
+
+
+static int threads(void)
+{
+#ifdef _OPENMP
+    return(omp_get_max_threads());
+#else
+    return(1);
+#endif
+}
+
+
+/* Sort n records: each thread sorts a slice, then the slices are merged
+ * in pairs, the merges of each level running in parallel */
+static void sort_recs(struct rec *a, long n)
+{
+    struct rec *tmp, *src = a, *dst;
+    int nt = threads();
+    long slice = (n + nt - 1)/nt;
+
+    if (n < 2)
+        return;
+    if (slice < 1024)
+        slice = 1024;
+    #pragma omp parallel for schedule(dynamic)
+    for (long lo = 0; lo < n; lo += slice)
+        qsort(a + lo, (lo + slice < n ? slice : n - lo), sizeof(struct rec), compare_rec);
+    if (slice >= n)
+        return;
+
+    tmp = (struct rec *) malloc(n*sizeof(struct rec));
+    dst = tmp;
+    for (long width = slice; width < n; width *= 2) {
+        #pragma omp parallel for schedule(dynamic)
+        for (long lo = 0; lo < n; lo += 2*width) {
+            long mid = lo + width < n ? lo + width : n;
+            long hi = lo + 2*width < n ? lo + 2*width : n;
+            long i = lo, j = mid, k = lo;
+            while (i < mid && j < hi)
+                dst[k++] = compare_rec(&src[j], &src[i]) < 0 ? src[j++] : src[i++];
+            while (i < mid)
+                dst[k++] = src[i++];
+            while (j < hi)
+                dst[k++] = src[j++];
+        }
+        dst = src;
+        src = src == a ? tmp : a;
+    }
+    if (src != a)
+        memcpy(a, src, n*sizeof(struct rec));
+    free(tmp);
+}
+
+
+/* The text and keys of the rows held in memory, in blocks that never move */
+struct arena {
+    char **block;
+    int nblock, size;
+    size_t used, avail;
+    size_t total;
+};
+
+
+static void *arena_alloc(struct arena *ar, size_t bytes)
+{
+    bytes = (bytes + sizeof(double) - 1) & ~(sizeof(double) - 1);
+    if (bytes > ar->avail) {
+        size_t b = bytes > chunk ? bytes : chunk;
+        if (ar->nblock == ar->size) {
+            ar->size = ar->size ? 2*ar->size : 16;
+            ar->block = (char **) realloc(ar->block, ar->size*sizeof(char *));
+        }
+        ar->block[ar->nblock++] = (char *) malloc(b);
+        ar->used = 0;
+        ar->avail = b;
+        ar->total += b;
+    }
+    ar->avail -= bytes;
+    ar->used += bytes;
+    return(ar->block[ar->nblock - 1] + ar->used - bytes);
+}
+
+
+static void arena_free(struct arena *ar)
+{
+    for (int i = 0; i < ar->nblock; i++)
+        free(ar->block[i]);
+    ar->nblock = 0;
+    ar->used = ar->avail = ar->total = 0;
+}
+
+
+/* Read the key fields of a row, setting those that are not numbers to
+ * NAN; returns 0 if the row is empty */
+static int parse_keys(const char *s, size_t len, const int *col, int maxcol, double *key)
+{
+    const char *end = s + len;
+    int found = 0;
+
+    for (int k = 0; k < nkeys; k++)
+        key[k] = NAN;
+    for (int c = 0; c <= maxcol; c++) {
+        const char *t;
+        while (s < end && isspace((unsigned char) *s))
+            s++;
+        if (s == end)
+            break;
+        t = s;
+        while (s < end && !isspace((unsigned char) *s))
+            s++;
+        found = 1;
+        for (int k = 0; k < nkeys; k++)
+            if (col[k] == c) {
+                char *stop;
+                double x = strtod(t, &stop);
+                key[k] = stop == s ? x : NAN;
+            }
+    }
+    return(found);
+}
+
+
+/* A run: records of keys, length, position and text in a temporary file.
+ * While it waits to be merged only its file descriptor is kept; fp and
+ * its buffer exist only while it is written or merged. */
+struct run {
+    FILE *fp;
+    char *vbuf;
+    int fd;
+    int level;
+    double key[MAXKEYS];
+    long seq;
+    char *text;
+    size_t len, cap;
+};
+
+
+/* Start a run in a new temporary file */
+static void run_open(struct run *u, const char *dir)
+{
+    char *name = (char *) malloc(strlen(dir) + 16);
+    FILE *fp = NULL;
+    int fd;
+
+    sprintf(name, "%s/tsortXXXXXX", dir);
+    if ((fd = mkstemp(name)) >= 0) {
+        unlink(name);
+        fp = fdopen(fd, "w+");
+    }
+    if (!fp) {
+        fprintf(stderr,"Cannot make a temporary file in %s.\n",dir);
+        exit(1);
+    }
+    free(name);
+    memset(u, 0, sizeof(struct run));
+    u->fp = fp;
+    u->fd = -1;
+    u->vbuf = (char *) malloc(runbuf);
+    setvbuf(u->fp, u->vbuf, _IOFBF, runbuf);
+}
+
+
+/* Finish writing a run, keeping only a descriptor of its file */
+static void run_finish(struct run *u)
+{
+    if (fflush(u->fp) || (u->fd = dup(fileno(u->fp))) < 0) {
+        fprintf(stderr,"Cannot write a temporary file.\n");
+        exit(1);
+    }
+    fclose(u->fp);
+    free(u->vbuf);
+    u->fp = NULL;
+    u->vbuf = NULL;
+}
+
+
+/* Open a finished run to read it from the start */
+static void run_rewind(struct run *u)
+{
+    if (lseek(u->fd, 0, SEEK_SET) < 0 || !(u->fp = fdopen(u->fd, "r"))) {
+        fprintf(stderr,"Cannot read a temporary file.\n");
+        exit(1);
+    }
+    u->vbuf = (char *) malloc(runbuf);
+    setvbuf(u->fp, u->vbuf, _IOFBF, runbuf);
+}
+
+
+static void run_close(struct run *u)
+{
+    fclose(u->fp);
+    free(u->vbuf);
+    free(u->text);
+}
+
+
+static void run_put(FILE *fp, const double *key, long seq, const char *text, size_t len)
+{
+    if (fwrite(key, sizeof(double), nkeys, fp) != (size_t) nkeys
+        || fwrite(&len, sizeof(size_t), 1, fp) != 1
+        || fwrite(&seq, sizeof(long), 1, fp) != 1
+        || fwrite(text, 1, len, fp) != len) {
+        fprintf(stderr,"Cannot write a temporary file.\n");
+        exit(1);
+    }
+}
+
+
+/* Read the next record of a run; returns 0 at its end */
+static int run_next(struct run *u)
+{
+    if (fread(u->key, sizeof(double), nkeys, u->fp) != (size_t) nkeys)
+        return(0);
+    if (fread(&u->len, sizeof(size_t), 1, u->fp) != 1
+        || fread(&u->seq, sizeof(long), 1, u->fp) != 1) {
+        fprintf(stderr,"Cannot read a temporary file.\n");
+        exit(1);
+    }
+    if (u->len > u->cap) {
+        u->cap = 2*u->len;
+        u->text = (char *) realloc(u->text, u->cap);
+    }
+    if (fread(u->text, 1, u->len, u->fp) != u->len) {
+        fprintf(stderr,"Cannot read a temporary file.\n");
+        exit(1);
+    }
+    return(1);
+}
+
+
+/* Write the sorted records held in memory to a new run */
+static void write_run(struct run *u, const struct rec *rec, long n, const char *dir)
+{
+    run_open(u, dir);
+    for (long i = 0; i < n; i++)
+        run_put(u->fp, rec[i].key, rec[i].seq, REC_TEXT(&rec[i]), rec[i].len);
+    run_finish(u);
+}
+
+
+static int run_less(const struct run *a, const struct run *b)
+{
+    return(compare_keys(a->key, a->seq, b->key, b->seq) < 0);
+}
+
+
+static void sift_down(struct run **heap, int n, int i)
+{
+    for (;;) {
+        int m = i, l = 2*i + 1, r = l + 1;
+        struct run *t;
+        if (l < n && run_less(heap[l], heap[m]))
+            m = l;
+        if (r < n && run_less(heap[r], heap[m]))
+            m = r;
+        if (m == i)
+            return;
+        t = heap[i];
+        heap[i] = heap[m];
+        heap[m] = t;
+        i = m;
+    }
+}
+
+
+/* Merge n runs, closing them, into another run or (out == NULL) as text
+ * to stdout */
+static void merge_runs(struct run *u, int n, FILE *out)
+{
+    struct run **heap = (struct run **) malloc(n*sizeof(struct run *));
+    int m = 0;
+
+    for (int i = 0; i < n; i++) {
+        run_rewind(&u[i]);
+        if (run_next(&u[i]))
+            heap[m++] = &u[i];
+    }
+    for (int i = m/2 - 1; i >= 0; i--)
+        sift_down(heap, m, i);
+    while (m > 0) {
+        struct run *top = heap[0];
+        if (out)
+            run_put(out, top->key, top->seq, top->text, top->len);
+        else
+            fwrite(top->text, 1, top->len, stdout);
+        if (!run_next(top))
+            heap[0] = heap[--m];
+        sift_down(heap, m, 0);
+    }
+    for (int i = 0; i < n; i++)
+        run_close(&u[i]);
+    free(heap);
+}
+
+
+/* Add a new run to the nrun held, merging as they pile up so that no more
+ * than fanin are ever open: whenever the last fanin/4 runs are of one
+ * level (a new run being of level 0) they are merged into a run of the
+ * next level, and should fanin be open anyway they are all merged. Each
+ * row is thus rewritten about once per level. */
+static void push_run(struct run *runs, int *nrun, const char *dir)
+{
+    const int tier = fanin/4 > 2 ? fanin/4 : 2;
+
+    for (;;) {
+        int n = *nrun, m = 0;
+        struct run out;
+
+        if (n >= fanin)
+            m = n;
+        else if (n >= tier) {
+            m = tier;
+            for (int i = n - tier; i < n - 1; i++)
+                if (runs[i].level != runs[n - 1].level)
+                    m = 0;
+        }
+        if (m == 0)
+            return;
+        run_open(&out, dir);
+        merge_runs(runs + n - m, m, out.fp);
+        run_finish(&out);
+        out.level = runs[n - m].level + 1;
+        runs[n - m] = out;
+        *nrun = n - m + 1;
+    }
+}
+
+
+int main (int argc, char **argv)
+{
+    struct reader r;
+    const char *line[BATCH];
+    size_t len[BATCH];
+    char **keyword = NULL;
+    int *number = NULL;
+    int nheader = 0, hsize = 0;
+    char *head = NULL;
+    size_t hlen = 0, hcap = 0;
+    char **colnames;
+    int col[MAXKEYS], maxcol = -1;
+    int resolved = 0;
+    double megabytes = 512;
+    const char *dir = getenv("TMPDIR");
+    struct arena ar = {NULL, 0, 0, 0, 0, 0};
+    struct rec *rec = NULL;
+    long nrec = 0, reccap = 0, seq = 0;
+    size_t budget;
+    struct run *runs = NULL;
+    int nrun = 0;
+    struct rlimit rl;
+    int n, c;
+
+    while ((c = getopt (argc, argv, "rm:T:h")) != -1)
+        switch (c)
+        {
+            case 'r':
+                reverse = 1;
+                break;
+            case 'm':
+                megabytes = atof(optarg);
+                break;
+            case 'T':
+                dir = optarg;
+                break;
+            case 'h':
+                print_help();
+                return(0);
+                break;
+            case '?':
+                if (optopt == 'm' || optopt == 'T')
+                    fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint (optopt))
+                    fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf (stderr,
+                            "Unknown option character `\\x%x'.\n",
+                            optopt);
+                print_help();
+                return 1;
+            default:
+                abort();
+        }
+    nkeys = argc - optind;
+    if (nkeys < 1)
+    {
+        print_help();
+        return(1);
+    }
+    if (nkeys > MAXKEYS) {
+        fprintf(stderr,"At most %d columns can be sorted on.\n",MAXKEYS);
+        return(1);
+    }
+    if (!(megabytes >= 1)) {
+        fprintf(stderr,"The memory must be at least 1 megabyte.\n");
+        return(1);
+    }
+    if (!dir || !*dir)
+        dir = "/tmp";
+    budget = (size_t) (megabytes*1048576.0);
+    if (chunk > budget/8)
+        chunk = budget/8;
+
+    /* Leave a few descriptors for stdio and the run being written */
+    if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur != RLIM_INFINITY && (long) rl.rlim_cur - 8 < fanin)
+        fanin = (long) rl.rlim_cur - 8;
+    if (fanin < 2) {
+        fprintf(stderr,"Too few files can be open to merge temporary files.\n");
+        return(1);
+    }
+    if (runbuf > budget/(fanin + 1))
+        runbuf = budget/(fanin + 1);
+    runs = (struct run *) malloc((fanin + 1)*sizeof(struct run));
+    colnames = argv + optind;
+
+    reader_init(&r, stdin);
+    while ((n = reader_lines(&r, line, len, BATCH)) > 0) {
+        int start = 0;
+
+        /* The header is held until its columns are found */
+        if (!resolved) {
+            for (; start < n; start++) {
+                char name[1024];
+                size_t at;
+                if (line[start][0] != '#')
+                    break;
+                if (hlen + len[start] > hcap) {
+                    hcap = 2*(hlen + len[start]);
+                    head = (char *) realloc(head, hcap);
+                }
+                memcpy(head + hlen, line[start], len[start]);
+                hlen += len[start];
+                if (len[start] > 1 && line[start][1] == '!')
+                    continue;
+                if (nheader == hsize) {
+                    hsize = hsize ? 2*hsize : 64;
+                    keyword = (char **) realloc(keyword, hsize*sizeof(char *));
+                    number = (int *) realloc(number, hsize*sizeof(int));
+                }
+                if (!header_column(line[start], len[start], &number[nheader], name, sizeof(name), &at)
+                    || number[nheader] < 1)
+                    continue;
+                keyword[nheader++] = strdup(name);
+            }
+            if (start == n)
+                continue;
+            for (int k = 0; k < nkeys; k++) {
+                int j;
+                for (j = 0; j < nheader && strcmp(keyword[j], colnames[k]); j++)
+                    ;
+                if (j == nheader) {
+                    fprintf(stderr,"Keyword %s not found.\n",colnames[k]);
+                    return(1);
+                }
+                col[k] = number[j] - 1;
+                if (col[k] > maxcol)
+                    maxcol = col[k];
+            }
+            fwrite(head, 1, hlen, stdout);
+            resolved = 1;
+        }
+
+        /* Comment lines among the rows are written as they arrive */
+        for (int i = start; i < n; i++)
+            if (line[i][0] == '#')
+                fwrite(line[i], 1, len[i], stdout);
+
+        for (int i = start; i < n; i++) {
+            double kv[MAXKEYS], *key;
+            size_t l = len[i];
+            if (line[i][0] == '#' || !parse_keys(line[i], len[i], col, maxcol, kv))
+                continue;
+            if (nrec == reccap) {
+                reccap = reccap ? 2*reccap : 65536;
+                rec = (struct rec *) realloc(rec, reccap*sizeof(struct rec));
+            }
+            if (line[i][l - 1] != '\n')
+                l++;
+            key = (double *) arena_alloc(&ar, nkeys*sizeof(double) + l);
+            memcpy(key, kv, nkeys*sizeof(double));
+            memcpy((char *) (key + nkeys), line[i], l - 1);
+            ((char *) (key + nkeys))[l - 1] = '\n';
+            rec[nrec].key = key;
+            rec[nrec].len = l;
+            rec[nrec++].seq = seq++;
+        }
+
+        /* Spill a sorted run when the rows held outgrow the memory. The
+         * records count twice, for the merges of the sort. */
+        if (ar.total + 2*nrec*sizeof(struct rec) > budget && nrec > 0) {
+            sort_recs(rec, nrec);
+            write_run(&runs[nrun++], rec, nrec, dir);
+            arena_free(&ar);
+            free(rec);
+            rec = NULL;
+            nrec = reccap = 0;
+            push_run(runs, &nrun, dir);
+        }
+    }
+    reader_free(&r);
+    if (!resolved)
+        fwrite(head, 1, hlen, stdout);
+
+    sort_recs(rec, nrec);
+    if (nrun == 0) {
+        for (long i = 0; i < nrec; i++)
+            fwrite(REC_TEXT(&rec[i]), 1, rec[i].len, stdout);
+        return(0);
+    }
+    if (nrec > 0)
+        write_run(&runs[nrun++], rec, nrec, dir);
+    arena_free(&ar);
+    free(rec);
+    push_run(runs, &nrun, dir);
+    merge_runs(runs, nrun, NULL);
+
+    return 0;
+}
@@ -27,6 +27,7 @@ my $yformat = 0;
 my $parabola = ();
 my @polynomial = ();
 my $symbol = 17;
+my $decimate = 1;
 
 $help = 1 if $#ARGV == -1;
 $result = GetOptions(
@@ -58,6 +59,7 @@ $result = GetOptions(
     "gaussian=f{3}" => \@gaussian,
     "polynomial=f{,}" => \@polynomial,
     "serial" => \$serial, 
+    "decimate!" => \$decimate,
     "help|?" => \$help, 
      man=> \$man) or pod2usage(2);
 pod2usage(1) if $help;
@@ -79,6 +81,35 @@ if ($#ARGV==2) {
 die "Error: DATE must be on the X-axis; stopped" if $keyY =~ /^DATE/;
 die "Error: DATE must be on the X-axis; stopped" if $keySigma =~ /^DATE/;
 
+# Large tables are thinned to the points that can be seen on the plot
+# by tdecimate, when it is installed. Ranges go to it in data units.
+my $input = \*STDIN;
+if ($decimate && !$serial && !$extra && !defined($covariance)
+    && grep { -x "$_/tdecimate" } split(/:/, $ENV{PATH})) {
+    my @args = ('-m', ($joined || $pulse || $histogram) ? 'minmax' : 'grid');
+    push(@args, '-W', defined($png_width) ? $png_width : 1024);
+    push(@args, '-H', defined($png_height) ? $png_height : 1024);
+    if (defined($explicit_xmin) && defined($explicit_xmax) && $keyX !~ /^DATE/) {
+        push(@args, '-l', '-x', (10**$explicit_xmin).','.(10**$explicit_xmax)) if $xlog;
+        push(@args, '-x', "$explicit_xmin,$explicit_xmax") if !$xlog;
+    }
+    elsif ($xlog) {
+        push(@args, '-l');
+    }
+    if (defined($explicit_ymin) && defined($explicit_ymax) && !$skylevel) {
+        push(@args, '-L', '-y', (10**$explicit_ymin).','.(10**$explicit_ymax)) if $ylog;
+        push(@args, '-y', "$explicit_ymin,$explicit_ymax") if !$ylog;
+    }
+    elsif ($ylog && !$skylevel) {
+        push(@args, '-L');
+    }
+    push(@args, '--', $keyX, $keyY);
+    push(@args, $keySigma) if $has_errorbars;
+    my $pid = open($input, '-|');
+    die "Error: cannot start tdecimate; stopped" unless defined($pid);
+    exec('tdecimate', @args) or die "Error: cannot run tdecimate; stopped" if $pid == 0;
+}
+
 # Load the data table
 my $xmax = -1e100;
 my $xmin =  1e100;
@@ -88,7 +119,7 @@ my $colnum=0;
 my $count=0;
 my @serial_numbers = ();
 
-while(<STDIN>)
+while(<$input>)
 {
     my $line = $_;
     if ($line =~ /^#/) {
@@ -453,6 +484,15 @@ Controls whether the Y axis is labeled in decimal or exponential format.  1:
 force decimal labelling, instead of automatic choice.  2: force exponential
 labelling, instead of automatic.
 
+=item B<--nodecimate>
+
+Plot every row. By default, if the tdecimate program is on the path,
+the table is first thinned to the points that can be seen on the plot
+(one per pixel for points, the extremes of each pixel column for
+--joined, --pulse and --hist), so that tables of millions of rows plot
+in seconds. Tables are not thinned with --serial, --extra or
+--covariance.
+
 =item B<--hist>
 
 Draw using a histogram style.